@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+#include "accel.hpp"
+#include "isa.hpp"
+
+namespace {
+
+/** Record a hit if it is closer than the best so far, breaking ties in favor
+  of the object which comes first in the scene. */
+void keep_closest(std::optional<Hit>& best, const std::optional<Hit>& h) {
+    if (h && (!best || h->t < best->t || (h->t == best->t && h->object < best->object))) {
+        best = h;
+    }
+}
+
+/** Sort objects into those with bounds, returning the bounds, and those
+  without. */
+std::vector<BoundingBox> partition_bounded(const Primitives& objects,
+                                           std::vector<size_t>& bounded,
+                                           std::vector<size_t>& unbounded) {
+    std::vector<BoundingBox> boxes;
+    for (size_t i = 0; i < objects.size(); i++) {
+        std::optional<BoundingBox> b = objects.bounds(i);
+        if (b) {
+            bounded.push_back(i);
+            boxes.push_back(*b);
+        } else {
+            unbounded.push_back(i);
+        }
+    }
+    return boxes;
+}
+
+/** The closest hit among the unbounded objects and the bounded objects
+  kept in a spatial structure (a BVH or grid). */
+template <typename Structure>
+std::optional<Hit> closest_hit(const Ray& r, const Primitives& objects,
+                               const std::vector<size_t>& bounded,
+                               const std::vector<size_t>& unbounded,
+                               const Structure& structure) {
+    std::optional<Hit> best;
+    for (size_t i : unbounded) {
+        keep_closest(best, objects.collision(i, r));
+    }
+    Real limit = best ? best->t : std::numeric_limits<Real>::infinity();
+    structure.traverse(r, limit, [&](uint32_t prim, Real& t_max) {
+        size_t i = bounded[prim];
+        keep_closest(best, objects.collision(i, r));
+        if (best) {
+            t_max = best->t;
+        }
+        return false;
+    });
+    return best;
+}
+
+/** Whether the ray hits any of the objects before t_max. */
+template <typename Structure>
+bool any_hit(const Ray& r, Real t_max, const Primitives& objects,
+             const std::vector<size_t>& bounded, const std::vector<size_t>& unbounded,
+             const Structure& structure) {
+    for (size_t i : unbounded) {
+        if (objects.occludes(i, r, t_max)) {
+            return true;
+        }
+    }
+    return structure.traverse(r, t_max, [&](uint32_t prim, [[maybe_unused]] Real& limit) {
+        return objects.occludes(bounded[prim], r, t_max);
+    });
+}
+
+/** A limit for SphereSet::closest which lets it return hits at exactly the
+  current best time, so that keep_closest can break the tie. */
+Real tie_limit(Real t) {
+    return std::nextafter(t, std::numeric_limits<Real>::infinity());
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}
+
+void Accelerator::intersect_packet(const RayPacket& p, std::optional<Hit>* hits) const {
+    for (size_t k = 0; k < p.size; k++) {
+        if ((p.active >> k) & 1) {
+            hits[k] = this->intersect(p.ray(k));
+        }
+    }
+}
+
+uint32_t Accelerator::occluded_packet(const RayPacket& p, Real t_max) const {
+    uint32_t blocked = 0;
+    for (size_t k = 0; k < p.size; k++) {
+        if ((p.active >> k) & 1) {
+            blocked |= (uint32_t) this->occluded(p.ray(k), t_max) << k;
+        }
+    }
+    return blocked;
+}
+
+LinearScan::LinearScan(const Primitives& objs):
+    objects{objs},
+    spheres{},
+    others{}
+{
+    for (size_t i = 0; i < this->objects.size(); i++) {
+        this->add(i);
+    }
+}
+
+void LinearScan::add(size_t i) {
+    const CompiledSphere* s = this->objects.as_sphere(i);
+    if (s) {
+        this->spheres.add(s->get_center(), s->get_radius(), i);
+    } else {
+        this->others.push_back(i);
+    }
+}
+
+std::optional<Hit> LinearScan::intersect(const Ray& r) const {
+    std::optional<Hit> best;
+    std::optional<SphereHit> h = this->spheres.closest(r, 0, this->spheres.size(),
+                                                       std::numeric_limits<Real>::infinity());
+    if (h) {
+        best = Hit{this->spheres.id(h->index), h->t, 0, 0};
+    }
+    for (size_t i : this->others) {
+        keep_closest(best, this->objects.collision(i, r));
+    }
+    return best;
+}
+
+bool LinearScan::occluded(const Ray& r, Real t_max) const {
+    for (size_t i : this->others) {
+        if (this->objects.occludes(i, r, t_max)) {
+            return true;
+        }
+    }
+    return this->spheres.closest(r, 0, this->spheres.size(), t_max).has_value();
+}
+
+std::string LinearScan::summary() const {
+    return "linear scan over " + std::to_string(this->objects.size()) + " objects (" +
+        std::to_string(this->spheres.size()) + " spheres, " + isa_name(current_isa()) + " kernel)";
+}
+
+BVHAccelerator::BVHAccelerator(const Primitives& objs,
+                               BVH::Builder b, ThreadPool& pool):
+    objects{objs},
+    bounded{},
+    unbounded{},
+    bvh{},
+    spheres{},
+    builder{b},
+    build_seconds{0.0}
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<BoundingBox> boxes = partition_bounded(this->objects, this->bounded,
+                                                       this->unbounded);
+    this->bvh.build(boxes, this->builder, pool);
+    bool all_spheres = std::all_of(this->bounded.begin(), this->bounded.end(), [&](size_t i) {
+        return this->objects.kind(i) == Primitives::Kind::sphere;
+    });
+    if (all_spheres) {
+        for (uint32_t prim : this->bvh.ordering()) {
+            size_t i = this->bounded[prim];
+            const CompiledSphere* s = this->objects.as_sphere(i);
+            this->spheres.add(s->get_center(), s->get_radius(), i);
+        }
+    }
+    this->build_seconds = seconds_since(start);
+}
+
+std::optional<Hit> BVHAccelerator::intersect(const Ray& r) const {
+    if (this->spheres.size() == 0) {
+        return closest_hit(r, this->objects, this->bounded, this->unbounded, this->bvh);
+    }
+    std::optional<Hit> best;
+    for (size_t i : this->unbounded) {
+        keep_closest(best, this->objects.collision(i, r));
+    }
+    Real limit = best ? best->t : std::numeric_limits<Real>::infinity();
+    this->bvh.traverse_leaves(r, limit, [&](uint32_t first, uint32_t count, Real& t_max) {
+        std::optional<SphereHit> h = this->spheres.closest(r, first, first + count,
+                                                           tie_limit(t_max));
+        if (h) {
+            keep_closest(best, Hit{this->spheres.id(h->index), h->t, 0, 0});
+            t_max = best->t;
+        }
+        return false;
+    });
+    return best;
+}
+
+bool BVHAccelerator::occluded(const Ray& r, Real t_max) const {
+    if (this->spheres.size() == 0) {
+        return any_hit(r, t_max, this->objects, this->bounded, this->unbounded, this->bvh);
+    }
+    for (size_t i : this->unbounded) {
+        if (this->objects.occludes(i, r, t_max)) {
+            return true;
+        }
+    }
+    return this->bvh.traverse_leaves(r, t_max, [&](uint32_t first, uint32_t count,
+                                                   [[maybe_unused]] Real& limit) {
+        return this->spheres.closest(r, first, first + count, t_max).has_value();
+    });
+}
+
+template <size_t W>
+void BVHAccelerator::packet_closest(const RayPacket& p, std::optional<Hit>* hits) const {
+    Real t[W];
+    size_t object[W];
+    // The unbounded objects' hits, which keep their parts unless a sphere
+    // is hit first.
+    std::optional<Hit> unbounded_hit[W];
+    for (size_t k = 0; k < W; k++) {
+        std::optional<Hit>& best = unbounded_hit[k];
+        if ((p.active >> k) & 1) {
+            Ray r = p.ray(k);
+            for (size_t i : this->unbounded) {
+                keep_closest(best, this->objects.collision(i, r));
+            }
+        }
+        t[k] = best ? best->t : std::numeric_limits<Real>::infinity();
+        object[k] = best ? best->object : std::numeric_limits<size_t>::max();
+    }
+    this->bvh.traverse_packet<W>(p, p.active, t, [&](uint32_t first, uint32_t count,
+                                                     uint32_t lanes) {
+        this->spheres.closest_packet(p, lanes, first, first + count, t, object);
+        return 0u;
+    });
+    for (size_t k = 0; k < p.size; k++) {
+        if (!((p.active >> k) & 1)) {
+            continue;
+        }
+        if (object[k] == std::numeric_limits<size_t>::max()) {
+            hits[k] = std::optional<Hit>();
+        } else if (unbounded_hit[k] && object[k] == unbounded_hit[k]->object) {
+            hits[k] = unbounded_hit[k];
+        } else {
+            hits[k] = Hit{object[k], t[k], 0, 0};
+        }
+    }
+}
+
+template <size_t W>
+uint32_t BVHAccelerator::packet_occluded(const RayPacket& p, Real t_max) const {
+    uint32_t blocked = 0;
+    for (size_t k = 0; k < p.size; k++) {
+        if ((p.active >> k) & 1) {
+            Ray r = p.ray(k);
+            for (size_t i : this->unbounded) {
+                if (this->objects.occludes(i, r, t_max)) {
+                    blocked |= 1u << k;
+                    break;
+                }
+            }
+        }
+    }
+    Real limit[W];
+    std::fill(limit, limit + W, t_max);
+    this->bvh.traverse_packet<W>(p, p.active & ~blocked, limit, [&](uint32_t first,
+                                                                    uint32_t count,
+                                                                    uint32_t lanes) {
+        uint32_t hit = this->spheres.occluded_packet(p, lanes, first, first + count, t_max);
+        blocked |= hit;
+        return hit;
+    });
+    return blocked;
+}
+
+void BVHAccelerator::intersect_packet(const RayPacket& p, std::optional<Hit>* hits) const {
+    if (this->spheres.size() == 0) {
+        Accelerator::intersect_packet(p, hits);
+    } else if (p.size > 8) {
+        this->packet_closest<16>(p, hits);
+    } else if (p.size > 4) {
+        this->packet_closest<8>(p, hits);
+    } else {
+        this->packet_closest<4>(p, hits);
+    }
+}
+
+uint32_t BVHAccelerator::occluded_packet(const RayPacket& p, Real t_max) const {
+    if (this->spheres.size() == 0) {
+        return Accelerator::occluded_packet(p, t_max);
+    } else if (p.size > 8) {
+        return this->packet_occluded<16>(p, t_max);
+    } else if (p.size > 4) {
+        return this->packet_occluded<8>(p, t_max);
+    } else {
+        return this->packet_occluded<4>(p, t_max);
+    }
+}
+
+std::string BVHAccelerator::summary() const {
+    std::ostringstream out;
+    out << (this->builder == BVH::Builder::sah ? "SAH" : "median split") << " BVH over "
+        << this->bounded.size() << " objects (+" << this->unbounded.size()
+        << " unbounded): " << this->bvh.node_count() << " nodes, SAH cost "
+        << this->bvh.sah_cost() << ", built in " << this->build_seconds << " s";
+    if (this->spheres.size() > 0) {
+        out << ", " << isa_name(current_isa()) << " sphere leaves";
+    }
+    return out.str();
+}
+
+GridAccelerator::GridAccelerator(const Primitives& objs):
+    objects{objs},
+    bounded{},
+    unbounded{},
+    grid{},
+    build_seconds{0.0}
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<BoundingBox> boxes = partition_bounded(this->objects, this->bounded,
+                                                       this->unbounded);
+    this->grid.build(boxes, 2.0);
+    this->build_seconds = seconds_since(start);
+}
+
+std::optional<Hit> GridAccelerator::intersect(const Ray& r) const {
+    return closest_hit(r, this->objects, this->bounded, this->unbounded, this->grid);
+}
+
+bool GridAccelerator::occluded(const Ray& r, Real t_max) const {
+    return any_hit(r, t_max, this->objects, this->bounded, this->unbounded, this->grid);
+}
+
+std::string GridAccelerator::summary() const {
+    std::ostringstream out;
+    const int* dims = this->grid.resolution();
+    out << "grid over " << this->bounded.size() << " objects (+" << this->unbounded.size()
+        << " unbounded): " << dims[0] << "x" << dims[1] << "x" << dims[2] << " cells, "
+        << (double) this->grid.ref_count() / std::max<size_t>(1, this->bounded.size())
+        << " cells per object, built in " << this->build_seconds << " s";
+    return out.str();
+}
+
+std::unique_ptr<Accelerator> make_accelerator(const std::string& name,
+                                              const Primitives& objects,
+                                              ThreadPool& pool) {
+    if (name == "linear") {
+        return std::make_unique<LinearScan>(objects);
+    } else if (name == "bvh") {
+        return std::make_unique<BVHAccelerator>(objects, BVH::Builder::sah, pool);
+    } else if (name == "bvh-median") {
+        return std::make_unique<BVHAccelerator>(objects, BVH::Builder::median, pool);
+    } else if (name == "grid") {
+        return std::make_unique<GridAccelerator>(objects);
+    } else {
+        throw std::invalid_argument("Unknown accelerator: " + name);
+    }
+}
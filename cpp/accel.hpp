@@ -0,0 +1,127 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "bvh.hpp"
+#include "grid.hpp"
+#include "packet.hpp"
+#include "primitives.hpp"
+#include "spheres.hpp"
+#include "thread_pool.hpp"
+#include "types.hpp"
+
+/**
+ * An acceleration structure answers ray queries against a fixed list of
+ * objects. Every accelerator must give exactly the same answers as testing
+ * every object in order; in particular when two objects are hit at the same
+ * time the one which comes first in the list wins.
+ */
+class Accelerator {
+public:
+    virtual ~Accelerator() {}
+
+    /** Find the closest object the ray hits, if any. */
+    virtual std::optional<Hit> intersect(const Ray&) const = 0;
+
+    /** Check whether the ray hits anything before time t_max. Stops at the
+      first such hit, whichever object it is. */
+    virtual bool occluded(const Ray&, Real) const = 0;
+
+    /** A one line description of the structure and what it cost to build. */
+    virtual std::string summary() const = 0;
+
+    /** Find the closest hit of each active ray in a packet, writing it to
+      hits[lane]. Unless overridden, the rays are traced one at a time. */
+    virtual void intersect_packet(const RayPacket&, std::optional<Hit>*) const;
+
+    /** The mask of active lanes whose ray hits something before time t_max.
+      Unless overridden, the rays are traced one at a time. */
+    virtual uint32_t occluded_packet(const RayPacket&, Real) const;
+};
+
+/**
+ * Tests every object against every ray. Spheres are copied into a SphereSet
+ * and tested several at a time.
+ */
+class LinearScan: public Accelerator {
+private:
+    const Primitives& objects;
+    SphereSet spheres;
+    // Indices of the objects which are not spheres.
+    std::vector<size_t> others;
+
+public:
+    LinearScan(const Primitives&);
+
+    /** Start testing an object added to the list after this was built. */
+    void add(size_t);
+
+    std::optional<Hit> intersect(const Ray&) const override;
+    bool occluded(const Ray&, Real) const override;
+    std::string summary() const override;
+};
+
+/**
+ * Keeps bounded objects in a bounding volume hierarchy. Unbounded objects
+ * such as planes are kept in a separate list and tested against every ray.
+ */
+class BVHAccelerator: public Accelerator {
+private:
+    const Primitives& objects;
+    // Indices into objects of the primitives in the hierarchy, in the order
+    // the hierarchy knows them.
+    std::vector<size_t> bounded;
+    std::vector<size_t> unbounded;
+    BVH bvh;
+    // When every bounded object is a sphere, the spheres in the hierarchy's
+    // order so that each leaf is tested as a batch. Empty otherwise.
+    SphereSet spheres;
+    BVH::Builder builder;
+    double build_seconds;
+
+public:
+    BVHAccelerator(const Primitives&, BVH::Builder, ThreadPool&);
+
+    std::optional<Hit> intersect(const Ray&) const override;
+    bool occluded(const Ray&, Real) const override;
+    std::string summary() const override;
+    /** Packets walk the tree together when the leaves hold only spheres. */
+    void intersect_packet(const RayPacket&, std::optional<Hit>*) const override;
+    uint32_t occluded_packet(const RayPacket&, Real) const override;
+
+private:
+    template <size_t W>
+    void packet_closest(const RayPacket&, std::optional<Hit>*) const;
+    template <size_t W>
+    uint32_t packet_occluded(const RayPacket&, Real) const;
+};
+
+/**
+ * Keeps bounded objects in a uniform grid and, like the BVH accelerator,
+ * unbounded objects in a list tested against every ray.
+ */
+class GridAccelerator: public Accelerator {
+private:
+    const Primitives& objects;
+    std::vector<size_t> bounded;
+    std::vector<size_t> unbounded;
+    Grid grid;
+    double build_seconds;
+
+public:
+    GridAccelerator(const Primitives&);
+
+    std::optional<Hit> intersect(const Ray&) const override;
+    bool occluded(const Ray&, Real) const override;
+    std::string summary() const override;
+};
+
+/** Build an accelerator by name over the given objects: "linear", "bvh" (built
+  with the surface area heuristic), "bvh-median" or "grid". The accelerator refers to
+  the list, which must outlive it and must not change while it is in use. */
+std::unique_ptr<Accelerator> make_accelerator(const std::string&,
+                                              const Primitives&,
+                                              ThreadPool&);
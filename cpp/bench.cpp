@@ -0,0 +1,1302 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "generator.hpp"
+#include "image.hpp"
+#include "instance.hpp"
+#include "isa.hpp"
+#include "mesh.hpp"
+#include "obj_file.hpp"
+#include "packet.hpp"
+#include "prototype.hpp"
+#include "renderer.hpp"
+#include "rng.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include "scene_json.hpp"
+#include "spheres.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * Benchmarks for the renderer, one per subcommand. Each one prints a small
+ * table to stdout.
+ */
+
+namespace {
+
+/** Root mean squared difference of two images over all channels, after
+  clamping to the displayable range. */
+double rmse(Image& a, Image& b, size_t width, size_t height) {
+    double sum = 0.0;
+    for (size_t j = 0; j < height; j++) {
+        for (size_t i = 0; i < width; i++) {
+            Color ca = a(i, j);
+            Color cb = b(i, j);
+            double dr = clamp_channel(ca.red) - clamp_channel(cb.red);
+            double dg = clamp_channel(ca.green) - clamp_channel(cb.green);
+            double db = clamp_channel(ca.blue) - clamp_channel(cb.blue);
+            sum += dr * dr + dg * dg + db * db;
+        }
+    }
+    return std::sqrt(sum / (3 * width * height));
+}
+
+/**
+ * The arguments to a benchmark: positional arguments followed by options of
+ * the form "--name value". Only the option names a benchmark declares are
+ * accepted; anything else is an error which shows the benchmark's usage.
+ */
+class Options {
+private:
+    std::string usage;
+    std::vector<std::string> positional;
+    std::map<std::string, std::string> named;
+
+public:
+    Options(const std::vector<std::string>& args, size_t required,
+            const std::vector<std::string>& allowed, const std::string& u):
+        usage{u},
+        positional{},
+        named{}
+    {
+        size_t i = 0;
+        for (; i < args.size() && args[i].rfind("--", 0) != 0; i++) {
+            this->positional.push_back(args[i]);
+        }
+        for (; i < args.size(); i += 2) {
+            if (i + 1 == args.size() ||
+                    std::find(allowed.begin(), allowed.end(), args[i]) == allowed.end()) {
+                throw std::invalid_argument(this->usage);
+            }
+            this->named[args[i]] = args[i + 1];
+        }
+        if (this->positional.size() != required) {
+            throw std::invalid_argument(this->usage);
+        }
+    }
+
+    const std::string& arg(size_t i) const {
+        return this->positional.at(i);
+    }
+
+    std::string get(const std::string& name, const std::string& fallback) const {
+        auto it = this->named.find(name);
+        return it == this->named.end() ? fallback : it->second;
+    }
+
+    size_t get(const std::string& name, size_t fallback) const {
+        auto it = this->named.find(name);
+        return it == this->named.end() ? fallback : std::stoul(it->second);
+    }
+};
+
+void parse_size(const std::string& size, Scene& scene) {
+    size_t x = size.find('x');
+    if (x == std::string::npos) {
+        throw std::invalid_argument("Bad image size: " + size);
+    }
+    scene.pixel_width = std::stoul(size.substr(0, x));
+    scene.pixel_height = std::stoul(size.substr(x + 1));
+}
+
+/** Check whether two images hold exactly the same colors. */
+bool identical(Image& a, Image& b, size_t width, size_t height) {
+    for (size_t j = 0; j < height; j++) {
+        for (size_t i = 0; i < width; i++) {
+            Color ca = a(i, j);
+            Color cb = b(i, j);
+            if (ca.red != cb.red || ca.green != cb.green || ca.blue != cb.blue) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Hides a built-in shape from the scene's typed storage, so that it is stored
+ * and called like a custom shape: behind a pointer, through the vtable.
+ */
+template <typename T>
+class Virtual final: public Object {
+private:
+    T shape;
+
+public:
+    Virtual(const T& s):
+        Object(0.0, Color(0, 0, 0)),
+        shape{s}
+    {}
+
+    std::optional<Real> collision(Ray r) const override {
+        return this->shape.collision(r);
+    }
+
+    Vector normal(Point p) const override {
+        return this->shape.normal(p);
+    }
+
+    Color get_color(Point p) const override {
+        return this->shape.get_color(p);
+    }
+
+    Real get_reflectivity(Point p) const override {
+        return this->shape.get_reflectivity(p);
+    }
+
+    std::optional<BoundingBox> bounds() const override {
+        return this->shape.bounds();
+    }
+};
+
+/** Add a shape to the scene, wrapped in Virtual if asked. */
+template <typename T>
+void add_shape(Scene& scene, const T& shape, bool virtual_dispatch) {
+    if (virtual_dispatch) {
+        scene.add_object(std::make_unique<Virtual<T>>(shape));
+    } else {
+        scene.add_object(std::make_unique<T>(shape));
+    }
+}
+
+/** The generator of a deterministic cloud of n spheres spread uniformly over
+  a checkerboard floor (see generator.hpp), the scene of most benchmarks and
+  of make regress. About mirror_percent of the spheres are mirrors of the
+  given reflectivity. */
+SceneGenerator sphere_cloud(size_t n, uint64_t seed, double mirror_percent = 30,
+                            double mirror_reflectivity = 0.7) {
+    GeneratorSettings settings;
+    settings.objects = n;
+    settings.seed = seed;
+    settings.mirror_percent = mirror_percent;
+    settings.mirror_reflectivity = mirror_reflectivity;
+    return SceneGenerator(settings);
+}
+
+/** Fill a scene with the objects of sphere_cloud, in front of the same
+  camera and light as shiny.json. */
+void add_sphere_cloud(Scene& scene, size_t n, uint64_t seed, bool virtual_dispatch = false,
+                      size_t mirror_percent = 30, double mirror_reflectivity = 0.7) {
+    scene.camera = Point(0.5, -1.0, 0.5);
+    scene.light = Point(0.0, -0.5, 1.0);
+    sphere_cloud(n, seed, mirror_percent, mirror_reflectivity).for_each_object([&](const auto& shape) {
+        add_shape(scene, shape, virtual_dispatch);
+    });
+}
+
+std::vector<std::string> split_list(const std::string& list) {
+    std::vector<std::string> items;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        items.push_back(list.substr(pos, comma - pos));
+        pos = comma + 1;
+    }
+    return items;
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/** Render a low-noise reference image with many Sobol samples per pixel,
+  leaving the scene's sampling settings as they were. The reference uses a
+  different seed so that its noise is independent of the images being
+  measured. */
+Image render_reference(Scene& scene, const Renderer& renderer, size_t spp) {
+    Image reference(scene.pixel_width, scene.pixel_height);
+    std::unique_ptr<Sampler> sampler = std::move(scene.sampler);
+    size_t antialias = scene.antialias;
+    uint64_t seed = scene.seed;
+    double threshold = scene.adaptive_threshold;
+    scene.sampler = make_sampler("sobol");
+    scene.antialias = spp;
+    scene.seed = seed ^ 0x5eed;
+    scene.adaptive_threshold = 0.0;
+    renderer.render(reference);
+    scene.sampler = std::move(sampler);
+    scene.antialias = antialias;
+    scene.seed = seed;
+    scene.adaptive_threshold = threshold;
+    return reference;
+}
+
+/**
+ * Error against a high sample count reference for each sampler at increasing
+ * samples per pixel.
+ */
+int bench_samplers(const std::vector<std::string>& args) {
+    Options opts(args, 1, {"--size", "--reference-spp", "--max-spp", "--threads"},
+                 "Usage: ./bench samplers <scene-file> [--size WxH] "
+                 "[--reference-spp N] [--max-spp N] [--threads N]");
+    ThreadPool pool(opts.get("--threads", 0));
+    Scene scene(opts.arg(0), pool);
+    parse_size(opts.get("--size", "128x128"), scene);
+    size_t reference_spp = opts.get("--reference-spp", 1024);
+    size_t max_spp = opts.get("--max-spp", 64);
+    Renderer renderer(scene, pool, 32);
+
+    Image reference = render_reference(scene, renderer, reference_spp);
+
+    const std::vector<std::string> names = {"random", "stratified", "halton", "sobol"};
+    std::cout << "RMSE vs. " << reference_spp << " spp reference, "
+              << scene.pixel_width << "x" << scene.pixel_height << std::endl;
+    std::cout << std::setw(6) << "spp";
+    for (const std::string& name : names) {
+        std::cout << std::setw(12) << name;
+    }
+    std::cout << std::endl;
+    for (size_t spp = 1; spp <= max_spp; spp *= 2) {
+        std::cout << std::setw(6) << spp;
+        for (const std::string& name : names) {
+            scene.sampler = make_sampler(name);
+            scene.antialias = spp;
+            Image img(scene.pixel_width, scene.pixel_height);
+            renderer.render(img);
+            std::cout << std::setw(12) << std::fixed << std::setprecision(3)
+                      << rmse(img, reference, scene.pixel_width, scene.pixel_height);
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+/**
+ * Samples taken and error against a reference for adaptive antialiasing at a
+ * range of thresholds, compared with taking the scene's fixed sample count
+ * everywhere.
+ */
+int bench_adaptive(const std::vector<std::string>& args) {
+    Options opts(args, 1, {"--size", "--sampler", "--threads"},
+                 "Usage: ./bench adaptive <scene-file> [--size WxH] "
+                 "[--sampler S] [--threads N]");
+    ThreadPool pool(opts.get("--threads", 0));
+    Scene scene(opts.arg(0), pool);
+    parse_size(opts.get("--size", "128x128"), scene);
+    std::string sampler = opts.get("--sampler", "sobol");
+    Renderer renderer(scene, pool, 32);
+    size_t spp = scene.antialias;
+    Image reference = render_reference(scene, renderer, 1024);
+    scene.sampler = make_sampler(sampler);
+
+    uint64_t fixed = scene.pixel_width * scene.pixel_height * spp;
+    std::cout << sampler << " sampler, up to " << spp << " spp, "
+              << scene.pixel_width << "x" << scene.pixel_height << std::endl;
+    std::cout << std::setw(10) << "threshold" << std::setw(12) << "samples"
+              << std::setw(10) << "saved" << std::setw(10) << "RMSE" << std::endl;
+    for (double threshold : {0.0, 8.0, 4.0, 2.0, 1.0, 0.5}) {
+        scene.adaptive_threshold = threshold;
+        Image img(scene.pixel_width, scene.pixel_height);
+        RenderStats stats = renderer.render(img);
+        uint64_t samples = stats.total().samples;
+        std::cout << std::setw(10);
+        if (threshold > 0) {
+            std::cout << threshold;
+        } else {
+            std::cout << "fixed";
+        }
+        std::cout << std::setw(12) << samples
+                  << std::setw(9) << std::fixed << std::setprecision(1)
+                  << 100.0 * (fixed - samples) / fixed << "%"
+                  << std::setw(10) << std::setprecision(3)
+                  << rmse(img, reference, scene.pixel_width, scene.pixel_height)
+                  << std::defaultfloat << std::endl;
+    }
+    return 0;
+}
+
+/**
+ * Build and render time for each accelerator on sphere clouds of increasing
+ * size, checking that every accelerator produces the same image as the first
+ * one listed.
+ */
+int bench_accel(const std::vector<std::string>& args) {
+    Options opts(args, 0, {"--objects", "--accels", "--size", "--threads", "--no-render"},
+                 "Usage: ./bench accel [--objects N,N,...] [--accels A,B,...] "
+                 "[--size WxH] [--threads N] [--no-render 1]");
+    std::vector<std::string> counts = split_list(opts.get("--objects", "10,100,1000,10000"));
+    std::vector<std::string> names = split_list(opts.get("--accels", "linear,bvh-median,bvh,grid"));
+    bool render = opts.get("--no-render", 0) == 0;
+    ThreadPool pool(opts.get("--threads", 0));
+    std::cout << std::setw(10) << "objects" << std::setw(12) << "accel"
+              << std::setw(12) << "build (s)" << std::setw(12) << "render (s)"
+              << std::setw(12) << "same image" << std::endl;
+    for (const std::string& count : counts) {
+        size_t n = std::stoul(count);
+        Scene scene(Point(0, 0, 0));
+        parse_size(opts.get("--size", "128x128"), scene);
+        add_sphere_cloud(scene, n, 1);
+        Renderer renderer(scene, pool, 32);
+        Image baseline(scene.pixel_width, scene.pixel_height);
+        for (size_t k = 0; k < names.size(); k++) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            scene.build_accelerator(names[k], pool);
+            double build = seconds_since(start);
+            std::cout << std::setw(10) << n << std::setw(12) << names[k]
+                      << std::fixed << std::setprecision(4) << std::setw(12) << build;
+            if (render) {
+                Image img(scene.pixel_width, scene.pixel_height);
+                double seconds = renderer.render(img).seconds;
+                bool same = true;
+                if (k == 0) {
+                    baseline = std::move(img);
+                } else {
+                    same = identical(img, baseline, scene.pixel_width, scene.pixel_height);
+                }
+                std::cout << std::setw(12) << seconds << std::setw(12) << (same ? "yes" : "NO");
+            }
+            std::cout << std::defaultfloat << std::endl;
+            std::cout << "    " << scene.accelerator_summary() << std::endl;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Time the shadow rays of a render as closest-hit queries, which is how they
+ * used to be traced, and as occlusion queries which stop at the first hit and
+ * at the light.
+ */
+int bench_shadows(const std::vector<std::string>& args) {
+    Options opts(args, 0, {"--scene", "--objects", "--accels", "--size", "--threads"},
+                 "Usage: ./bench shadows [--scene FILE | --objects N] [--accels A,B,...] "
+                 "[--size WxH]");
+    ThreadPool pool(opts.get("--threads", 0));
+    std::unique_ptr<Scene> scene;
+    if (opts.get("--scene", "") != "") {
+        scene = std::make_unique<Scene>(opts.get("--scene", ""), pool);
+    } else {
+        scene = std::make_unique<Scene>(Point(0, 0, 0));
+        add_sphere_cloud(*scene, opts.get("--objects", 10000), 1);
+    }
+    parse_size(opts.get("--size", "512x512"), *scene);
+
+    std::cout << std::setw(12) << "accel" << std::setw(14) << "shadow rays"
+              << std::setw(16) << "closest (ns)" << std::setw(16) << "occluded (ns)"
+              << std::setw(10) << "blocked" << std::setw(10) << "now" << std::endl;
+    for (const std::string& name : split_list(opts.get("--accels", "linear,bvh,grid"))) {
+        scene->build_accelerator(name, pool);
+        // One shadow ray from the first hit of each pixel's center ray.
+        std::vector<Ray> rays;
+        for (size_t j = 0; j < scene->pixel_height; j++) {
+            for (size_t i = 0; i < scene->pixel_width; i++) {
+                Point p((i + 0.5) / scene->pixel_width, 0,
+                        1 - (j + 0.5) / scene->pixel_width);
+                Ray primary(p, p - scene->camera);
+                std::optional<Hit> hit = scene->intersect(primary);
+                if (hit) {
+                    Point collision = primary.at(hit->t);
+                    rays.push_back(scene->shadow_ray(collision));
+                }
+            }
+        }
+
+        // Anything the old query hit behind the light counted as a shadow,
+        // so it may report more blocked rays than the new one.
+        size_t blocked_closest = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (const Ray& r : rays) {
+            blocked_closest += scene->intersect(r).has_value();
+        }
+        double closest = seconds_since(start);
+        start = std::chrono::steady_clock::now();
+        size_t blocked = 0;
+        for (const Ray& r : rays) {
+            blocked += scene->occluded(r, Scene::shadow_limit);
+        }
+        double occluded = seconds_since(start);
+        std::cout << std::setw(12) << name << std::setw(14) << rays.size()
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(16) << 1e9 * closest / rays.size()
+                  << std::setw(16) << 1e9 * occluded / rays.size()
+                  << std::setw(10) << blocked_closest << std::setw(10) << blocked
+                  << std::defaultfloat << std::endl;
+    }
+    return 0;
+}
+
+size_t file_size(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    return in ? (size_t) in.tellg() : 0;
+}
+
+/**
+ * Run `f` in a child process and return how long it took and the child's peak
+ * resident memory in MB. A process's peak only ever grows, so each measurement
+ * needs a process of its own.
+ */
+std::pair<double, double> measure_in_child(const std::function<void()>& f) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw std::runtime_error("pipe failed");
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw std::runtime_error("fork failed");
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        int code = 0;
+        try {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            f();
+            double seconds = seconds_since(start);
+            code = write(fds[1], &seconds, sizeof(seconds)) == sizeof(seconds) ? 0 : 1;
+        } catch (const std::exception& e) {
+            std::cout << e.what() << std::endl;
+            code = 1;
+        }
+        _exit(code);
+    }
+    close(fds[1]);
+    double seconds = 0;
+    bool got = read(fds[0], &seconds, sizeof(seconds)) == sizeof(seconds);
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    if (!got || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error("Measured process failed");
+    }
+    // ru_maxrss is in kilobytes on Linux.
+    return {seconds, usage.ru_maxrss / 1024.0};
+}
+
+/**
+ * Time loading a sphere cloud of each size, and measure the peak memory it
+ * takes, in three ways:
+ *   json-dom  the old loader: parse the whole JSON file into a tree, then
+ *             add each entry of "objects"
+ *   json-sax  the streaming loader trace uses for JSON, once for each of
+ *             --threads, which parses the objects on that many threads
+ *   binary    the scene file compiled from the same cloud
+ * Each load builds a Scene up to and including its accelerator, a linear scan
+ * unless --accel says otherwise, and runs in a process of its own. The files
+ * are written to --dir and removed afterwards. JSON is only written up to
+ * --json-max objects, and only loaded into a tree up to --dom-max, since the
+ * tree takes several times the memory of the file. The other loads use the
+ * first of --threads.
+ */
+int bench_load(const std::vector<std::string>& args) {
+    Options opts(args, 0, {"--objects", "--dir", "--json-max", "--dom-max", "--accel",
+                           "--threads"},
+                 "Usage: ./bench load [--objects N,N,...] [--dir DIR] [--json-max N] "
+                 "[--dom-max N] [--accel NAME] [--threads N,N,...]");
+    std::vector<std::string> counts = split_list(opts.get("--objects", "1000,100000,10000000"));
+    std::string dir = opts.get("--dir", "/tmp");
+    size_t json_max = opts.get("--json-max", 1000000);
+    size_t dom_max = opts.get("--dom-max", 1000000);
+    std::string accel = opts.get("--accel", "linear");
+    std::vector<size_t> thread_counts;
+    for (const std::string& t : split_list(opts.get("--threads", "1,2,4,8,16,32"))) {
+        thread_counts.push_back(std::stoul(t));
+    }
+    size_t threads = thread_counts.front();
+    nlohmann::json settings = {
+        {"camera", {0.5, -1.0, 0.5}},
+        {"light", {0.0, -0.5, 1.0}},
+        {"antialias", 1},
+        {"accelerator", accel},
+    };
+    std::cout << std::setw(10) << "objects" << std::setw(10) << "format"
+              << std::setw(9) << "threads" << std::setw(12) << "file (MB)" << std::setw(12) << "load (s)"
+              << std::setw(14) << "objects/s" << std::setw(16) << "peak RSS (MB)" << std::endl;
+    for (const std::string& count : counts) {
+        size_t n = std::stoul(count);
+        std::string json_file = dir + "/rtlc-load-" + count + ".json";
+        std::string scene_file = dir + "/rtlc-load-" + count + ".rtlc";
+        std::vector<std::tuple<std::string, size_t, std::function<void()>>> loads;
+        if (n <= json_max) {
+            JsonSceneWriter writer(json_file, settings);
+            sphere_cloud(n, 1).for_each_object([&](const auto& shape) { writer.add(shape); });
+            writer.close();
+            if (n <= dom_max) {
+                loads.emplace_back("json-dom", threads, [&]() {
+                    ThreadPool pool(threads);
+                    Scene scene(Point(0, 0, 0));
+                    std::ifstream infile(json_file);
+                    nlohmann::json data = nlohmann::json::parse(infile);
+                    for (nlohmann::json obj : data["objects"]) {
+                        scene.add_object(parse_object(obj, dir));
+                    }
+                    scene.build_accelerator(accel, pool);
+                });
+            }
+            for (size_t t : thread_counts) {
+                loads.emplace_back("json-sax", t, [&, t]() {
+                    ThreadPool pool(t);
+                    Scene scene(json_file, pool);
+                });
+            }
+        }
+        {
+            SceneFileWriter writer;
+            sphere_cloud(n, 1).for_each_object([&](const auto& shape) { writer.add(shape); });
+            writer.write(scene_file, settings);
+        }
+        loads.emplace_back("binary", threads, [&]() {
+            ThreadPool pool(threads);
+            Scene scene(scene_file, pool);
+        });
+        for (const auto& [name, load_threads, load] : loads) {
+            auto [seconds, peak] = measure_in_child(load);
+            const std::string& file = name == "binary" ? scene_file : json_file;
+            std::cout << std::setw(10) << n << std::setw(10) << name
+                      << std::setw(9) << load_threads << std::fixed << std::setprecision(1) << std::setw(12)
+                      << file_size(file) / 1e6
+                      << std::setprecision(4) << std::setw(12) << seconds
+                      << std::setprecision(0) << std::setw(14) << (n + 1) / seconds
+                      << std::setprecision(1) << std::setw(16) << peak
+                      << std::defaultfloat << std::endl;
+        }
+        std::remove(json_file.c_str());
+        std::remove(scene_file.c_str());
+    }
+    return 0;
+}
+
+/**
+ * Write a sphere as an OBJ file of about n triangles, with a normal at each
+ * vertex. Rings of vertices run from pole to pole, so the triangles touching a
+ * pole are degenerate, and every edge is shared by two triangles.
+ */
+void write_sphere_obj(const std::string& filename, size_t n, Point center, double radius) {
+    size_t rings = std::max<size_t>(2, (size_t) std::sqrt(n / 4.0));
+    size_t segments = 2 * rings;
+    std::ofstream out(filename);
+    out << std::setprecision(17);
+    for (size_t i = 0; i <= rings; i++) {
+        double theta = M_PI * i / rings;
+        for (size_t j = 0; j < segments; j++) {
+            double phi = 2 * M_PI * j / segments;
+            Vector d(std::sin(theta) * std::cos(phi), std::sin(theta) * std::sin(phi),
+                     std::cos(theta));
+            Point p = center + radius * d;
+            out << "v " << p.x << " " << p.y << " " << p.z << "\n"
+                << "vn " << d.x << " " << d.y << " " << d.z << "\n";
+        }
+    }
+    auto corner = [&](size_t i, size_t j) {
+        size_t k = i * segments + j % segments + 1;
+        return std::to_string(k) + "//" + std::to_string(k);
+    };
+    for (size_t i = 0; i < rings; i++) {
+        for (size_t j = 0; j < segments; j++) {
+            out << "f " << corner(i, j) << " " << corner(i + 1, j) << " "
+                << corner(i + 1, j + 1) << " " << corner(i, j + 1) << "\n";
+        }
+    }
+}
+
+/**
+ * Render shiny.json's scene with its red sphere replaced by a mesh of each
+ * number of triangles, read from an OBJ file written to --dir. Reports the
+ * time to read the file, to build the mesh's hierarchy and to render, and the
+ * rays traced per second. Also shoots --leak-rays rays from the center of the
+ * closed mesh and counts those which get out between its triangles, which the
+ * watertight test should never let happen.
+ */
+int bench_mesh(const std::vector<std::string>& args) {
+    Options opts(args, 0, {"--triangles", "--size", "--threads", "--dir", "--leak-rays"},
+                 "Usage: ./bench mesh [--triangles N,N,...] [--size WxH] [--threads N] "
+                 "[--dir DIR] [--leak-rays N]");
+    std::vector<std::string> counts = split_list(opts.get("--triangles", "1000,100000,1000000"));
+    std::string dir = opts.get("--dir", "/tmp");
+    size_t leak_rays = opts.get("--leak-rays", 1000000);
+    ThreadPool pool(opts.get("--threads", 0));
+    Point center(0.25, 0.45, 0.4);
+    std::cout << std::setw(10) << "triangles" << std::setw(12) << "file (MB)"
+              << std::setw(10) << "read (s)" << std::setw(11) << "build (s)"
+              << std::setw(12) << "render (s)" << std::setw(10) << "Mrays/s"
+              << std::setw(8) << "leaks" << std::endl;
+    for (const std::string& count : counts) {
+        std::string filename = dir + "/rtlc-mesh-" + count + ".obj";
+        write_sphere_obj(filename, std::stoul(count), center, 0.4);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::shared_ptr<MeshGeometry> geometry = read_obj(filename);
+        double read = seconds_since(start);
+        start = std::chrono::steady_clock::now();
+        geometry->build(pool);
+        double build = seconds_since(start);
+
+        Scene scene(Point(0.5, -1.0, 0.5));
+        scene.light = Point(0.0, -0.5, 1.0);
+        parse_size(opts.get("--size", "512x512"), scene);
+        scene.add_object(std::make_unique<TriangleMesh>(0.7, Color(255, 0, 0), geometry));
+        scene.add_object(std::make_unique<Sphere>(0.7, Color(0, 255, 0), Point(1.0, 1.0, 0.25),
+                                                  0.25));
+        scene.add_object(std::make_unique<Sphere>(0.7, Color(0, 0, 255), Point(0.8, 0.3, 0.15),
+                                                  0.15));
+        scene.add_object(std::make_unique<Plane>(0.0, Color(255, 255, 255), Vector(0, 0, 1),
+                                                 Point(0, 0, 0), Color(0, 0, 0),
+                                                 Vector(0, 1, 0)));
+        scene.build_accelerator("bvh", pool);
+        Image img(scene.pixel_width, scene.pixel_height);
+        RenderStats stats = Renderer(scene, pool, 32).render(img);
+        TraceStats total = stats.total();
+
+        TriangleMesh mesh(0.0, Color(), geometry);
+        size_t leaks = 0;
+        for (size_t k = 0; k < leak_rays; k++) {
+            SampleRng rng(0, k, 0);
+            double z = 2 * rng.next_double() - 1;
+            double phi = 2 * M_PI * rng.next_double();
+            double r = std::sqrt(1 - z * z);
+            leaks += !mesh.collision(Ray(center, Vector(r * std::cos(phi), r * std::sin(phi), z)));
+        }
+        std::cout << std::setw(10) << geometry->triangle_count() << std::fixed
+                  << std::setprecision(1) << std::setw(12) << file_size(filename) / 1e6
+                  << std::setprecision(3) << std::setw(10) << read << std::setw(11) << build
+                  << std::setw(12) << stats.seconds << std::setprecision(2) << std::setw(10)
+                  << 1e-6 * (total.rays + total.shadow_rays) / stats.seconds
+                  << std::setw(8) << leaks << std::defaultfloat << std::endl;
+        std::remove(filename.c_str());
+    }
+    return 0;
+}
+
+/**
+ * Render each number of copies of a cluster of --spheres spheres, each copy
+ * turned about the vertical and placed on a grid facing the camera, in two
+ * layouts:
+ *   instanced  one prototype holding the cluster, with an instance for each
+ *              copy
+ *   flat       every sphere of every copy added to the scene on its own
+ * and report the time to build the scene and render it and the peak memory
+ * it took, each in a process of its own. Flat scenes are only built up to
+ * --flat-max spheres in all. The scaling keeps spheres round, so both layouts
+ * render the same picture.
+ */
+int bench_instances(const std::vector<std::string>& args) {
+    Options opts(args, 0, {"--copies", "--spheres", "--size", "--threads", "--flat-max"},
+                 "Usage: ./bench instances [--copies N,N,...] [--spheres N] [--size WxH] "
+                 "[--threads N] [--flat-max N]");
+    std::vector<std::string> counts = split_list(opts.get("--copies", "10,100,1000,10000"));
+    size_t cluster = opts.get("--spheres", 100);
+    size_t threads = opts.get("--threads", 0);
+    size_t flat_max = opts.get("--flat-max", 2000000);
+    std::string size = opts.get("--size", "256x256");
+    // The cluster, within the unit ball.
+    std::vector<Sphere> spheres;
+    for (size_t i = 0; i < cluster; i++) {
+        SampleRng rng(3, i, 0);
+        Point center(0, 0, 0);
+        do {
+            center = Point(2 * rng.next_double() - 1, 2 * rng.next_double() - 1,
+                           2 * rng.next_double() - 1);
+        } while ((center - Point(0, 0, 0)).magnitude() > 0.8);
+        double radius = 0.4 / std::cbrt((double) cluster) * (0.5 + rng.next_double());
+        Color color(255 * rng.next_double(), 255 * rng.next_double(), 255 * rng.next_double());
+        spheres.push_back(Sphere(rng.next_double() < 0.3 ? 0.5 : 0.0, color, center, radius));
+    }
+    std::cout << std::setw(10) << "copies" << std::setw(11) << "layout"
+              << std::setw(12) << "spheres" << std::setw(12) << "time (s)"
+              << std::setw(16) << "peak RSS (MB)" << std::endl;
+    for (const std::string& count : counts) {
+        size_t n = std::stoul(count);
+        size_t side = (size_t) std::ceil(std::sqrt((double) n));
+        double cell = 1.0 / side;
+        std::vector<AffineTransform> placements;
+        for (size_t k = 0; k < n; k++) {
+            SampleRng rng(4, k, 0);
+            double scale = 0.45 * cell;
+            Point at((k % side + 0.5) * cell, 0.5, (k / side + 0.5) * cell);
+            placements.push_back(AffineTransform::scaling(Vector(scale, scale, scale))
+                                     .then(AffineTransform::rotation(Vector(0, 0, 1),
+                                                                     360 * rng.next_double()))
+                                     .then(AffineTransform::translation(at - Point(0, 0, 0))));
+        }
+        auto render = [&](Scene& scene, ThreadPool& pool) {
+            scene.light = Point(0.0, -0.5, 1.0);
+            parse_size(size, scene);
+            scene.build_accelerator("bvh", pool);
+            Image img(scene.pixel_width, scene.pixel_height);
+            Renderer(scene, pool, 32).render(img);
+        };
+        std::vector<std::pair<std::string, std::function<void()>>> layouts;
+        layouts.emplace_back("instanced", [&]() {
+            ThreadPool pool(threads);
+            auto prototype = std::make_shared<Prototype>();
+            for (const Sphere& s : spheres) {
+                prototype->add_object(std::make_unique<Sphere>(s));
+            }
+            prototype->build_accelerator("bvh", pool);
+            Scene scene(Point(0.5, -1.0, 0.5));
+            for (const AffineTransform& t : placements) {
+                scene.add_instance(Instance(prototype, t));
+            }
+            render(scene, pool);
+        });
+        if (n * cluster <= flat_max) {
+            layouts.emplace_back("flat", [&]() {
+                ThreadPool pool(threads);
+                Scene scene(Point(0.5, -1.0, 0.5));
+                for (const AffineTransform& t : placements) {
+                    // The scale is the length the transform gives a unit
+                    // vector.
+                    double scale = t.apply(Vector(1, 0, 0)).magnitude();
+                    for (const Sphere& s : spheres) {
+                        scene.add_object(std::make_unique<Sphere>(
+                            s.get_reflectivity(s.get_center()), s.get_color(s.get_center()),
+                            t.apply(s.get_center()), scale * s.get_radius()));
+                    }
+                }
+                render(scene, pool);
+            });
+        }
+        for (const auto& [name, layout] : layouts) {
+            auto [seconds, peak] = measure_in_child(layout);
+            std::cout << std::setw(10) << n << std::setw(11) << name
+                      << std::setw(12) << n * cluster << std::fixed << std::setprecision(3)
+                      << std::setw(12) << seconds << std::setprecision(1) << std::setw(16)
+                      << peak << std::defaultfloat << std::endl;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Time one ray against n spheres, first through the virtual Sphere::collision
+ * one sphere at a time, then with each SphereSet kernel the CPU supports,
+ * checking that every kernel finds the same sphere at the same time.
+ */
+int bench_spheres(const std::vector<std::string>& args) {
+    Options opts(args, 0, {"--spheres", "--tests"},
+                 "Usage: ./bench spheres [--spheres N,N,...] [--tests N]");
+    std::vector<std::string> counts = split_list(opts.get("--spheres", "4,16,64,256,4096"));
+    size_t tests = opts.get("--tests", 1 << 24);
+    std::vector<Isa> isas = supported_isas();
+    Isa original = current_isa();
+    std::cout << std::setw(10) << "spheres" << std::setw(12) << "virtual";
+    for (Isa isa : isas) {
+        std::cout << std::setw(12) << isa_name(isa);
+    }
+    std::cout << "   (ns per ray-sphere test)" << std::endl;
+    for (const std::string& count : counts) {
+        size_t n = std::stoul(count);
+        std::vector<std::unique_ptr<Object>> objects;
+        SphereSet set;
+        double radius = 0.3 / std::cbrt((double) n);
+        for (size_t i = 0; i < n; i++) {
+            SampleRng rng(1, i, 0);
+            Point center(rng.next_double(), rng.next_double(), rng.next_double());
+            double r = radius * (0.5 + rng.next_double());
+            objects.push_back(std::make_unique<Sphere>(0.0, Color(0, 0, 0), center, r));
+            set.add(center, r, i);
+        }
+        std::vector<Ray> rays;
+        for (size_t k = 0; k < std::max<size_t>(1, tests / n); k++) {
+            SampleRng rng(2, k, 0);
+            Point start(rng.next_double(), -1.0, rng.next_double());
+            Point target(rng.next_double(), rng.next_double(), rng.next_double());
+            rays.push_back(Ray(start, target - start));
+        }
+        double per_test = 1e9 / ((double) rays.size() * n);
+
+        std::vector<std::optional<Hit>> expected(rays.size());
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (size_t k = 0; k < rays.size(); k++) {
+            std::optional<Hit> best;
+            for (size_t i = 0; i < n; i++) {
+                std::optional<Real> t = objects[i]->collision(rays[k]);
+                if (t && (!best || *t < best->t)) {
+                    best = Hit{i, *t, 0, 0};
+                }
+            }
+            expected[k] = best;
+        }
+        std::cout << std::setw(10) << n << std::fixed << std::setprecision(3)
+                  << std::setw(12) << per_test * seconds_since(start);
+
+        bool same = true;
+        for (Isa isa : isas) {
+            select_isa(isa);
+            std::vector<std::optional<SphereHit>> found(rays.size());
+            start = std::chrono::steady_clock::now();
+            for (size_t r = 0; r < rays.size(); r++) {
+                found[r] = set.closest(rays[r], 0, n, std::numeric_limits<Real>::infinity());
+            }
+            std::cout << std::setw(12) << per_test * seconds_since(start);
+            for (size_t r = 0; r < rays.size(); r++) {
+                if (found[r].has_value() != expected[r].has_value() ||
+                        (found[r] && (found[r]->index != expected[r]->object ||
+                                      found[r]->t != expected[r]->t))) {
+                    same = false;
+                }
+            }
+        }
+        std::cout << std::defaultfloat << (same ? "" : "   MISMATCH") << std::endl;
+    }
+    select_isa(original);
+    return 0;
+}
+
+/**
+ * Render sphere clouds with the objects in the scene's typed arrays and again
+ * with every object wrapped as a custom shape, which is stored behind a
+ * pointer and called through the vtable as all objects used to be.
+ */
+int bench_dispatch(const std::vector<std::string>& args) {
+    Options opts(args, 0, {"--objects", "--accels", "--size", "--threads"},
+                 "Usage: ./bench dispatch [--objects N,N,...] [--accels A,B,...] "
+                 "[--size WxH] [--threads N]");
+    std::vector<std::string> counts = split_list(opts.get("--objects", "1000,10000,100000"));
+    std::vector<std::string> names = split_list(opts.get("--accels", "bvh,grid"));
+    ThreadPool pool(opts.get("--threads", 0));
+    std::cout << std::setw(10) << "objects" << std::setw(12) << "accel"
+              << std::setw(12) << "typed (s)" << std::setw(14) << "virtual (s)"
+              << std::setw(10) << "speedup" << std::setw(12) << "same image" << std::endl;
+    for (const std::string& count : counts) {
+        size_t n = std::stoul(count);
+        Scene typed(Point(0, 0, 0));
+        Scene boxed(Point(0, 0, 0));
+        parse_size(opts.get("--size", "128x128"), typed);
+        parse_size(opts.get("--size", "128x128"), boxed);
+        add_sphere_cloud(typed, n, 1, false);
+        add_sphere_cloud(boxed, n, 1, true);
+        for (const std::string& name : names) {
+            typed.build_accelerator(name, pool);
+            boxed.build_accelerator(name, pool);
+            Image a(typed.pixel_width, typed.pixel_height);
+            Image b(boxed.pixel_width, boxed.pixel_height);
+            double fast = Renderer(typed, pool, 32).render(a).seconds;
+            double slow = Renderer(boxed, pool, 32).render(b).seconds;
+            bool same = identical(a, b, typed.pixel_width, typed.pixel_height);
+            std::cout << std::setw(10) << n << std::setw(12) << name
+                      << std::fixed << std::setprecision(4) << std::setw(12) << fast
+                      << std::setw(14) << slow << std::setprecision(2)
+                      << std::setw(10) << slow / fast << std::setw(12) << (same ? "yes" : "NO")
+                      << std::defaultfloat << std::endl;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Rays per second for camera and shadow rays traced one at a time and in
+ * packets of neighboring pixels, then the whole render at each packet size.
+ */
+int bench_packets(const std::vector<std::string>& args) {
+    Options opts(args, 0,
+                 {"--scene", "--objects", "--accel", "--size", "--threads", "--isa"},
+                 "Usage: ./bench packets [--scene FILE | --objects N] [--accel NAME] "
+                 "[--size WxH] [--threads N] [--isa NAME]");
+    if (opts.get("--isa", "") != "") {
+        select_isa(parse_isa(opts.get("--isa", "")));
+    }
+    ThreadPool pool(opts.get("--threads", 0));
+    std::unique_ptr<Scene> scene;
+    if (opts.get("--scene", "") != "") {
+        scene = std::make_unique<Scene>(opts.get("--scene", ""), pool);
+    } else {
+        scene = std::make_unique<Scene>(Point(0, 0, 0));
+        add_sphere_cloud(*scene, opts.get("--objects", 10000), 1);
+    }
+    parse_size(opts.get("--size", "512x512"), *scene);
+    scene->build_accelerator(opts.get("--accel", "bvh"), pool);
+    std::cout << scene->accelerator_summary() << std::endl;
+
+    // The center ray of every pixel, row by row.
+    std::vector<Ray> primary;
+    for (size_t j = 0; j < scene->pixel_height; j++) {
+        for (size_t i = 0; i < scene->pixel_width; i++) {
+            Point p((i + 0.5) / scene->pixel_width, 0, 1 - (j + 0.5) / scene->pixel_width);
+            primary.push_back(Ray(p, p - scene->camera));
+        }
+    }
+    std::vector<std::optional<Hit>> expected(primary.size());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < primary.size(); r++) {
+        expected[r] = scene->intersect(primary[r]);
+    }
+    double primary_single = seconds_since(start);
+    std::vector<Ray> shadow;
+    for (size_t r = 0; r < primary.size(); r++) {
+        if (expected[r]) {
+            Point collision = primary[r].at(expected[r]->t);
+            shadow.push_back(scene->shadow_ray(collision));
+        }
+    }
+    std::vector<bool> blocked(shadow.size());
+    start = std::chrono::steady_clock::now();
+    for (size_t r = 0; r < shadow.size(); r++) {
+        blocked[r] = scene->occluded(shadow[r], Scene::shadow_limit);
+    }
+    double shadow_single = seconds_since(start);
+
+    std::cout << std::setw(8) << "packet" << std::setw(18) << "camera (Mray/s)"
+              << std::setw(18) << "shadow (Mray/s)" << std::setw(12) << "render (s)"
+              << std::setw(12) << "same" << std::endl;
+    Image baseline(scene->pixel_width, scene->pixel_height);
+    for (size_t width : {1, 4, 8, 16}) {
+        bool same = true;
+        double primary_seconds = primary_single;
+        double shadow_seconds = shadow_single;
+        if (width > 1) {
+            std::vector<std::optional<Hit>> hits(primary.size());
+            start = std::chrono::steady_clock::now();
+            for (size_t first = 0; first < primary.size(); first += width) {
+                RayPacket p(std::min(width, primary.size() - first));
+                for (size_t k = 0; k < p.size; k++) {
+                    p.set(k, primary[first + k]);
+                }
+                scene->get_intersections(p, &hits[first]);
+            }
+            primary_seconds = seconds_since(start);
+            std::vector<bool> packet_blocked(shadow.size());
+            start = std::chrono::steady_clock::now();
+            for (size_t first = 0; first < shadow.size(); first += width) {
+                RayPacket p(std::min(width, shadow.size() - first));
+                for (size_t k = 0; k < p.size; k++) {
+                    p.set(k, shadow[first + k]);
+                }
+                uint32_t mask = scene->occluded(p, Scene::shadow_limit);
+                for (size_t k = 0; k < p.size; k++) {
+                    packet_blocked[first + k] = (mask >> k) & 1;
+                }
+            }
+            shadow_seconds = seconds_since(start);
+            for (size_t r = 0; r < primary.size(); r++) {
+                if (hits[r].has_value() != expected[r].has_value() ||
+                        (hits[r] && (hits[r]->object != expected[r]->object ||
+                                     hits[r]->t != expected[r]->t))) {
+                    same = false;
+                }
+            }
+            same = same && packet_blocked == blocked;
+        }
+        scene->packet_size = width;
+        Image img(scene->pixel_width, scene->pixel_height);
+        double render = Renderer(*scene, pool, 32).render(img).seconds;
+        if (width == 1) {
+            baseline = std::move(img);
+        } else {
+            same = same && identical(img, baseline, scene->pixel_width, scene->pixel_height);
+        }
+        std::cout << std::setw(8) << width << std::fixed << std::setprecision(2)
+                  << std::setw(18) << 1e-6 * primary.size() / primary_seconds
+                  << std::setw(18) << 1e-6 * shadow.size() / shadow_seconds
+                  << std::setprecision(4) << std::setw(12) << render
+                  << std::setw(12) << (same ? "yes" : "NO") << std::defaultfloat << std::endl;
+    }
+    return 0;
+}
+
+
+/**
+ * Renders a scene with the depth-first tracer and with the wavefront engine at
+ * several batch sizes, reporting rays per second over all camera, reflected
+ * and shadow rays. The default scene is a sphere cloud of mirrors, where most
+ * rays bounce several times.
+ */
+int bench_wavefront(const std::vector<std::string>& args) {
+    Options opts(args, 0,
+                 {"--scene", "--objects", "--mirrors", "--accel", "--size", "--threads",
+                  "--packet", "--batches"},
+                 "Usage: ./bench wavefront [--scene FILE | --objects N] [--mirrors PERCENT] "
+                 "[--accel NAME] [--size WxH] [--threads N] [--packet N] [--batches N,N,...]");
+    ThreadPool pool(opts.get("--threads", 0));
+    std::unique_ptr<Scene> scene;
+    if (opts.get("--scene", "") != "") {
+        scene = std::make_unique<Scene>(opts.get("--scene", ""), pool);
+    } else {
+        scene = std::make_unique<Scene>(Point(0, 0, 0));
+        add_sphere_cloud(*scene, opts.get("--objects", 1000), 1, false,
+                         opts.get("--mirrors", 100));
+    }
+    parse_size(opts.get("--size", "512x512"), *scene);
+    scene->build_accelerator(opts.get("--accel", "bvh"), pool);
+    scene->packet_size = opts.get("--packet", 1);
+    if (!valid_packet_size(scene->packet_size)) {
+        throw std::invalid_argument("Bad packet size: " + std::to_string(scene->packet_size));
+    }
+    std::cout << scene->accelerator_summary() << std::endl;
+
+    std::vector<size_t> batches = {0};
+    for (const std::string& b : split_list(opts.get("--batches", "256,1024,4096,16384"))) {
+        batches.push_back(std::stoul(b));
+    }
+    std::cout << std::setw(12) << "batch" << std::setw(12) << "render (s)"
+              << std::setw(12) << "Mray/s" << std::setw(14) << "rays/sample"
+              << std::setw(12) << "same" << std::endl;
+    Image baseline(scene->pixel_width, scene->pixel_height);
+    for (size_t batch : batches) {
+        scene->wavefront_batch = batch;
+        Image img(scene->pixel_width, scene->pixel_height);
+        RenderStats stats = Renderer(*scene, pool, 32).render(img);
+        TraceStats total = stats.total();
+        bool same = true;
+        if (batch == 0) {
+            baseline = std::move(img);
+        } else {
+            same = identical(img, baseline, scene->pixel_width, scene->pixel_height);
+        }
+        std::cout << std::setw(12) << (batch == 0 ? "depth-first" : std::to_string(batch))
+                  << std::fixed << std::setprecision(4) << std::setw(12) << stats.seconds
+                  << std::setprecision(2)
+                  << std::setw(12) << 1e-6 * (total.rays + total.shadow_rays) / stats.seconds
+                  << std::setw(14) << (double) total.rays / total.samples
+                  << std::setw(12) << (same ? "yes" : "NO") << std::defaultfloat << std::endl;
+    }
+    return 0;
+}
+
+
+/**
+ * Renders a sphere cloud of mirrors following every reflection, then with
+ * each cutoff, with and without roulette. Reports the time, the average
+ * number of rays per path and how far each image is from the exact one.
+ */
+int bench_reflections(const std::vector<std::string>& args) {
+    Options opts(args, 0,
+                 {"--objects", "--mirrors", "--reflectivity", "--size", "--threads",
+                  "--antialias", "--cutoffs"},
+                 "Usage: ./bench reflections [--objects N] [--mirrors PERCENT] "
+                 "[--reflectivity R] [--size WxH] [--threads N] [--antialias N] "
+                 "[--cutoffs L,L,...]");
+    ThreadPool pool(opts.get("--threads", 0));
+    Scene scene(Point(0, 0, 0));
+    add_sphere_cloud(scene, opts.get("--objects", 1000), 1, false, opts.get("--mirrors", 100),
+                     std::stod(opts.get("--reflectivity", "0.7")));
+    parse_size(opts.get("--size", "512x512"), scene);
+    scene.antialias = opts.get("--antialias", 4);
+    scene.build_accelerator("bvh", pool);
+
+    std::cout << std::setw(10) << "cutoff" << std::setw(10) << "roulette"
+              << std::setw(12) << "render (s)" << std::setw(14) << "rays/sample"
+              << std::setw(10) << "cut (%)" << std::setw(10) << "RMSE" << std::endl;
+    Image exact(scene.pixel_width, scene.pixel_height);
+    double exact_seconds = 0.0;
+    std::vector<double> cutoffs = {0.0};
+    for (const std::string& c : split_list(opts.get("--cutoffs", "0.5,2"))) {
+        cutoffs.push_back(std::stod(c));
+    }
+    for (double cutoff : cutoffs) {
+        for (bool roulette : {false, true}) {
+            if (cutoff == 0.0 && roulette) {
+                continue;
+            }
+            scene.cutoff = cutoff;
+            scene.roulette = roulette;
+            Image img(scene.pixel_width, scene.pixel_height);
+            RenderStats stats = Renderer(scene, pool, 32).render(img);
+            TraceStats total = stats.total();
+            double error = 0.0;
+            if (cutoff == 0.0) {
+                exact = std::move(img);
+                exact_seconds = stats.seconds;
+            } else {
+                error = rmse(img, exact, scene.pixel_width, scene.pixel_height);
+            }
+            std::cout << std::setw(10) << cutoff << std::setw(10) << (roulette ? "yes" : "no")
+                      << std::fixed << std::setprecision(4) << std::setw(12) << stats.seconds
+                      << std::setprecision(3)
+                      << std::setw(14) << (double) total.rays / total.samples
+                      << std::setprecision(2)
+                      << std::setw(10) << 100.0 * total.cut / total.samples
+                      << std::setprecision(4) << std::setw(10) << error
+                      << std::defaultfloat;
+            if (cutoff > 0.0) {
+                std::cout << "  (" << std::fixed << std::setprecision(1)
+                          << 100 * (1 - stats.seconds / exact_seconds) << "% saved)"
+                          << std::defaultfloat;
+            }
+            std::cout << std::endl;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Render a sphere cloud with the kernels for every instruction set the CPU
+ * supports, one ray at a time and in packets, checking that each gives the
+ * same image as the scalar kernels.
+ */
+int bench_isa(const std::vector<std::string>& args) {
+    Options opts(args, 0, {"--objects", "--accel", "--size", "--threads", "--packet"},
+                 "Usage: ./bench isa [--objects N] [--accel NAME] [--size WxH] [--threads N] "
+                 "[--packet N]");
+    ThreadPool pool(opts.get("--threads", 0));
+    Scene scene(Point(0, 0, 0));
+    add_sphere_cloud(scene, opts.get("--objects", 10000), 1);
+    parse_size(opts.get("--size", "512x512"), scene);
+    scene.build_accelerator(opts.get("--accel", "bvh"), pool);
+    size_t packet = opts.get("--packet", 8);
+    if (!valid_packet_size(packet)) {
+        throw std::invalid_argument("Bad packet size: " + std::to_string(packet));
+    }
+    Isa original = current_isa();
+    std::vector<Isa> isas = supported_isas();
+    std::reverse(isas.begin(), isas.end());
+
+    std::cout << isa_report() << std::endl;
+    std::cout << std::setw(10) << "isa" << std::setw(14) << "single (s)"
+              << std::setw(14) << "packet (s)" << std::setw(12) << "same" << std::endl;
+    Renderer renderer(scene, pool, 32);
+    Image single_baseline(scene.pixel_width, scene.pixel_height);
+    Image packet_baseline(scene.pixel_width, scene.pixel_height);
+    for (Isa isa : isas) {
+        select_isa(isa);
+        Image single(scene.pixel_width, scene.pixel_height);
+        Image packets(scene.pixel_width, scene.pixel_height);
+        scene.packet_size = 1;
+        double single_seconds = renderer.render(single).seconds;
+        scene.packet_size = packet;
+        double packet_seconds = renderer.render(packets).seconds;
+        bool same = true;
+        if (isa == Isa::scalar) {
+            single_baseline = std::move(single);
+            packet_baseline = std::move(packets);
+        } else {
+            same = identical(single, single_baseline, scene.pixel_width, scene.pixel_height) &&
+                identical(packets, packet_baseline, scene.pixel_width, scene.pixel_height);
+        }
+        std::cout << std::setw(10) << isa_name(isa) << std::fixed << std::setprecision(4)
+                  << std::setw(14) << single_seconds << std::setw(14) << packet_seconds
+                  << std::setw(12) << (same ? "yes" : "NO") << std::defaultfloat << std::endl;
+    }
+    select_isa(original);
+    return 0;
+}
+
+/**
+ * Time the vector math of tracing one ray, apart from finding what it hits:
+ * the ray-sphere tests, placing the hit point and its shadow ray, and shading
+ * the hit (normals, normalizing, the specular half vector and the
+ * reflection). The hits are found once up front; each stage then runs over
+ * all of them --repeat times.
+ */
+int bench_math(const std::vector<std::string>& args) {
+    Options opts(args, 0, {"--objects", "--size", "--repeat"},
+                 "Usage: ./bench math [--objects N] [--size WxH] [--repeat N]");
+    ThreadPool pool(1);
+    Scene scene(Point(0, 0, 0));
+    size_t n = opts.get("--objects", 1000);
+    add_sphere_cloud(scene, n, 1);
+    parse_size(opts.get("--size", "256x256"), scene);
+    size_t repeat = std::max<size_t>(1, opts.get("--repeat", 20));
+    scene.build_accelerator("bvh", pool);
+
+    // The same spheres as the cloud, to test every ray against directly.
+    std::vector<Sphere> spheres;
+    double radius = 0.3 / std::cbrt((double) n);
+    for (size_t i = 0; i < std::min<size_t>(n, 16); i++) {
+        SampleRng rng(1, i, 0);
+        Point center(rng.next_double(), 0.2 + 1.5 * rng.next_double(),
+                     radius + rng.next_double());
+        spheres.push_back(Sphere(0.0, Color(0, 0, 0), center, radius));
+    }
+    std::vector<Ray> rays;
+    std::vector<Hit> hits;
+    for (size_t j = 0; j < scene.pixel_height; j++) {
+        for (size_t i = 0; i < scene.pixel_width; i++) {
+            Ray r = scene.camera_ray(i, j, 0);
+            std::optional<Hit> hit = scene.intersect(r);
+            if (hit) {
+                rays.push_back(r);
+                hits.push_back(*hit);
+            }
+        }
+    }
+
+    // Sums of the results, so that none of the work can be optimized away.
+    Real sink = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < repeat; k++) {
+        for (const Ray& r : rays) {
+            for (const Sphere& s : spheres) {
+                std::optional<Real> t = s.collision(r);
+                sink += t ? *t : 0;
+            }
+        }
+    }
+    double tests = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < repeat; k++) {
+        for (size_t h = 0; h < hits.size(); h++) {
+            Ray shadow = scene.shadow_ray(rays[h].at(hits[h].t));
+            sink += shadow.start.x + shadow.direction.z;
+        }
+    }
+    double shadows = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t k = 0; k < repeat; k++) {
+        for (size_t h = 0; h < hits.size(); h++) {
+            std::optional<Bounce> bounce;
+            Color c = scene.shade(hits[h], rays[h], true, 0, bounce);
+            sink += c.red + (bounce ? bounce->ray.direction.x : 0);
+        }
+    }
+    double shading = seconds_since(start);
+
+    double per_hit = 1e9 / ((double) repeat * hits.size());
+    std::cout << hits.size() << " hits, repeated " << repeat << " times (checksum "
+              << sink << ")" << std::endl;
+    std::cout << std::setw(16) << "stage" << std::setw(12) << "ns per ray" << std::endl;
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(16) << "sphere tests" << std::setw(12)
+              << tests * 1e9 / ((double) repeat * rays.size() * spheres.size())
+              << "  (per ray-sphere test)" << std::endl
+              << std::setw(16) << "shadow ray" << std::setw(12) << shadows * per_hit << std::endl
+              << std::setw(16) << "shading" << std::setw(12) << shading * per_hit << std::endl
+              << std::defaultfloat;
+    return 0;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+    const std::map<std::string, std::function<int(const std::vector<std::string>&)>> benches = {
+        {"accel", bench_accel},
+        {"adaptive", bench_adaptive},
+        {"dispatch", bench_dispatch},
+        {"instances", bench_instances},
+        {"isa", bench_isa},
+        {"load", bench_load},
+        {"math", bench_math},
+        {"mesh", bench_mesh},
+        {"packets", bench_packets},
+        {"reflections", bench_reflections},
+        {"samplers", bench_samplers},
+        {"shadows", bench_shadows},
+        {"spheres", bench_spheres},
+        {"wavefront", bench_wavefront},
+    };
+    if (argc < 2 || benches.count(argv[1]) == 0) {
+        std::cout << "Usage: ./bench <benchmark> [args]" << std::endl;
+        std::cout << "Benchmarks:";
+        for (const auto& b : benches) {
+            std::cout << " " << b.first;
+        }
+        std::cout << std::endl;
+        return 1;
+    }
+    try {
+        return benches.at(argv[1])(std::vector<std::string>(argv + 2, argv + argc));
+    } catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
+}
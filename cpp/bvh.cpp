@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <optional>
+
+#include "bvh.hpp"
+
+namespace {
+
+const uint32_t median_leaf_size = 4;
+const uint32_t sah_leaf_size = 4;
+const size_t bin_count = 16;
+// The cost of visiting a node relative to testing one primitive.
+const double traversal_cost = 1.0;
+// Ranges with more primitives than this are scanned by all of the pool's
+// workers together rather than by one.
+const size_t parallel_threshold = 1 << 16;
+
+Real component(Point p, int axis) {
+    return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+}
+
+Real component(Vector v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+struct Bin {
+    BoundingBox box;
+    uint32_t count;
+};
+
+using Bins = std::array<std::array<Bin, bin_count>, 3>;
+
+/** A node at the top of the tree, built before the tree is split into
+  subtrees for the workers. */
+struct TopNode {
+    BVH::Node node;
+    uint32_t left;
+    uint32_t right;
+    // Index into the list of subtrees if this node stands for one.
+    std::optional<size_t> subtree;
+};
+
+struct Subtree {
+    uint32_t start;
+    uint32_t end;
+    size_t depth;
+    std::vector<BVH::Node> nodes;
+};
+
+/**
+ * The state of one build. Ranges of `order` are split recursively; once a range
+ * is small enough it becomes a subtree which a single worker builds into its
+ * own node list, and the lists are spliced together at the end.
+ */
+class Build {
+private:
+    const std::vector<BoundingBox>& boxes;
+    std::vector<Point> centroids;
+    std::vector<uint32_t>& order;
+    BVH::Builder method;
+    ThreadPool& pool;
+    std::vector<TopNode> top;
+    std::vector<Subtree> subtrees;
+    size_t cutoff;
+
+    /** The bounds of the boxes in order[start, end) and of their
+      centroids. Large ranges are scanned in parallel if allowed, which it is
+      not from inside a job already running on the pool. */
+    std::pair<BoundingBox, BoundingBox> bounds(uint32_t start, uint32_t end,
+                                               bool parallel) const {
+        auto scan = [&](uint32_t from, uint32_t to) {
+            std::pair<BoundingBox, BoundingBox> b;
+            for (uint32_t i = from; i < to; i++) {
+                b.first.expand(this->boxes[this->order[i]]);
+                b.second.expand(this->centroids[this->order[i]]);
+            }
+            return b;
+        };
+        if (!parallel || end - start < parallel_threshold) {
+            return scan(start, end);
+        }
+        size_t chunks = 4 * this->pool.size();
+        std::vector<std::pair<BoundingBox, BoundingBox>> partial(chunks);
+        this->pool.parallel_for(chunks, [&](size_t c, [[maybe_unused]] size_t worker) {
+            partial[c] = scan(start + (end - start) * c / chunks,
+                              start + (end - start) * (c + 1) / chunks);
+        });
+        std::pair<BoundingBox, BoundingBox> b;
+        for (const auto& p : partial) {
+            b.first.expand(p.first);
+            b.second.expand(p.second);
+        }
+        return b;
+    }
+
+    size_t bin_of(uint32_t prim, int axis, const BoundingBox& centers) const {
+        Real lo = component(centers.min, axis);
+        Real extent = component(centers.max, axis) - lo;
+        size_t b = (size_t) (bin_count * (component(this->centroids[prim], axis) - lo) / extent);
+        return std::min(b, bin_count - 1);
+    }
+
+    Bins fill_bins(uint32_t start, uint32_t end, const BoundingBox& centers,
+                   bool parallel) const {
+        auto scan = [&](uint32_t from, uint32_t to) {
+            Bins bins{};
+            for (int axis = 0; axis < 3; axis++) {
+                if (component(centers.max, axis) <= component(centers.min, axis)) {
+                    continue;
+                }
+                for (uint32_t i = from; i < to; i++) {
+                    Bin& bin = bins[axis][this->bin_of(this->order[i], axis, centers)];
+                    bin.box.expand(this->boxes[this->order[i]]);
+                    bin.count++;
+                }
+            }
+            return bins;
+        };
+        if (!parallel || end - start < parallel_threshold) {
+            return scan(start, end);
+        }
+        size_t chunks = 4 * this->pool.size();
+        std::vector<Bins> partial(chunks);
+        this->pool.parallel_for(chunks, [&](size_t c, [[maybe_unused]] size_t worker) {
+            partial[c] = scan(start + (end - start) * c / chunks,
+                              start + (end - start) * (c + 1) / chunks);
+        });
+        Bins bins{};
+        for (const Bins& p : partial) {
+            for (int axis = 0; axis < 3; axis++) {
+                for (size_t b = 0; b < bin_count; b++) {
+                    bins[axis][b].box.expand(p[axis][b].box);
+                    bins[axis][b].count += p[axis][b].count;
+                }
+            }
+        }
+        return bins;
+    }
+
+    /** Decide how to split order[start, end), reordering it so that the
+      children are order[start, mid) and order[mid, end). Returns the split
+      position and axis, or nothing if the range should be a leaf. */
+    std::optional<std::pair<uint32_t, int>> split(uint32_t start, uint32_t end,
+                                                  const BoundingBox& box,
+                                                  const BoundingBox& centers,
+                                                  size_t depth, bool parallel) {
+        uint32_t n = end - start;
+        uint32_t leaf_size = this->method == BVH::Builder::sah ? sah_leaf_size : median_leaf_size;
+        if (n <= 1 || depth == BVH::max_depth) {
+            return {};
+        }
+        Vector extent = centers.max - centers.min;
+        int widest = 0;
+        if (extent.y > extent.x && extent.y >= extent.z) {
+            widest = 1;
+        } else if (extent.z > extent.x && extent.z > extent.y) {
+            widest = 2;
+        }
+
+        if (this->method == BVH::Builder::sah && component(extent, widest) > 0) {
+            Bins bins = this->fill_bins(start, end, centers, parallel);
+            Real best_cost = std::numeric_limits<Real>::infinity();
+            int best_axis = -1;
+            size_t best_bin = 0;
+            double area = box.surface_area();
+            for (int axis = 0; axis < 3; axis++) {
+                // right_cost[b] covers bins b and above.
+                std::array<double, bin_count> right_cost{};
+                BoundingBox right;
+                uint32_t right_count = 0;
+                for (size_t b = bin_count - 1; b > 0; b--) {
+                    right.expand(bins[axis][b].box);
+                    right_count += bins[axis][b].count;
+                    right_cost[b] = right.surface_area() * right_count;
+                }
+                BoundingBox left;
+                uint32_t left_count = 0;
+                for (size_t b = 1; b < bin_count; b++) {
+                    left.expand(bins[axis][b - 1].box);
+                    left_count += bins[axis][b - 1].count;
+                    if (left_count == 0 || left_count == n) {
+                        continue;
+                    }
+                    double cost = traversal_cost +
+                        (left.surface_area() * left_count + right_cost[b]) / area;
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bin = b;
+                    }
+                }
+            }
+            // Small ranges become leaves when no split is cheaper than
+            // testing everything in them.
+            if (n <= leaf_size && n <= best_cost) {
+                return {};
+            }
+            if (best_axis >= 0) {
+                auto middle = std::partition(
+                    this->order.begin() + start, this->order.begin() + end,
+                    [&](uint32_t prim) {
+                        return this->bin_of(prim, best_axis, centers) < best_bin;
+                    });
+                return std::make_pair((uint32_t) (middle - this->order.begin()), best_axis);
+            }
+        } else if (n <= leaf_size) {
+            return {};
+        }
+
+        // Median split, also used when the surface area heuristic finds
+        // nothing to separate (every centroid in the same place).
+        uint32_t mid = start + n / 2;
+        std::nth_element(this->order.begin() + start, this->order.begin() + mid,
+                         this->order.begin() + end, [&](uint32_t a, uint32_t b) {
+            return component(this->centroids[a], widest) < component(this->centroids[b], widest);
+        });
+        return std::make_pair(mid, widest);
+    }
+
+    /** Build the tree over order[start, end) into `out`, with child offsets
+      relative to the start of `out`. */
+    uint32_t build_subtree(std::vector<BVH::Node>& out, uint32_t start, uint32_t end,
+                           size_t depth) {
+        uint32_t index = out.size();
+        auto [box, centers] = this->bounds(start, end, false);
+        out.push_back(BVH::Node{box, start, 0, 0});
+        auto s = this->split(start, end, box, centers, depth, false);
+        if (!s) {
+            out[index].count = end - start;
+            std::sort(this->order.begin() + start, this->order.begin() + end);
+            return index;
+        }
+        this->build_subtree(out, start, s->first, depth + 1);
+        uint32_t right = this->build_subtree(out, s->first, end, depth + 1);
+        out[index].offset = right;
+        out[index].axis = s->second;
+        return index;
+    }
+
+    /** Split the top of the tree until every remaining range is small
+      enough to hand to one worker. */
+    uint32_t build_top(uint32_t start, uint32_t end, size_t depth) {
+        uint32_t index = this->top.size();
+        this->top.push_back(TopNode{BVH::Node{BoundingBox(), start, 0, 0}, 0, 0, {}});
+        if (end - start <= this->cutoff) {
+            this->top[index].subtree = this->subtrees.size();
+            this->subtrees.push_back(Subtree{start, end, depth, {}});
+            return index;
+        }
+        auto [box, centers] = this->bounds(start, end, true);
+        this->top[index].node.box = box;
+        auto s = this->split(start, end, box, centers, depth, true);
+        if (!s) {
+            this->top[index].node.count = end - start;
+            std::sort(this->order.begin() + start, this->order.begin() + end);
+            return index;
+        }
+        uint32_t left = this->build_top(start, s->first, depth + 1);
+        uint32_t right = this->build_top(s->first, end, depth + 1);
+        this->top[index].left = left;
+        this->top[index].right = right;
+        this->top[index].node.axis = s->second;
+        return index;
+    }
+
+    /** Copy the top node and everything below it into `out` in depth first
+      order, splicing in the subtrees. */
+    uint32_t assemble(std::vector<BVH::Node>& out, uint32_t t) {
+        uint32_t index = out.size();
+        const TopNode& node = this->top[t];
+        if (node.subtree) {
+            for (BVH::Node n : this->subtrees[*node.subtree].nodes) {
+                if (n.count == 0) {
+                    n.offset += index;
+                }
+                out.push_back(n);
+            }
+            return index;
+        }
+        out.push_back(node.node);
+        if (node.node.count > 0) {
+            return index;
+        }
+        this->assemble(out, node.left);
+        uint32_t right = this->assemble(out, node.right);
+        out[index].offset = right;
+        return index;
+    }
+
+public:
+    Build(const std::vector<BoundingBox>& b, std::vector<uint32_t>& o, BVH::Builder m,
+          ThreadPool& p):
+        boxes{b},
+        centroids{},
+        order{o},
+        method{m},
+        pool{p},
+        top{},
+        subtrees{},
+        cutoff{std::max<size_t>(4096, b.size() / (8 * p.size()))}
+    {
+        this->centroids.assign(this->boxes.size(), Point(0, 0, 0));
+        this->pool.parallel_for(this->boxes.size() / 4096 + 1,
+                                [&](size_t c, [[maybe_unused]] size_t worker) {
+            size_t end = std::min(this->boxes.size(), (c + 1) * 4096);
+            for (size_t i = c * 4096; i < end; i++) {
+                this->centroids[i] = this->boxes[i].centroid();
+            }
+        });
+    }
+
+    void run(std::vector<BVH::Node>& out) {
+        this->build_top(0, this->order.size(), 1);
+        this->pool.parallel_for(this->subtrees.size(), [&](size_t k, [[maybe_unused]] size_t worker) {
+            Subtree& s = this->subtrees[k];
+            this->build_subtree(s.nodes, s.start, s.end, s.depth);
+        });
+        size_t total = this->top.size();
+        for (const Subtree& s : this->subtrees) {
+            total += s.nodes.size();
+        }
+        out.reserve(total);
+        this->assemble(out, 0);
+    }
+};
+
+}
+
+BVH::BVH():
+    nodes{},
+    order{}
+{}
+
+void BVH::build(const std::vector<BoundingBox>& boxes, Builder method, ThreadPool& pool) {
+    this->nodes.clear();
+    this->order.resize(boxes.size());
+    for (uint32_t i = 0; i < boxes.size(); i++) {
+        this->order[i] = i;
+    }
+    if (boxes.empty()) {
+        return;
+    }
+    Build(boxes, this->order, method, pool).run(this->nodes);
+}
+
+size_t BVH::node_count() const {
+    return this->nodes.size();
+}
+
+const std::vector<uint32_t>& BVH::ordering() const {
+    return this->order;
+}
+
+double BVH::sah_cost() const {
+    if (this->nodes.empty()) {
+        return 0.0;
+    }
+    double root = this->nodes[0].box.surface_area();
+    if (root <= 0.0) {
+        return this->nodes[0].count;
+    }
+    double cost = 0.0;
+    for (const Node& n : this->nodes) {
+        double p = n.box.surface_area() / root;
+        cost += p * (n.count > 0 ? n.count : traversal_cost);
+    }
+    return cost;
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "packet.hpp"
+#include "thread_pool.hpp"
+#include "types.hpp"
+
+/**
+ * A bounding volume hierarchy over a set of boxes.
+ *
+ * The hierarchy only knows about the boxes it was built from. Primitives are
+ * identified by their index in the list passed to build, and traversal hands
+ * those indices back to a visitor which does the real intersection test.
+ */
+class BVH {
+public:
+    struct Node {
+        BoundingBox box;
+        // For leaves, the position in `order` of the first primitive; the
+        // primitives of a leaf are kept in increasing index order. For
+        // interior nodes, the index of the second child; the first child
+        // always immediately follows its parent.
+        uint32_t offset;
+        // Number of primitives in a leaf, zero for interior nodes.
+        uint32_t count;
+        // The axis the children were split along.
+        uint32_t axis;
+    };
+
+    /** How to choose where to split a node. */
+    enum class Builder {
+        // At the median centroid along the widest axis. Fast to build.
+        median,
+        // Where the surface area heuristic, evaluated at a fixed number of
+        // bins along each axis, predicts the cheapest traversal.
+        sah,
+    };
+
+    // Deeper trees are not built, so traversal can use a fixed size stack.
+    static const size_t max_depth = 64;
+
+private:
+    std::vector<Node> nodes;
+    std::vector<uint32_t> order;
+
+public:
+    BVH();
+
+    /** Build the hierarchy over the given boxes, replacing any previous
+      contents. The pool's workers share the work on large inputs. */
+    void build(const std::vector<BoundingBox>&, Builder, ThreadPool&);
+
+    size_t node_count() const;
+
+    /** The primitive indices in the order leaves refer to them. */
+    const std::vector<uint32_t>& ordering() const;
+
+    /** The expected cost of tracing a random ray through the tree according
+      to the surface area heuristic, in units of one primitive test. */
+    double sah_cost() const;
+
+    /**
+     * Call `visit(index, t_max)` for every primitive whose box the ray enters
+     * before `t_max`. The visitor may lower `t_max` to cull the rest of the
+     * traversal, and may return true to stop the traversal outright. Nearer
+     * children are visited first. Returns whether the visitor stopped early.
+     */
+    template <typename F>
+    bool traverse(const Ray&, Real, F&&) const;
+
+    /**
+     * Like traverse, but call `visit(first, count, t_max)` once per leaf with
+     * the leaf's primitives given as positions [first, first + count) in
+     * ordering(), so that they can be tested together.
+     */
+    template <typename F>
+    bool traverse_leaves(const Ray&, Real, F&&) const;
+
+    /** Call `visit(first, count)`, as for traverse_leaves, for every leaf
+      whose box contains the point. */
+    template <typename F>
+    void traverse_point(Point, F&&) const;
+
+    /**
+     * Walk the tree with a packet of rays, W lanes wide. Each ray has its own
+     * limit t_max[lane], which the visitor may lower. A node is entered when
+     * any active ray hits its box, and `visit(first, count, lanes)` is called
+     * for each leaf with the mask of rays which hit it. The visitor returns
+     * the lanes which are finished and should leave the traversal. Children
+     * are ordered by the direction of the first active ray.
+     */
+    template <size_t W, typename F>
+    void traverse_packet(const RayPacket&, uint32_t, Real*, F&&) const;
+};
+
+template <typename F>
+bool BVH::traverse(const Ray& r, Real t_max, F&& visit) const {
+    return this->traverse_leaves(r, t_max, [&](uint32_t first, uint32_t count, Real& limit) {
+        for (uint32_t i = first; i < first + count; i++) {
+            if (visit(this->order[i], limit)) {
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+template <typename F>
+bool BVH::traverse_leaves(const Ray& r, Real t_max, F&& visit) const {
+    if (this->nodes.empty()) {
+        return false;
+    }
+    Vector inv(1 / r.direction.x, 1 / r.direction.y, 1 / r.direction.z);
+    bool negative[3] = {inv.x < 0, inv.y < 0, inv.z < 0};
+    uint32_t stack[max_depth];
+    size_t top = 0;
+    uint32_t current = 0;
+    while (true) {
+        const Node& node = this->nodes[current];
+        if (node.box.hit(r, inv, t_max)) {
+            if (node.count > 0) {
+                if (visit(node.offset, node.count, t_max)) {
+                    return true;
+                }
+            } else if (negative[node.axis]) {
+                stack[top++] = current + 1;
+                current = node.offset;
+                continue;
+            } else {
+                stack[top++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (top == 0) {
+            return false;
+        }
+        current = stack[--top];
+    }
+}
+
+template <typename F>
+void BVH::traverse_point(Point p, F&& visit) const {
+    if (this->nodes.empty()) {
+        return;
+    }
+    uint32_t stack[max_depth];
+    size_t top = 0;
+    uint32_t current = 0;
+    while (true) {
+        const Node& node = this->nodes[current];
+        if (node.box.contains(p)) {
+            if (node.count > 0) {
+                visit(node.offset, node.count);
+            } else {
+                stack[top++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (top == 0) {
+            return;
+        }
+        current = stack[--top];
+    }
+}
+
+template <size_t W, typename F>
+void BVH::traverse_packet(const RayPacket& p, uint32_t active, Real* t_max, F&& visit) const {
+    if (this->nodes.empty() || active == 0) {
+        return;
+    }
+    PacketInverse inv(p);
+    size_t lead = __builtin_ctz(active);
+    bool negative[3] = {inv.x[lead] < 0, inv.y[lead] < 0, inv.z[lead] < 0};
+    uint32_t stack[max_depth];
+    size_t top = 0;
+    uint32_t current = 0;
+    while (true) {
+        const Node& node = this->nodes[current];
+        uint32_t lanes = packet_box_hits(node.box, p, inv, t_max, W);
+        lanes &= active;
+        if (lanes != 0) {
+            if (node.count > 0) {
+                active &= ~visit(node.offset, node.count, lanes);
+                if (active == 0) {
+                    return;
+                }
+            } else if (negative[node.axis]) {
+                stack[top++] = current + 1;
+                current = node.offset;
+                continue;
+            } else {
+                stack[top++] = node.offset;
+                current = current + 1;
+                continue;
+            }
+        }
+        if (top == 0) {
+            return;
+        }
+        current = stack[--top];
+    }
+}
@@ -0,0 +1,32 @@
+#include "compiled.hpp"
+
+CompiledSphere::CompiledSphere(const Sphere& s):
+    center{s.get_center()},
+    radius{s.get_radius()},
+    radius2{s.get_radius() * s.get_radius()},
+    inv_radius{1 / s.get_radius()},
+    color{s.get_base_color()},
+    reflectivity{s.get_base_reflectivity()}
+{}
+
+CompiledPlane::CompiledPlane(const Plane& p):
+    norm{p.get_normal()},
+    unit_norm{p.get_normal().normalized()},
+    point{p.get_point()},
+    color{p.get_base_color()},
+    checkerboard{p.get_checkerboard()},
+    x_axis{p.get_x_axis()},
+    y_axis{p.get_y_axis()},
+    reflectivity{p.get_base_reflectivity()}
+{}
+
+Color CompiledPlane::get_color(Point p) const {
+    if (!this->checkerboard) {
+        return this->color;
+    }
+    if (checkerboard_first(p - this->point, this->x_axis, this->y_axis)) {
+        return this->color;
+    } else {
+        return *this->checkerboard;
+    }
+}
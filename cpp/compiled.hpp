@@ -0,0 +1,97 @@
+#pragma once
+
+#include <optional>
+
+#include "object.hpp"
+#include "types.hpp"
+
+/**
+ * Spheres and planes as they are rendered. Compiling an object works out
+ * everything its collision and shading code needs which depends only on the
+ * object and not on the ray, once, so that hits do not redo it: squared radii,
+ * unit normals and the axes of checkerboards. The records are immutable; a
+ * changed object has to be compiled again.
+ *
+ * Hit times are computed exactly as the Object versions compute them, so
+ * compiling never changes what a ray hits. Shading uses the precomputed
+ * lengths instead of square roots, which can change colors by rounding.
+ */
+class CompiledSphere {
+private:
+    Point center;
+    Real radius;
+    Real radius2;
+    Real inv_radius;
+    Color color;
+    Real reflectivity;
+
+public:
+    explicit CompiledSphere(const Sphere&);
+
+    std::optional<Real> collision(const Ray& r) const {
+        return sphere_collision(this->center, this->radius2, r);
+    }
+
+    Point get_center() const {
+        return this->center;
+    }
+
+    Real get_radius() const {
+        return this->radius;
+    }
+
+    /** The outward normal at a point on the surface, with no square root:
+      the point is a radius away from the center. */
+    Vector unit_normal(Point p) const {
+        return this->inv_radius * (p - this->center);
+    }
+
+    Color get_color(Point) const {
+        return this->color;
+    }
+
+    Real get_reflectivity(Point) const {
+        return this->reflectivity;
+    }
+
+    std::optional<BoundingBox> bounds() const {
+        return sphere_bounds(this->center, this->radius);
+    }
+};
+
+class CompiledPlane {
+private:
+    Vector norm;
+    Vector unit_norm;
+    Point point;
+    Color color;
+    std::optional<Color> checkerboard;
+    /** The checkerboard's axes, as the plane has them (see
+      checkerboard_axes). */
+    Vector x_axis;
+    Vector y_axis;
+    Real reflectivity;
+
+public:
+    explicit CompiledPlane(const Plane&);
+
+    std::optional<Real> collision(const Ray& r) const {
+        return plane_collision(this->point, this->norm, r);
+    }
+
+    Vector unit_normal(Point) const {
+        return this->unit_norm;
+    }
+
+    /** The color of the square containing a point on the plane, as for
+      Plane::get_color. */
+    Color get_color(Point) const;
+
+    Real get_reflectivity(Point) const {
+        return this->reflectivity;
+    }
+
+    std::optional<BoundingBox> bounds() const {
+        return {};
+    }
+};
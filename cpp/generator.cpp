@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "generator.hpp"
+#include "rng.hpp"
+
+namespace {
+
+// Streams of the generator's random numbers, keyed apart by the second part
+// of the SampleRng key.
+const uint64_t sphere_stream = 0;
+const uint64_t cluster_stream = 1;
+
+}
+
+Distribution parse_distribution(const std::string& name) {
+    if (name == "uniform") {
+        return Distribution::uniform;
+    } else if (name == "clustered") {
+        return Distribution::clustered;
+    } else if (name == "layered") {
+        return Distribution::layered;
+    } else {
+        throw std::invalid_argument("Unknown distribution: " + name);
+    }
+}
+
+GeneratorSettings::GeneratorSettings():
+    objects{1000},
+    distribution{Distribution::uniform},
+    mirror_percent{30},
+    mirror_reflectivity{0.7},
+    width{512},
+    height{512},
+    antialias{1},
+    seed{1},
+    floor{true},
+    accelerator{"bvh"}
+{}
+
+SceneGenerator::SceneGenerator(const GeneratorSettings& s):
+    settings{s},
+    radius{Real(0.3 / std::cbrt((double) std::max<size_t>(1, s.objects)))},
+    clusters{std::max<size_t>(1, (size_t) std::sqrt((double) s.objects))},
+    spread{Real(0.5 / std::cbrt((double) clusters))},
+    layers{std::max<size_t>(1, (size_t) std::round(std::cbrt((double) s.objects)))}
+{
+    if (s.mirror_percent < 0 || s.mirror_percent > 100) {
+        throw std::invalid_argument("Mirror percentage must be from 0 to 100");
+    }
+    if (s.width == 0 || s.height == 0 || s.antialias == 0) {
+        throw std::invalid_argument("Image size and antialias must be positive");
+    }
+}
+
+nlohmann::json SceneGenerator::scene_settings() const {
+    return {
+        {"camera", {0.5, -1.0, 0.5}},
+        {"light", {0.0, -0.5, 1.0}},
+        {"width", this->settings.width},
+        {"height", this->settings.height},
+        {"antialias", this->settings.antialias},
+        {"accelerator", this->settings.accelerator},
+    };
+}
+
+std::optional<Plane> SceneGenerator::floor() const {
+    if (!this->settings.floor) {
+        return {};
+    }
+    return Plane(0.0, Color(255, 255, 255), Vector(0, 0, 1), Point(0, 0, 0), Color(0, 0, 0),
+                 Vector(0, 1, 0));
+}
+
+Point SceneGenerator::cluster_center(size_t k) const {
+    // Far enough inside the volume that the cluster stays above the floor.
+    SampleRng rng(this->settings.seed, k, cluster_stream);
+    Real x = rng.next_double();
+    Real y = 0.2 + 1.5 * rng.next_double();
+    Real z = this->spread + 2 * this->radius + rng.next_double();
+    return Point(x, y, z);
+}
+
+Sphere SceneGenerator::sphere(size_t i) const {
+    SampleRng rng(this->settings.seed, i, sphere_stream);
+    Point center(0, 0, 0);
+    switch (this->settings.distribution) {
+    case Distribution::uniform:
+        center = Point(rng.next_double(), 0.2 + 1.5 * rng.next_double(),
+                       this->radius + rng.next_double());
+        break;
+    case Distribution::clustered: {
+        Point c = this->cluster_center(rng.next_u64() % this->clusters);
+        // A point in the unit ball, by rejection.
+        Vector v(0, 0, 0);
+        do {
+            v = Vector(2 * rng.next_double() - 1, 2 * rng.next_double() - 1,
+                       2 * rng.next_double() - 1);
+        } while (v.dot_product(v) > 1);
+        center = multiply_add(this->spread, v, c);
+        break;
+    }
+    case Distribution::layered: {
+        size_t layer = i % this->layers;
+        center = Point(rng.next_double(), 0.2 + 1.5 * (layer + 0.5) / this->layers,
+                       this->radius + rng.next_double());
+        break;
+    }
+    }
+    Color color(255 * rng.next_double(), 255 * rng.next_double(), 255 * rng.next_double());
+    Real r = this->radius * (0.5 + rng.next_double());
+    Real reflectivity = 100 * rng.next_double() < this->settings.mirror_percent
+        ? this->settings.mirror_reflectivity : 0.0;
+    return Sphere(reflectivity, color, center, r);
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+
+#include "json.hpp"
+#include "object.hpp"
+#include "types.hpp"
+
+/**
+ * How the spheres of a generated scene are arranged:
+ *   uniform    spread evenly through the volume in front of the camera
+ *   clustered  gathered in balls around about sqrt(n) random centers, so that
+ *              most of the volume is empty
+ *   layered    in about cbrt(n) thin sheets facing the camera, one behind
+ *              another, so that camera rays pass many spheres' bounds
+ */
+enum class Distribution {
+    uniform,
+    clustered,
+    layered,
+};
+
+/** The distribution with the given name. Throws for any other name. */
+Distribution parse_distribution(const std::string&);
+
+struct GeneratorSettings {
+    size_t objects;
+    Distribution distribution;
+    /** The percentage of spheres which are mirrors, and their
+      reflectivity. The others are matte. */
+    double mirror_percent;
+    double mirror_reflectivity;
+    size_t width;
+    size_t height;
+    size_t antialias;
+    /** Seeds the objects, not the render. */
+    uint64_t seed;
+    /** Whether there is a checkerboard floor under the spheres. */
+    bool floor;
+    std::string accelerator;
+
+    GeneratorSettings();
+};
+
+/**
+ * Deterministic scenes of any size for scaling studies and performance
+ * regression runs: spheres over a checkerboard floor, in front of the camera
+ * and light of shiny.json, filling [0, 1] x [0.2, 1.7] x [0, 1]. Sphere sizes
+ * shrink as the count grows so that the scene stays about as full.
+ *
+ * Each sphere is a function of the seed, the count and its own index alone,
+ * so a scene is the same on every machine and every run, and any part of it
+ * can be made without the rest.
+ */
+class SceneGenerator {
+private:
+    GeneratorSettings settings;
+    Real radius;
+    size_t clusters;
+    Real spread;
+    size_t layers;
+
+    Point cluster_center(size_t) const;
+
+public:
+    /** Throws if the settings are out of range. */
+    explicit SceneGenerator(const GeneratorSettings&);
+
+    /** The settings of the scene as a JSON scene gives them: everything but
+      its objects. */
+    nlohmann::json scene_settings() const;
+
+    std::optional<Plane> floor() const;
+
+    /** Sphere i, from zero. */
+    Sphere sphere(size_t) const;
+
+    /** Call `f` with each object, the floor first. */
+    template <typename F>
+    void for_each_object(F&&) const;
+};
+
+template <typename F>
+void SceneGenerator::for_each_object(F&& f) const {
+    std::optional<Plane> p = this->floor();
+    if (p) {
+        f(*p);
+    }
+    for (size_t i = 0; i < this->settings.objects; i++) {
+        f(this->sphere(i));
+    }
+}
@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <cmath>
+
+#include "grid.hpp"
+
+namespace {
+
+// Neither the cells along one axis nor the cells overall may exceed these.
+const int max_axis_cells = 1024;
+const size_t max_cells = 1 << 26;
+
+}
+
+Grid::Grid():
+    bounds{},
+    dims{1, 1, 1},
+    cell_size{Vector(0, 0, 0)},
+    inv_cell_size{Vector(0, 0, 0)},
+    starts{},
+    refs{}
+{}
+
+int Grid::cell_of(Real v, int axis) const {
+    Real lo = axis == 0 ? this->bounds.min.x : (axis == 1 ? this->bounds.min.y : this->bounds.min.z);
+    Real inv = axis == 0 ? this->inv_cell_size.x :
+        (axis == 1 ? this->inv_cell_size.y : this->inv_cell_size.z);
+    int c = (int) std::floor((v - lo) * inv);
+    return std::max(0, std::min(this->dims[axis] - 1, c));
+}
+
+void Grid::build(const std::vector<BoundingBox>& boxes, double density) {
+    this->bounds = BoundingBox();
+    this->starts.clear();
+    this->refs.clear();
+    if (boxes.empty()) {
+        return;
+    }
+    for (const BoundingBox& b : boxes) {
+        this->bounds.expand(b);
+    }
+
+    // Pick roughly cubic cells so that there are about density cells per
+    // box. Flat axes get one cell.
+    Vector extent = this->bounds.max - this->bounds.min;
+    Real e[3] = {extent.x, extent.y, extent.z};
+    Real largest = std::max({e[0], e[1], e[2]});
+    double volume = 1.0;
+    int flat = 0;
+    for (int a = 0; a < 3; a++) {
+        if (e[a] > largest * 1e-6) {
+            volume *= e[a];
+        } else {
+            flat++;
+        }
+    }
+    double per_unit = std::pow(density * boxes.size() / volume, 1.0 / (3 - std::min(flat, 2)));
+    size_t total = 1;
+    for (int a = 0; a < 3; a++) {
+        this->dims[a] = e[a] > largest * 1e-6 ?
+            std::max(1, std::min(max_axis_cells, (int) std::ceil(e[a] * per_unit))) : 1;
+        total *= this->dims[a];
+    }
+    while (total > max_cells) {
+        total = 1;
+        for (int a = 0; a < 3; a++) {
+            this->dims[a] = std::max(1, this->dims[a] / 2);
+            total *= this->dims[a];
+        }
+    }
+    this->cell_size = Vector(e[0] / this->dims[0], e[1] / this->dims[1], e[2] / this->dims[2]);
+    this->inv_cell_size = Vector(
+        this->cell_size.x > 0 ? 1 / this->cell_size.x : 0.0,
+        this->cell_size.y > 0 ? 1 / this->cell_size.y : 0.0,
+        this->cell_size.z > 0 ? 1 / this->cell_size.z : 0.0);
+
+    // Count the boxes in each cell, turn the counts into offsets, then fill
+    // the cells. Going through the boxes in order keeps each cell sorted.
+    this->starts.assign(total + 1, 0);
+    auto for_each_cell = [&](const BoundingBox& b, auto&& f) {
+        int x0 = this->cell_of(b.min.x, 0), x1 = this->cell_of(b.max.x, 0);
+        int y0 = this->cell_of(b.min.y, 1), y1 = this->cell_of(b.max.y, 1);
+        int z0 = this->cell_of(b.min.z, 2), z1 = this->cell_of(b.max.z, 2);
+        for (int z = z0; z <= z1; z++) {
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    f(((size_t) z * this->dims[1] + y) * this->dims[0] + x);
+                }
+            }
+        }
+    };
+    for (const BoundingBox& b : boxes) {
+        for_each_cell(b, [&](size_t c) { this->starts[c + 1]++; });
+    }
+    for (size_t c = 0; c < total; c++) {
+        this->starts[c + 1] += this->starts[c];
+    }
+    this->refs.resize(this->starts[total]);
+    std::vector<uint32_t> fill(this->starts.begin(), this->starts.end() - 1);
+    for (uint32_t i = 0; i < boxes.size(); i++) {
+        for_each_cell(boxes[i], [&](size_t c) { this->refs[fill[c]++] = i; });
+    }
+}
+
+size_t Grid::cell_count() const {
+    return (size_t) this->dims[0] * this->dims[1] * this->dims[2];
+}
+
+size_t Grid::ref_count() const {
+    return this->refs.size();
+}
+
+const int* Grid::resolution() const {
+    return this->dims;
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "types.hpp"
+
+/**
+ * A uniform grid over a set of boxes. Each cell lists every box overlapping
+ * it, and rays walk the cells in order with a 3D-DDA. Builds in linear time
+ * and suits dense clouds of similarly sized objects, where a tree gains little
+ * over equal subdivision.
+ *
+ * Like the BVH, the grid only knows primitives by their index in the list of
+ * boxes it was built from.
+ */
+class Grid {
+private:
+    BoundingBox bounds;
+    int dims[3];
+    Vector cell_size;
+    Vector inv_cell_size;
+    // Cell c lists refs[starts[c]] up to refs[starts[c + 1]], in increasing
+    // order of primitive index.
+    std::vector<uint32_t> starts;
+    std::vector<uint32_t> refs;
+
+    int cell_of(Real, int) const;
+
+public:
+    Grid();
+
+    /** Build the grid over the given boxes, aiming for about `density` cells
+      per box. */
+    void build(const std::vector<BoundingBox>&, double);
+
+    size_t cell_count() const;
+    size_t ref_count() const;
+    const int* resolution() const;
+
+    /**
+     * Call `visit(index, t_max)` for the primitives in each cell the ray
+     * passes through before `t_max`, nearest cells first, until a cell ends
+     * beyond the current `t_max`. The visitor may lower `t_max` and may return
+     * true to stop the walk. A primitive spanning several cells is usually only
+     * visited once: recently visited primitives are remembered in a small
+     * per-ray mailbox. Returns whether the visitor stopped early.
+     */
+    template <typename F>
+    bool traverse(const Ray&, Real, F&&) const;
+};
+
+template <typename F>
+bool Grid::traverse(const Ray& r, Real t_max, F&& visit) const {
+    if (this->refs.empty()) {
+        return false;
+    }
+    Vector inv(1 / r.direction.x, 1 / r.direction.y, 1 / r.direction.z);
+    Real t_enter = 0.0;
+    Real t_exit = t_max;
+    const Real start[3] = {r.start.x, r.start.y, r.start.z};
+    const Real dir[3] = {r.direction.x, r.direction.y, r.direction.z};
+    const Real lo[3] = {this->bounds.min.x, this->bounds.min.y, this->bounds.min.z};
+    const Real hi[3] = {this->bounds.max.x, this->bounds.max.y, this->bounds.max.z};
+    const Real size[3] = {this->cell_size.x, this->cell_size.y, this->cell_size.z};
+    const Real inv_dir[3] = {inv.x, inv.y, inv.z};
+    for (int a = 0; a < 3; a++) {
+        Real t0 = (lo[a] - start[a]) * inv_dir[a];
+        Real t1 = (hi[a] - start[a]) * inv_dir[a];
+        t_enter = std::max(t_enter, std::min(t0, t1));
+        t_exit = std::min(t_exit, std::max(t0, t1));
+    }
+    if (t_enter > t_exit) {
+        return false;
+    }
+
+    // Set up the walk from the cell where the ray enters the grid.
+    int cell[3];
+    int step[3];
+    int out[3];
+    Real next[3];
+    Real delta[3];
+    for (int a = 0; a < 3; a++) {
+        cell[a] = this->cell_of(start[a] + t_enter * dir[a], a);
+        if (dir[a] > 0) {
+            step[a] = 1;
+            out[a] = this->dims[a];
+            next[a] = (lo[a] + (cell[a] + 1) * size[a] - start[a]) * inv_dir[a];
+            delta[a] = size[a] * inv_dir[a];
+        } else if (dir[a] < 0) {
+            step[a] = -1;
+            out[a] = -1;
+            next[a] = (lo[a] + cell[a] * size[a] - start[a]) * inv_dir[a];
+            delta[a] = -size[a] * inv_dir[a];
+        } else {
+            step[a] = 0;
+            out[a] = -1;
+            next[a] = std::numeric_limits<Real>::infinity();
+            delta[a] = 0.0;
+        }
+    }
+
+    const size_t mailbox_size = 32;
+    uint32_t mailbox[mailbox_size];
+    std::fill(mailbox, mailbox + mailbox_size, UINT32_MAX);
+
+    while (true) {
+        size_t c = ((size_t) cell[2] * this->dims[1] + cell[1]) * this->dims[0] + cell[0];
+        for (uint32_t i = this->starts[c]; i < this->starts[c + 1]; i++) {
+            uint32_t prim = this->refs[i];
+            if (mailbox[prim % mailbox_size] == prim) {
+                continue;
+            }
+            mailbox[prim % mailbox_size] = prim;
+            if (visit(prim, t_max)) {
+                return true;
+            }
+        }
+        int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+        if (step[axis] == 0) {
+            // Only possible for a zero direction, which never leaves the cell.
+            return false;
+        }
+        // Anything hit before the end of this cell is in this cell or one
+        // already walked, so nothing further along can be closer.
+        if (t_max < next[axis]) {
+            return false;
+        }
+        cell[axis] += step[axis];
+        if (cell[axis] == out[axis]) {
+            return false;
+        }
+        next[axis] += delta[axis];
+    }
+}
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <fstream>
 
 #include "fpng.h"
@@ -9,13 +10,17 @@ Image::Image(size_t w, size_t h):
     pixels{std::vector<Color>(w * h)}
 {}
 
+double clamp_channel(double v) {
+    return std::max(0.0, std::min(255.0, v));
+}
+
 uint8_t convert(double val) {
     return std::max(0, std::min(255, (int) val));
 }
 
 void Image::write(std::string filename) {
     std::vector<uint8_t> png_file;
-    uint8_t pix[this->width * this->height * 3];
+    std::vector<uint8_t> pix(this->width * this->height * 3);
     for (size_t i = 0; i < width; i++) {
         for (size_t j = 0; j < height; j++) {
             pix[j * width * 3 + i * 3    ] = convert(pixels[j * width + i].red);
@@ -23,7 +28,7 @@ void Image::write(std::string filename) {
             pix[j * width * 3 + i * 3 + 2] = convert(pixels[j * width + i].blue);
         }
     }
-    bool res = fpng::fpng_encode_image_to_memory(pix, width, height, 3, png_file);
+    bool res = fpng::fpng_encode_image_to_memory(pix.data(), width, height, 3, png_file);
     if (!res) {
         throw std::runtime_error("Failed to encode PNG file");
     }
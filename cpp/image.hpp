@@ -1,9 +1,13 @@
 #pragma once
 
+#include <string>
 #include <vector>
 
 #include "types.hpp"
 
+/** A color channel clamped to the range an image can show, [0, 255]. */
+double clamp_channel(double);
+
 class Image {
 private:
     size_t width;
@@ -0,0 +1,105 @@
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "fpng.h"
+
+/**
+ * Compare two renders channel by channel, e.g. trace's against trace-f32's
+ * of the same scene, and report how far apart they are.
+ */
+
+void usage() {
+    std::cout << "Usage: ./imgdiff [options] <image> <image>" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --tolerance N  fail if any channel differs by more than N levels (default: 0)"
+              << std::endl;
+}
+
+struct Png {
+    std::vector<uint8_t> pixels;
+    uint32_t width;
+    uint32_t height;
+};
+
+Png load(const std::string& filename) {
+    Png png;
+    uint32_t channels;
+    int res = fpng::fpng_decode_file(filename.c_str(), png.pixels, png.width, png.height,
+                                     channels, 3);
+    if (res == fpng::FPNG_DECODE_NOT_FPNG) {
+        throw std::runtime_error(filename + " was not written by trace");
+    } else if (res != fpng::FPNG_DECODE_SUCCESS) {
+        throw std::runtime_error("Failed to decode " + filename);
+    }
+    return png;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned long tolerance = 0;
+    std::vector<std::string> files;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--tolerance" && i + 1 < argc) {
+                tolerance = std::stoul(argv[++i]);
+            } else if (arg.rfind("--", 0) == 0) {
+                throw std::invalid_argument("Unknown option: " + arg);
+            } else {
+                files.push_back(arg);
+            }
+        }
+        if (files.size() != 2) {
+            usage();
+            return 2;
+        }
+
+        fpng::fpng_init();
+        Png a = load(files[0]);
+        Png b = load(files[1]);
+        if (a.width != b.width || a.height != b.height) {
+            throw std::runtime_error("Image sizes differ: " +
+                                     std::to_string(a.width) + "x" + std::to_string(a.height) +
+                                     " and " +
+                                     std::to_string(b.width) + "x" + std::to_string(b.height));
+        }
+
+        size_t pixels = (size_t) a.width * a.height;
+        size_t differing_pixels = 0;
+        size_t differing_channels = 0;
+        unsigned int max_diff = 0;
+        double squared = 0;
+        for (size_t p = 0; p < pixels; p++) {
+            bool differs = false;
+            for (size_t c = 0; c < 3; c++) {
+                int d = std::abs((int) a.pixels[3 * p + c] - (int) b.pixels[3 * p + c]);
+                if (d > 0) {
+                    differs = true;
+                    differing_channels++;
+                    max_diff = std::max(max_diff, (unsigned int) d);
+                    squared += d * d;
+                }
+            }
+            differing_pixels += differs;
+        }
+        double rmse = std::sqrt(squared / (3 * pixels));
+
+        std::cout << "size: " << a.width << "x" << a.height << std::endl;
+        std::cout << "differing pixels: " << differing_pixels << " ("
+                  << 100.0 * differing_pixels / pixels << "%)" << std::endl;
+        std::cout << "differing channels: " << differing_channels << std::endl;
+        std::cout << "max channel difference: " << max_diff << std::endl;
+        std::cout << "rmse: " << rmse << std::endl;
+        if (rmse > 0) {
+            std::cout << "psnr: " << 20 * std::log10(255 / rmse) << " dB" << std::endl;
+        } else {
+            std::cout << "psnr: inf (identical)" << std::endl;
+        }
+        return max_diff > tolerance ? 1 : 0;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+}
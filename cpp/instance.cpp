@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "instance.hpp"
+#include "prototype.hpp"
+
+AffineTransform::AffineTransform():
+    m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}}
+{}
+
+AffineTransform::AffineTransform(const Real (&rows)[3][4]):
+    m{{rows[0][0], rows[0][1], rows[0][2], rows[0][3]},
+      {rows[1][0], rows[1][1], rows[1][2], rows[1][3]},
+      {rows[2][0], rows[2][1], rows[2][2], rows[2][3]}}
+{}
+
+AffineTransform AffineTransform::translation(Vector v) {
+    return AffineTransform({{1, 0, 0, v.x}, {0, 1, 0, v.y}, {0, 0, 1, v.z}});
+}
+
+AffineTransform AffineTransform::scaling(Vector v) {
+    return AffineTransform({{v.x, 0, 0, 0}, {0, v.y, 0, 0}, {0, 0, v.z, 0}});
+}
+
+AffineTransform AffineTransform::rotation(Vector axis, Real degrees) {
+    if (axis.dot_product(axis) == 0) {
+        throw std::invalid_argument("Rotation axis has zero length");
+    }
+    // Rodrigues' formula: R = cos I + sin [k]x + (1 - cos) k k^T for the
+    // unit axis k.
+    Vector k = axis.normalized();
+    Real a = degrees * Real(M_PI / 180);
+    Real c = std::cos(a);
+    Real s = std::sin(a);
+    Real d = 1 - c;
+    return AffineTransform({{c + d * k.x * k.x, d * k.x * k.y - s * k.z, d * k.x * k.z + s * k.y, 0},
+                            {d * k.y * k.x + s * k.z, c + d * k.y * k.y, d * k.y * k.z - s * k.x, 0},
+                            {d * k.z * k.x - s * k.y, d * k.z * k.y + s * k.x, c + d * k.z * k.z, 0}});
+}
+
+AffineTransform AffineTransform::then(const AffineTransform& next) const {
+    // next(this(p)) = B (A p + a) + b = (B A) p + (B a + b)
+    Real rows[3][4];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            rows[i][j] = next.m[i][0] * this->m[0][j] + next.m[i][1] * this->m[1][j] +
+                next.m[i][2] * this->m[2][j];
+        }
+        rows[i][3] += next.m[i][3];
+    }
+    return AffineTransform(rows);
+}
+
+AffineTransform AffineTransform::inverse() const {
+    // A^-1 is the transposed matrix of cofactors over the determinant, and
+    // the inverse map is p -> A^-1 p - A^-1 a.
+    const Real (&a)[3][4] = this->m;
+    Real cof[3][3] = {
+        {a[1][1] * a[2][2] - a[1][2] * a[2][1], a[1][2] * a[2][0] - a[1][0] * a[2][2],
+         a[1][0] * a[2][1] - a[1][1] * a[2][0]},
+        {a[0][2] * a[2][1] - a[0][1] * a[2][2], a[0][0] * a[2][2] - a[0][2] * a[2][0],
+         a[0][1] * a[2][0] - a[0][0] * a[2][1]},
+        {a[0][1] * a[1][2] - a[0][2] * a[1][1], a[0][2] * a[1][0] - a[0][0] * a[1][2],
+         a[0][0] * a[1][1] - a[0][1] * a[1][0]},
+    };
+    Real det = a[0][0] * cof[0][0] + a[0][1] * cof[0][1] + a[0][2] * cof[0][2];
+    if (det == 0 || !std::isfinite(det)) {
+        throw std::invalid_argument("Transform cannot be inverted");
+    }
+    Real rows[3][4];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            rows[i][j] = cof[j][i] / det;
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        rows[i][3] = -(rows[i][0] * a[0][3] + rows[i][1] * a[1][3] + rows[i][2] * a[2][3]);
+    }
+    return AffineTransform(rows);
+}
+
+BoundingBox AffineTransform::apply(const BoundingBox& b) const {
+    // Each coordinate of the image is smallest and largest at corners, and
+    // each term of its sum can be minimized on its own.
+    Point lo(this->m[0][3], this->m[1][3], this->m[2][3]);
+    Point hi = lo;
+    Real* los[] = {&lo.x, &lo.y, &lo.z};
+    Real* his[] = {&hi.x, &hi.y, &hi.z};
+    Real mins[] = {b.min.x, b.min.y, b.min.z};
+    Real maxs[] = {b.max.x, b.max.y, b.max.z};
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            Real e = this->m[i][j] * mins[j];
+            Real f = this->m[i][j] * maxs[j];
+            *los[i] += std::min(e, f);
+            *his[i] += std::max(e, f);
+        }
+    }
+    // Pad the box as sphere_bounds does, for rounding in the transform of
+    // the ray as well as in the box test.
+    Real pad = Tolerance<Real>::pad *
+        (std::max({hi.x - lo.x, hi.y - lo.y, hi.z - lo.z}) +
+         std::max({std::abs(lo.x), std::abs(lo.y), std::abs(lo.z),
+                   std::abs(hi.x), std::abs(hi.y), std::abs(hi.z)}));
+    Vector extent(pad, pad, pad);
+    return BoundingBox(lo + -extent, hi + extent);
+}
+
+Instance::Instance(std::shared_ptr<const Prototype> p, const AffineTransform& transform):
+    prototype{std::move(p)},
+    to_prototype{transform.inverse()},
+    box{}
+{
+    // An empty prototype's box stays empty rather than going through the
+    // transform as infinities.
+    std::optional<BoundingBox> b = this->prototype->bounds();
+    if (b) {
+        this->box = this->prototype->size() > 0 ? transform.apply(*b) : *b;
+    }
+}
+
+bool Instance::occludes(const Ray& r, Real t_max) const {
+    return this->prototype->occluded(this->to_local(r), t_max);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+
+#include "types.hpp"
+
+class Prototype;
+
+/**
+ * An affine map p -> A p + b, kept as the three rows of [A | b].
+ */
+class AffineTransform {
+private:
+    Real m[3][4];
+
+public:
+    /** The identity. */
+    AffineTransform();
+    /** The map with the given rows of [A | b]. */
+    AffineTransform(const Real (&)[3][4]);
+
+    static AffineTransform translation(Vector);
+    static AffineTransform scaling(Vector);
+    /** A rotation by the given angle in degrees about an axis through the
+      origin, counterclockwise looking down the axis. */
+    static AffineTransform rotation(Vector, Real);
+
+    /** This map followed by another. */
+    AffineTransform then(const AffineTransform&) const;
+
+    /** The inverse map. Throws if A is singular. */
+    AffineTransform inverse() const;
+
+    Point apply(Point p) const {
+        return Point(this->m[0][0] * p.x + this->m[0][1] * p.y + this->m[0][2] * p.z + this->m[0][3],
+                     this->m[1][0] * p.x + this->m[1][1] * p.y + this->m[1][2] * p.z + this->m[1][3],
+                     this->m[2][0] * p.x + this->m[2][1] * p.y + this->m[2][2] * p.z + this->m[2][3]);
+    }
+
+    Vector apply(Vector v) const {
+        return Vector(this->m[0][0] * v.x + this->m[0][1] * v.y + this->m[0][2] * v.z,
+                      this->m[1][0] * v.x + this->m[1][1] * v.y + this->m[1][2] * v.z,
+                      this->m[2][0] * v.x + this->m[2][1] * v.y + this->m[2][2] * v.z);
+    }
+
+    /** A transposed times a vector. Normals are carried by the transposed
+      inverse of the map which carries points. */
+    Vector apply_transposed(Vector v) const {
+        return Vector(this->m[0][0] * v.x + this->m[1][0] * v.y + this->m[2][0] * v.z,
+                      this->m[0][1] * v.x + this->m[1][1] * v.y + this->m[2][1] * v.z,
+                      this->m[0][2] * v.x + this->m[1][2] * v.y + this->m[2][2] * v.z);
+    }
+
+    Ray apply(const Ray& r) const {
+        return Ray(this->apply(r.start), this->apply(r.direction));
+    }
+
+    /** A box containing the image of a box. */
+    BoundingBox apply(const BoundingBox&) const;
+};
+
+/**
+ * A copy of a prototype placed in the scene by an affine transform. An
+ * instance holds only the inverse of the transform and its bounds; the
+ * objects and their acceleration structure belong to the prototype (see
+ * prototype.hpp), which any number of instances share.
+ *
+ * Rays are carried into the prototype's space by the inverse transform. The
+ * direction is not normalized there, so times along a ray are the same in
+ * both spaces.
+ */
+class Instance {
+private:
+    std::shared_ptr<const Prototype> prototype;
+    AffineTransform to_prototype;
+    std::optional<BoundingBox> box;
+
+public:
+    /** The prototype must not change once it has instances. Throws if the
+      transform cannot be inverted. */
+    Instance(std::shared_ptr<const Prototype>, const AffineTransform&);
+
+    const Prototype& get_prototype() const {
+        return *this->prototype;
+    }
+
+    /** A ray in the prototype's space. */
+    Ray to_local(const Ray& r) const {
+        return this->to_prototype.apply(r);
+    }
+
+    /** A normal in the prototype's space carried to the scene's, not
+      normalized. */
+    Vector normal_to_world(Vector n) const {
+        return this->to_prototype.apply_transposed(n);
+    }
+
+    bool occludes(const Ray&, Real) const;
+
+    /** The prototype's bounds carried into the scene, or nothing if it has
+      unbounded objects. */
+    std::optional<BoundingBox> bounds() const {
+        return this->box;
+    }
+};
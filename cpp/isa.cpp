@@ -0,0 +1,132 @@
+#include <cstdlib>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+
+#include "isa.hpp"
+
+namespace {
+
+const Isa all_isas[] = {Isa::scalar, Isa::sse41, Isa::avx2, Isa::avx512};
+
+/** Check whether the CPU has the instructions an ISA's kernels use, whether
+  or not this build has those kernels. */
+bool cpu_has(Isa isa) {
+#if defined(__x86_64__)
+    // Needed because this runs from a static initializer.
+    __builtin_cpu_init();
+    switch (isa) {
+    case Isa::scalar:
+        return true;
+    case Isa::sse41:
+        return __builtin_cpu_supports("sse4.1");
+    case Isa::avx2:
+        return __builtin_cpu_supports("avx2");
+    case Isa::avx512:
+        return __builtin_cpu_supports("avx512f");
+    }
+#endif
+    return isa == Isa::scalar;
+}
+
+/** The widest supported ISA, or the one RTLC_ISA names. This runs before
+  main, so a bad RTLC_ISA is reported and ignored rather than thrown. */
+Isa startup_isa() {
+    Isa widest = supported_isas().front();
+    const char* requested = std::getenv("RTLC_ISA");
+    if (requested == nullptr) {
+        return widest;
+    }
+    try {
+        Isa isa = parse_isa(requested);
+        if (isa_supported(isa)) {
+            return isa;
+        }
+        std::cerr << "RTLC_ISA: " << requested << " is not supported here";
+    } catch (const std::invalid_argument& e) {
+        std::cerr << "RTLC_ISA: " << e.what();
+    }
+    std::cerr << ", using " << isa_name(widest) << std::endl;
+    return widest;
+}
+
+Isa current = startup_isa();
+
+}
+
+std::string isa_name(Isa isa) {
+    switch (isa) {
+    case Isa::scalar:
+        return "scalar";
+    case Isa::sse41:
+        return "sse4.1";
+    case Isa::avx2:
+        return "avx2";
+    case Isa::avx512:
+        return "avx512";
+    }
+    throw std::invalid_argument("Unknown instruction set");
+}
+
+Isa parse_isa(const std::string& name) {
+    for (Isa isa : all_isas) {
+        if (name == isa_name(isa)) {
+            return isa;
+        }
+    }
+    throw std::invalid_argument("Unknown instruction set: " + name);
+}
+
+bool isa_supported(Isa isa) {
+#if defined(RTLC_FLOAT)
+    // The vector kernels work on doubles.
+    return isa == Isa::scalar;
+#else
+    return cpu_has(isa);
+#endif
+}
+
+std::vector<Isa> supported_isas() {
+    std::vector<Isa> isas;
+    for (size_t i = std::size(all_isas); i-- > 0;) {
+        if (isa_supported(all_isas[i])) {
+            isas.push_back(all_isas[i]);
+        }
+    }
+    return isas;
+}
+
+Isa current_isa() {
+    return current;
+}
+
+void select_isa(Isa isa) {
+    if (!isa_supported(isa)) {
+        throw std::invalid_argument("Instruction set not supported here: " + isa_name(isa));
+    }
+    current = isa;
+}
+
+std::string isa_report() {
+    std::ostringstream out;
+    out << "cpu:";
+    const char* separator = " ";
+    for (Isa isa : all_isas) {
+        if (isa != Isa::scalar) {
+            out << separator << isa_name(isa) << (cpu_has(isa) ? " yes" : " no");
+            separator = ", ";
+        }
+    }
+    out << std::endl << "kernels:";
+    for (Isa isa : supported_isas()) {
+        out << " " << isa_name(isa);
+    }
+#if defined(RTLC_FLOAT)
+    out << " (single precision build)";
+#endif
+    const char* requested = std::getenv("RTLC_ISA");
+    out << std::endl << "RTLC_ISA: " << (requested ? requested : "not set") << std::endl;
+    out << "using: " << isa_name(current);
+    return out.str();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/**
+ * The instruction sets the ray kernels (sphere leaves and packet box tests)
+ * have versions for, narrowest first. All of them compute exactly the same
+ * results; the wider ones just do more rays or spheres per instruction.
+ *
+ * One is chosen for all kernels when the program starts: the widest this CPU
+ * supports, unless the RTLC_ISA environment variable names a narrower one.
+ * Single precision builds only have the scalar kernels.
+ */
+enum class Isa {
+    scalar,
+    sse41,
+    avx2,
+    avx512,
+};
+
+/** The name of an instruction set, as RTLC_ISA and --print-isa spell it:
+  "scalar", "sse4.1", "avx2" or "avx512". */
+std::string isa_name(Isa);
+
+/** The instruction set with the given name. Throws if there is none. */
+Isa parse_isa(const std::string&);
+
+/** Check whether this CPU (and this build) can run an instruction set's
+  kernels. */
+bool isa_supported(Isa);
+
+/** The supported instruction sets, widest first. Always ends with scalar. */
+std::vector<Isa> supported_isas();
+
+/** The instruction set the kernels currently use. */
+Isa current_isa();
+
+/** Switch every kernel to an instruction set. Throws if this CPU does not
+  support it. Not safe to call while other threads are tracing. */
+void select_isa(Isa);
+
+/** A description of the CPU's relevant features, the supported kernels and
+  the choice made at startup, one item per line. */
+std::string isa_report();
@@ -1,24 +1,167 @@
 #include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
 
 #include "fpng.h"
 #include "scene.hpp"
 #include "image.hpp"
+#include "isa.hpp"
+#include "packet.hpp"
+#include "renderer.hpp"
+#include "sampler.hpp"
+#include "thread_pool.hpp"
+
+void usage() {
+    std::cout << "Usage: ./trace [options] <scene-file> <output-file>" << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --threads N   number of render threads (default: one per core)" << std::endl;
+    std::cout << "  --size WxH    override the image size given in the scene" << std::endl;
+    std::cout << "  --tile N      edge length of the initial render tiles (default: 32)" << std::endl;
+    std::cout << "  --seed N      seed for the sampling RNG (default: from the scene, or 0)" << std::endl;
+    std::cout << "  --sampler S   antialiasing pattern: random, stratified, halton or sobol" << std::endl;
+    std::cout << "  --adaptive T  stop sampling a pixel once its standard error is below T" << std::endl;
+    std::cout << "  --accel NAME  acceleration structure: linear, bvh, bvh-median or grid" << std::endl;
+    std::cout << "  --packet N    trace neighboring pixels' rays in packets of 4, 8 or 16 (1: off)" << std::endl;
+    std::cout << "  --wavefront N trace about N pixels' rays together, one bounce at a time (0: off)" << std::endl;
+    std::cout << "  --cutoff L    stop following reflections which could add less than L levels" << std::endl;
+    std::cout << "  --roulette    continue such reflections at random instead (unbiased)" << std::endl;
+    std::cout << "  --stats       print render statistics" << std::endl;
+    std::cout << "  --print-isa   print the CPU features and ray kernels in use, and exit" << std::endl;
+    std::cout << "Environment:" << std::endl;
+    std::cout << "  RTLC_ISA      use the scalar, sse4.1, avx2 or avx512 kernels rather than" << std::endl;
+    std::cout << "                the widest the CPU supports" << std::endl;
+}
+
+void print_stats(const Scene& scene, const RenderStats& stats) {
+    std::cout << scene.accelerator_summary() << std::endl;
+    std::cout << "render time: " << stats.seconds << " s" << std::endl;
+    for (size_t i = 0; i < stats.workers.size(); i++) {
+        const WorkerStats& w = stats.workers[i];
+        std::cout << "  worker " << i << ": " << w.busy_seconds << " s busy, "
+                  << w.tiles << " tiles, " << w.steals << " steals, "
+                  << w.splits << " splits" << std::endl;
+    }
+    std::cout << "load imbalance: " << 100 * stats.imbalance() << "%" << std::endl;
+    TraceStats total = stats.total();
+    uint64_t fixed = scene.pixel_width * scene.pixel_height * scene.antialias;
+    std::cout << "primary rays: " << total.samples << " (fixed antialias: " << fixed
+              << ", saved " << 100.0 * (fixed - total.samples) / fixed << "%)" << std::endl;
+    std::cout << "rays: " << total.rays << " camera and reflected, " << total.shadow_rays
+              << " shadow" << std::endl;
+    std::cout << "average path depth: " << (double) total.rays / total.samples << " rays, "
+              << total.cut << " paths cut short" << std::endl;
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        std::cout << "Usage: ./trace <scene-file> <output-file>" << std::endl;
+    size_t threads = 0;
+    size_t width = 0;
+    size_t height = 0;
+    size_t tile = 32;
+    bool show_stats = false;
+    bool print_isa = false;
+    std::optional<uint64_t> seed;
+    std::unique_ptr<Sampler> sampler;
+    std::optional<double> adaptive;
+    std::optional<std::string> accel;
+    std::optional<size_t> packet;
+    std::optional<size_t> wavefront;
+    std::optional<double> cutoff;
+    bool roulette = false;
+    std::vector<std::string> files;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--threads" && i + 1 < argc) {
+                threads = std::stoul(argv[++i]);
+            } else if (arg == "--size" && i + 1 < argc) {
+                std::string size = argv[++i];
+                size_t x = size.find('x');
+                if (x == std::string::npos) {
+                    throw std::invalid_argument("Bad image size: " + size);
+                }
+                width = std::stoul(size.substr(0, x));
+                height = std::stoul(size.substr(x + 1));
+            } else if (arg == "--tile" && i + 1 < argc) {
+                tile = std::max<size_t>(1, std::stoul(argv[++i]));
+            } else if (arg == "--seed" && i + 1 < argc) {
+                seed = std::stoull(argv[++i]);
+            } else if (arg == "--sampler" && i + 1 < argc) {
+                sampler = make_sampler(argv[++i]);
+            } else if (arg == "--adaptive" && i + 1 < argc) {
+                adaptive = std::stod(argv[++i]);
+            } else if (arg == "--accel" && i + 1 < argc) {
+                accel = argv[++i];
+            } else if (arg == "--packet" && i + 1 < argc) {
+                packet = std::stoul(argv[++i]);
+                if (!valid_packet_size(*packet)) {
+                    throw std::invalid_argument("Bad packet size: " + std::to_string(*packet));
+                }
+            } else if (arg == "--wavefront" && i + 1 < argc) {
+                wavefront = std::stoul(argv[++i]);
+            } else if (arg == "--cutoff" && i + 1 < argc) {
+                cutoff = std::stod(argv[++i]);
+            } else if (arg == "--roulette") {
+                roulette = true;
+            } else if (arg == "--stats") {
+                show_stats = true;
+            } else if (arg == "--print-isa") {
+                print_isa = true;
+            } else if (arg.rfind("--", 0) == 0) {
+                throw std::invalid_argument("Unknown option: " + arg);
+            } else {
+                files.push_back(arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+        usage();
+        return 1;
+    }
+    if (print_isa) {
+        std::cout << isa_report() << std::endl;
+        return 0;
+    }
+    if (files.size() != 2) {
+        usage();
         return 0;
     }
-    Scene scene(argv[1]);
+    ThreadPool pool(threads);
+    Scene scene(files[0], pool, accel);
+    if (width > 0 && height > 0) {
+        scene.pixel_width = width;
+        scene.pixel_height = height;
+    }
+    if (seed) {
+        scene.seed = *seed;
+    }
+    if (sampler) {
+        scene.sampler = std::move(sampler);
+    }
+    if (adaptive) {
+        scene.adaptive_threshold = *adaptive;
+    }
+    if (packet) {
+        scene.packet_size = *packet;
+    }
+    if (wavefront) {
+        scene.wavefront_batch = *wavefront;
+    }
+    if (cutoff) {
+        scene.cutoff = *cutoff;
+    }
+    if (roulette) {
+        scene.roulette = true;
+    }
 
     fpng::fpng_init();
 
     Image img(scene.pixel_width, scene.pixel_height);
-    for (size_t i = 0; i < scene.pixel_width; i++) {
-        for (size_t j = 0; j < scene.pixel_height; j++) {
-            img(i, j) = scene.compute_pixel_color(i, j);
-        }
+    Renderer renderer(scene, pool, tile);
+    RenderStats stats = renderer.render(img);
+    if (show_stats) {
+        print_stats(scene, stats);
     }
 
-    img.write(argv[2]);
+    img.write(files[1]);
 }
@@ -0,0 +1,57 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+
+MappedFile::MappedFile(const std::string& filename):
+    bytes{nullptr},
+    length{0}
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + filename + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error("Cannot stat " + filename + ": " + std::strerror(err));
+    }
+    this->length = st.st_size;
+    // mmap refuses empty mappings; an empty file is just no bytes.
+    if (this->length > 0) {
+        void* p = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            int err = errno;
+            close(fd);
+            throw std::runtime_error("Cannot map " + filename + ": " + std::strerror(err));
+        }
+        // Loaders read front to back.
+        madvise(p, this->length, MADV_SEQUENTIAL);
+        this->bytes = static_cast<const char*>(p);
+    }
+    // The mapping keeps the file open.
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (this->bytes) {
+        munmap(const_cast<char*>(this->bytes), this->length);
+    }
+}
+
+void MappedFile::release(size_t offset, size_t length) const {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t first = (std::min(offset, this->length) + page - 1) / page * page;
+    size_t last = std::min(offset + length, this->length) / page * page;
+    if (first < last) {
+        madvise(const_cast<char*>(this->bytes) + first, last - first, MADV_DONTNEED);
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+/**
+ * A file mapped read-only into memory for as long as this object lives. Pages
+ * are read in by the OS as they are first touched, so opening even a very large
+ * file is cheap and nothing is copied.
+ */
+class MappedFile {
+private:
+    const char* bytes;
+    size_t length;
+
+public:
+    /** Map a whole file. Throws if it cannot be opened or mapped. */
+    explicit MappedFile(const std::string&);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const {
+        return this->bytes;
+    }
+
+    size_t size() const {
+        return this->length;
+    }
+
+    /** Hand the whole pages within `length` bytes from `offset` back to the
+      OS, for a reader which is done with them. They are read in again if
+      touched. */
+    void release(size_t offset, size_t length) const;
+};
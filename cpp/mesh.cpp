@@ -0,0 +1,352 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "mesh.hpp"
+
+namespace {
+
+Real component(Vector v, int axis) {
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+/**
+ * A ray set up for the watertight test. The test works in a space where the
+ * ray starts at the origin and runs along +z: kz is the axis the direction is
+ * largest along, kx and ky the other two (swapped when the direction is
+ * negative along kz, so that windings are kept), and the shear takes the
+ * direction to the z axis.
+ */
+struct ShearedRay {
+    Point start;
+    int kx;
+    int ky;
+    int kz;
+    Real sx;
+    Real sy;
+    Real sz;
+
+    explicit ShearedRay(const Ray& r):
+        start{r.start},
+        kx{0},
+        ky{0},
+        kz{0},
+        sx{0},
+        sy{0},
+        sz{0}
+    {
+        Vector d = r.direction;
+        Real ax = std::abs(d.x);
+        Real ay = std::abs(d.y);
+        Real az = std::abs(d.z);
+        this->kz = ax > ay ? (ax > az ? 0 : 2) : (ay > az ? 1 : 2);
+        this->kx = (this->kz + 1) % 3;
+        this->ky = (this->kx + 1) % 3;
+        if (component(d, this->kz) < 0) {
+            std::swap(this->kx, this->ky);
+        }
+        Real dz = component(d, this->kz);
+        this->sx = component(d, this->kx) / dz;
+        this->sy = component(d, this->ky) / dz;
+        this->sz = 1 / dz;
+    }
+};
+
+/** The time at which the ray hits triangle abc and the weights of its
+  corners there, or nothing if it misses or the hit is behind the start. */
+std::optional<MeshHit> intersect(const ShearedRay& s, uint32_t triangle,
+                                 Point a, Point b, Point c) {
+    Vector pa = a - s.start;
+    Vector pb = b - s.start;
+    Vector pc = c - s.start;
+    Real ax = component(pa, s.kx) - s.sx * component(pa, s.kz);
+    Real ay = component(pa, s.ky) - s.sy * component(pa, s.kz);
+    Real bx = component(pb, s.kx) - s.sx * component(pb, s.kz);
+    Real by = component(pb, s.ky) - s.sy * component(pb, s.kz);
+    Real cx = component(pc, s.kx) - s.sx * component(pc, s.kz);
+    Real cy = component(pc, s.ky) - s.sy * component(pc, s.kz);
+    // The edge functions: twice the signed areas of the triangles the ray
+    // makes with each edge, which are the weights of the opposite corners.
+    Real u = cx * by - cy * bx;
+    Real v = ax * cy - ay * cx;
+    Real w = bx * ay - by * ax;
+    if constexpr (std::is_same_v<Real, float>) {
+        // An edge function which rounds to zero in single precision may have
+        // the wrong sign; the products are exact in double precision.
+        if (u == 0 || v == 0 || w == 0) {
+            u = (Real) ((double) cx * by - (double) cy * bx);
+            v = (Real) ((double) ax * cy - (double) ay * cx);
+            w = (Real) ((double) bx * ay - (double) by * ax);
+        }
+    }
+    // The ray is inside (or on an edge of) the triangle when the edge
+    // functions do not differ in sign.
+    if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0)) {
+        return {};
+    }
+    Real det = u + v + w;
+    if (det == 0) {
+        return {};
+    }
+    Real az = s.sz * component(pa, s.kz);
+    Real bz = s.sz * component(pb, s.kz);
+    Real cz = s.sz * component(pc, s.kz);
+    Real t = (u * az + v * bz + w * cz) / det;
+    if (!(t >= 0)) {
+        return {};
+    }
+    return MeshHit{t, triangle, {u / det, v / det, w / det}};
+}
+
+/** A box grown a little, so that rays which only just hit what it bounds are
+  not lost to rounding in the box test. */
+BoundingBox padded(const BoundingBox& b) {
+    Real size = std::max({std::abs(b.min.x), std::abs(b.min.y), std::abs(b.min.z),
+                          std::abs(b.max.x), std::abs(b.max.y), std::abs(b.max.z)});
+    Real pad = Tolerance<Real>::pad * size;
+    Vector extent(pad, pad, pad);
+    return BoundingBox(b.min + -extent, b.max + extent);
+}
+
+/** The point of triangle abc closest to p (Ericson, Real-Time Collision
+  Detection, 5.1.5). */
+Point closest_point(Point p, Point a, Point b, Point c) {
+    Vector ab = b - a;
+    Vector ac = c - a;
+    Vector ap = p - a;
+    Real d1 = ab.dot_product(ap);
+    Real d2 = ac.dot_product(ap);
+    if (d1 <= 0 && d2 <= 0) {
+        return a;
+    }
+    Vector bp = p - b;
+    Real d3 = ab.dot_product(bp);
+    Real d4 = ac.dot_product(bp);
+    if (d3 >= 0 && d4 <= d3) {
+        return b;
+    }
+    Real vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) {
+        return a + (d1 / (d1 - d3)) * ab;
+    }
+    Vector cp = p - c;
+    Real d5 = ab.dot_product(cp);
+    Real d6 = ac.dot_product(cp);
+    if (d6 >= 0 && d5 <= d6) {
+        return c;
+    }
+    Real vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) {
+        return a + (d2 / (d2 - d6)) * ac;
+    }
+    Real va = d3 * d6 - d5 * d4;
+    if (va <= 0 && d4 - d3 >= 0 && d5 - d6 >= 0) {
+        return b + ((d4 - d3) / ((d4 - d3) + (d5 - d6))) * (c - b);
+    }
+    Real denom = 1 / (va + vb + vc);
+    return a + (vb * denom) * ab + (vc * denom) * ac;
+}
+
+}
+
+MeshGeometry::MeshGeometry(std::vector<Point> vs, std::vector<Vector> ns,
+                           std::vector<MeshTriangle> ts):
+    vertices{std::move(vs)},
+    normals{std::move(ns)},
+    triangles{std::move(ts)},
+    box{},
+    bvh{},
+    built{false}
+{
+    if (this->triangles.empty()) {
+        throw std::invalid_argument("Mesh has no triangles");
+    }
+    for (const MeshTriangle& tri : this->triangles) {
+        bool flat = tri.normal[0] == MeshTriangle::no_normal;
+        for (int k = 0; k < 3; k++) {
+            if (tri.vertex[k] >= this->vertices.size()) {
+                throw std::invalid_argument("Mesh triangle refers to vertex " +
+                                            std::to_string(tri.vertex[k]) + " (from zero) of " +
+                                            std::to_string(this->vertices.size()));
+            }
+            if (flat ? tri.normal[k] != MeshTriangle::no_normal :
+                    tri.normal[k] >= this->normals.size()) {
+                throw std::invalid_argument("Mesh triangle refers to normal " +
+                                            std::to_string(tri.normal[k]) + " (from zero) of " +
+                                            std::to_string(this->normals.size()));
+            }
+            this->box.expand(this->vertices[tri.vertex[k]]);
+        }
+    }
+    this->box = padded(this->box);
+}
+
+void MeshGeometry::build(ThreadPool& pool) {
+    if (this->built) {
+        return;
+    }
+    std::vector<BoundingBox> boxes(this->triangles.size());
+    for (size_t i = 0; i < this->triangles.size(); i++) {
+        for (uint32_t v : this->triangles[i].vertex) {
+            boxes[i].expand(this->vertices[v]);
+        }
+        boxes[i] = padded(boxes[i]);
+    }
+    this->bvh.build(boxes, BVH::Builder::sah, pool);
+    // Store the triangles in the order of the leaves, so that a leaf's
+    // triangles are its range of positions.
+    std::vector<MeshTriangle> ordered;
+    ordered.reserve(this->triangles.size());
+    for (uint32_t i : this->bvh.ordering()) {
+        ordered.push_back(this->triangles[i]);
+    }
+    this->triangles = std::move(ordered);
+    this->built = true;
+}
+
+template <typename F>
+bool MeshGeometry::traverse(const Ray& r, Real t_max, F&& visit) const {
+    if (!this->built) {
+        return visit(0, (uint32_t) this->triangles.size(), t_max);
+    }
+    return this->bvh.traverse_leaves(r, t_max, visit);
+}
+
+std::optional<MeshHit> MeshGeometry::closest(const Ray& r, Real t_max) const {
+    ShearedRay s(r);
+    std::optional<MeshHit> best;
+    this->traverse(r, t_max, [&](uint32_t first, uint32_t count, Real& limit) {
+        for (uint32_t i = first; i < first + count; i++) {
+            const MeshTriangle& tri = this->triangles[i];
+            std::optional<MeshHit> h = intersect(s, i, this->vertices[tri.vertex[0]],
+                                                 this->vertices[tri.vertex[1]],
+                                                 this->vertices[tri.vertex[2]]);
+            if (h && h->t <= limit &&
+                    (!best || h->t < best->t || (h->t == best->t && i < best->triangle))) {
+                best = h;
+                limit = h->t;
+            }
+        }
+        return false;
+    });
+    return best;
+}
+
+bool MeshGeometry::occludes(const Ray& r, Real t_max) const {
+    ShearedRay s(r);
+    return this->traverse(r, t_max, [&](uint32_t first, uint32_t count,
+                                         [[maybe_unused]] Real& limit) {
+        for (uint32_t i = first; i < first + count; i++) {
+            const MeshTriangle& tri = this->triangles[i];
+            std::optional<MeshHit> h = intersect(s, i, this->vertices[tri.vertex[0]],
+                                                 this->vertices[tri.vertex[1]],
+                                                 this->vertices[tri.vertex[2]]);
+            if (h && h->t < t_max) {
+                return true;
+            }
+        }
+        return false;
+    });
+}
+
+std::optional<MeshHit> MeshGeometry::triangle_hit(const Ray& r, uint32_t i) const {
+    const MeshTriangle& tri = this->triangles[i];
+    return intersect(ShearedRay(r), i, this->vertices[tri.vertex[0]],
+                     this->vertices[tri.vertex[1]], this->vertices[tri.vertex[2]]);
+}
+
+Vector MeshGeometry::hit_normal(const Ray& r, const MeshHit& h) const {
+    const MeshTriangle& tri = this->triangles[h.triangle];
+    Point a = this->vertices[tri.vertex[0]];
+    Vector face = (this->vertices[tri.vertex[1]] - a).cross_product(
+        this->vertices[tri.vertex[2]] - a);
+    if (face.dot_product(r.direction) > 0) {
+        face = -face;
+    }
+    if (tri.normal[0] != MeshTriangle::no_normal) {
+        Vector n = h.weight[0] * this->normals[tri.normal[0]] +
+            h.weight[1] * this->normals[tri.normal[1]] +
+            h.weight[2] * this->normals[tri.normal[2]];
+        if (n.dot_product(face) < 0) {
+            n = -n;
+        }
+        Real length = n.magnitude();
+        if (length > 0) {
+            return (1 / length) * n;
+        }
+    }
+    return face.normalized();
+}
+
+Vector MeshGeometry::normal_near(Point p) const {
+    std::optional<uint32_t> nearest;
+    Real distance = 0;
+    auto consider = [&](uint32_t i) {
+        const MeshTriangle& tri = this->triangles[i];
+        Vector d = p - closest_point(p, this->vertices[tri.vertex[0]],
+                                     this->vertices[tri.vertex[1]],
+                                     this->vertices[tri.vertex[2]]);
+        Real d2 = d.dot_product(d);
+        if (!nearest || d2 < distance) {
+            nearest = i;
+            distance = d2;
+        }
+    };
+    // Only the triangles whose boxes hold the point are candidates, unless
+    // there is no hierarchy yet or rounding left the point outside them all.
+    if (this->built) {
+        this->bvh.traverse_point(p, [&](uint32_t first, uint32_t count) {
+            for (uint32_t i = first; i < first + count; i++) {
+                consider(i);
+            }
+        });
+    }
+    if (!nearest) {
+        for (uint32_t i = 0; i < this->triangles.size(); i++) {
+            consider(i);
+        }
+    }
+    const MeshTriangle& tri = this->triangles[*nearest];
+    Point a = this->vertices[tri.vertex[0]];
+    return (this->vertices[tri.vertex[1]] - a).cross_product(
+        this->vertices[tri.vertex[2]] - a).normalized();
+}
+
+TriangleMesh::TriangleMesh(Real refl, Color col, std::shared_ptr<MeshGeometry> g):
+    Object(refl, col),
+    geometry{std::move(g)}
+{}
+
+std::optional<Real> TriangleMesh::collision(Ray r) const {
+    std::optional<MeshHit> h = this->geometry->closest(r, std::numeric_limits<Real>::infinity());
+    if (!h) {
+        return {};
+    }
+    return h->t;
+}
+
+Vector TriangleMesh::normal(Point p) const {
+    return this->geometry->normal_near(p);
+}
+
+Vector TriangleMesh::unit_normal(Point p) const {
+    return this->geometry->normal_near(p);
+}
+
+std::optional<BoundingBox> TriangleMesh::bounds() const {
+    return this->geometry->bounds();
+}
+
+bool TriangleMesh::occludes(const Ray& r, Real t_max) const {
+    return this->geometry->occludes(r, t_max);
+}
+
+Vector TriangleMesh::hit_normal(const Ray& r, Real t, uint32_t triangle) const {
+    std::optional<MeshHit> h = this->geometry->triangle_hit(r, triangle);
+    if (!h) {
+        return this->geometry->normal_near(r.at(t));
+    }
+    return this->geometry->hit_normal(r, *h);
+}
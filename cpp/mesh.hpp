@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "bvh.hpp"
+#include "object.hpp"
+#include "thread_pool.hpp"
+#include "types.hpp"
+
+/**
+ * A triangle of a mesh, as indices into the mesh's vertex and normal buffers.
+ * Triangles without vertex normals are shaded flat and have no_normal in all
+ * three places.
+ */
+struct MeshTriangle {
+    static constexpr uint32_t no_normal = std::numeric_limits<uint32_t>::max();
+
+    uint32_t vertex[3];
+    uint32_t normal[3];
+};
+
+/** Where a ray hits a mesh: the time, the triangle, and the weights of the
+  triangle's three corners at the hit point. */
+struct MeshHit {
+    Real t;
+    uint32_t triangle;
+    Real weight[3];
+};
+
+/**
+ * The geometry of a triangle mesh: vertex positions and normals shared
+ * between triangles through indices, and a bounding volume hierarchy over the
+ * triangles. Several meshes may share one geometry.
+ *
+ * Rays are tested against triangles with the watertight algorithm of Woop,
+ * Benthin and Wald (2013), which never lets a ray through the shared edge or
+ * vertex of two triangles. Triangles are two-sided.
+ *
+ * The hierarchy is built by build(), which reorders the triangles to match
+ * its leaves. Until then every triangle is tested against every ray.
+ */
+class MeshGeometry {
+private:
+    std::vector<Point> vertices;
+    std::vector<Vector> normals;
+    std::vector<MeshTriangle> triangles;
+    BoundingBox box;
+    BVH bvh;
+    bool built;
+
+    /** Call `visit(first, count, t_max)` for the triangles the ray may hit
+      before t_max, as for BVH::traverse_leaves. */
+    template <typename F>
+    bool traverse(const Ray&, Real, F&&) const;
+
+public:
+    /** Throws if there are no triangles or a triangle refers to a vertex or
+      normal which does not exist. */
+    MeshGeometry(std::vector<Point>, std::vector<Vector>, std::vector<MeshTriangle>);
+
+    /** Build the hierarchy if it has not been built yet. The pool's workers
+      share the work on large meshes. */
+    void build(ThreadPool&);
+
+    size_t vertex_count() const {
+        return this->vertices.size();
+    }
+
+    size_t triangle_count() const {
+        return this->triangles.size();
+    }
+
+    const BoundingBox& bounds() const {
+        return this->box;
+    }
+
+    /** The closest hit at or before t_max. When two triangles are hit at the
+      same time the one which comes first wins. */
+    std::optional<MeshHit> closest(const Ray&, Real) const;
+
+    /** Whether the ray hits any triangle before t_max. */
+    bool occludes(const Ray&, Real) const;
+
+    /** The ray's hit on one triangle, exactly as closest finds it. */
+    std::optional<MeshHit> triangle_hit(const Ray&, uint32_t) const;
+
+    /** The unit normal at a hit, facing back along the ray: interpolated from
+      the vertex normals when the triangle has them, the triangle's own
+      otherwise. */
+    Vector hit_normal(const Ray&, const MeshHit&) const;
+
+    /** The unit normal of the triangle nearest a point, which is assumed to
+      lie on the mesh, as for Object::normal. */
+    Vector normal_near(Point) const;
+};
+
+/**
+ * A triangle mesh of one color and reflectivity. Final so that calls through a
+ * TriangleMesh are never virtual.
+ *
+ * An Object only gives the time at which a ray hits it, which does not say
+ * which triangle was hit. Shading therefore uses hit_normal with the triangle
+ * the scene's Hit records, rather than normal.
+ */
+class TriangleMesh final: public Object {
+private:
+    std::shared_ptr<MeshGeometry> geometry;
+
+public:
+    TriangleMesh(Real, Color, std::shared_ptr<MeshGeometry>);
+
+    std::optional<Real> collision(Ray) const override;
+    Vector normal(Point) const override;
+    Vector unit_normal(Point) const override;
+    std::optional<BoundingBox> bounds() const override;
+
+    /** Whether the ray hits the mesh before t_max. Stops at the first such
+      triangle. */
+    bool occludes(const Ray&, Real) const;
+
+    /** The unit normal where the ray hits the given triangle at time t, as
+      for MeshGeometry::hit_normal. */
+    Vector hit_normal(const Ray&, Real, uint32_t) const;
+
+    MeshGeometry& get_geometry() const {
+        return *this->geometry;
+    }
+};
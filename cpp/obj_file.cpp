@@ -0,0 +1,151 @@
+#include <algorithm>
+#include <charconv>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "mapped_file.hpp"
+#include "obj_file.hpp"
+
+namespace {
+
+/** The words of one line of an OBJ file, read in turn. */
+class Words {
+private:
+    const char* p;
+    const char* end;
+
+public:
+    Words(const char* b, const char* e): p{b}, end{e} {}
+
+    /** The next word, or an empty one at the end of the line. */
+    std::string_view next() {
+        while (this->p < this->end && (*this->p == ' ' || *this->p == '\t' || *this->p == '\r')) {
+            this->p++;
+        }
+        const char* start = this->p;
+        while (this->p < this->end && *this->p != ' ' && *this->p != '\t' && *this->p != '\r') {
+            this->p++;
+        }
+        return std::string_view(start, this->p - start);
+    }
+};
+
+class Reader {
+private:
+    const std::string& filename;
+    size_t line;
+    std::vector<Point> vertices;
+    std::vector<Vector> normals;
+    std::vector<MeshTriangle> triangles;
+
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error(this->filename + ":" + std::to_string(this->line) + ": " +
+                                 message);
+    }
+
+    double number(std::string_view word) const {
+        double value = 0;
+        auto [rest, error] = std::from_chars(word.data(), word.data() + word.size(), value);
+        if (word.empty() || error != std::errc() || rest != word.data() + word.size()) {
+            this->fail("bad number '" + std::string(word) + "'");
+        }
+        return value;
+    }
+
+    /** An index into a list which has `count` entries so far, from its
+      one-based (or, if negative, counted from the end) form in the file. */
+    uint32_t index(std::string_view word, size_t count) const {
+        long value = 0;
+        auto [rest, error] = std::from_chars(word.data(), word.data() + word.size(), value);
+        // The magnitude is taken unsigned, where negating LONG_MIN is defined.
+        unsigned long magnitude = value < 0 ? 0ul - (unsigned long) value : (unsigned long) value;
+        if (word.empty() || error != std::errc() || rest != word.data() + word.size() ||
+                magnitude == 0 || magnitude > count) {
+            this->fail("bad index '" + std::string(word) + "'");
+        }
+        return (uint32_t) (value > 0 ? magnitude - 1 : count - magnitude);
+    }
+
+    /** Three numbers, with anything after them (such as a vertex's w) left
+      unread. */
+    Vector triple(Words& words) const {
+        double x = this->number(words.next());
+        double y = this->number(words.next());
+        double z = this->number(words.next());
+        return Vector(x, y, z);
+    }
+
+    /** A face's corner: "v", "v/vt", "v//vn" or "v/vt/vn". */
+    std::pair<uint32_t, uint32_t> corner(std::string_view word) const {
+        size_t slash = word.find('/');
+        uint32_t v = this->index(word.substr(0, slash), this->vertices.size());
+        uint32_t n = MeshTriangle::no_normal;
+        if (slash != std::string_view::npos) {
+            size_t second = word.find('/', slash + 1);
+            if (second != std::string_view::npos && second + 1 < word.size()) {
+                n = this->index(word.substr(second + 1), this->normals.size());
+            }
+        }
+        return {v, n};
+    }
+
+    void face(Words& words) {
+        std::vector<std::pair<uint32_t, uint32_t>> corners;
+        for (std::string_view w = words.next(); !w.empty(); w = words.next()) {
+            corners.push_back(this->corner(w));
+        }
+        if (corners.size() < 3) {
+            this->fail("face with fewer than three corners");
+        }
+        for (size_t k = 1; k + 1 < corners.size(); k++) {
+            const auto& a = corners[0];
+            const auto& b = corners[k];
+            const auto& c = corners[k + 1];
+            MeshTriangle tri{{a.first, b.first, c.first}, {a.second, b.second, c.second}};
+            if (a.second == MeshTriangle::no_normal || b.second == MeshTriangle::no_normal ||
+                    c.second == MeshTriangle::no_normal) {
+                tri.normal[0] = tri.normal[1] = tri.normal[2] = MeshTriangle::no_normal;
+            }
+            this->triangles.push_back(tri);
+        }
+    }
+
+public:
+    Reader(const std::string& f): filename{f}, line{0}, vertices{}, normals{}, triangles{} {}
+
+    std::shared_ptr<MeshGeometry> read() {
+        MappedFile file(this->filename);
+        const char* p = file.data();
+        const char* end = p + file.size();
+        while (p < end) {
+            const char* eol = std::find(p, end, '\n');
+            this->line++;
+            Words words(p, eol);
+            std::string_view keyword = words.next();
+            if (keyword == "v") {
+                Vector v = this->triple(words);
+                this->vertices.push_back(Point(v.x, v.y, v.z));
+            } else if (keyword == "vn") {
+                this->normals.push_back(this->triple(words));
+            } else if (keyword == "f") {
+                this->face(words);
+            }
+            p = eol + (eol < end);
+        }
+        try {
+            return std::make_shared<MeshGeometry>(std::move(this->vertices),
+                                                  std::move(this->normals),
+                                                  std::move(this->triangles));
+        } catch (const std::invalid_argument& e) {
+            throw std::runtime_error(this->filename + ": " + e.what());
+        }
+    }
+};
+
+}
+
+std::shared_ptr<MeshGeometry> read_obj(const std::string& filename) {
+    return Reader(filename).read();
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "mesh.hpp"
+
+/**
+ * Read the triangles of a Wavefront OBJ file into a mesh geometry, whose
+ * hierarchy is not built yet.
+ *
+ * Vertices (v), vertex normals (vn) and faces (f) are read; everything else,
+ * such as texture coordinates, groups and materials, is skipped. Faces with
+ * more than three corners are split into a fan of triangles around their first
+ * corner. Indices may be negative, counting back from the last vertex or
+ * normal read. A triangle uses vertex normals only if all three of its corners
+ * give one.
+ *
+ * Throws if the file cannot be read or is malformed, naming the line.
+ */
+std::shared_ptr<MeshGeometry> read_obj(const std::string&);
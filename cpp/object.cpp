@@ -1,6 +1,10 @@
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+
 #include "object.hpp"
 
-Object::Object(double refl, Color c):
+Object::Object(Real refl, Color c):
     reflectivity{refl},
     color{c}
 {}
@@ -9,13 +13,17 @@ Color Object::get_color([[maybe_unused]] Point p) const {
     return this->color;
 }
 
-Sphere::Sphere(double refl, Color col, Point c, double rad):
+std::optional<BoundingBox> Object::bounds() const {
+    return {};
+}
+
+Sphere::Sphere(Real refl, Color col, Point c, Real rad):
     Object(refl, col),
     center{c},
     radius{rad}
 {}
 
-std::optional<double> Sphere::collision(Ray r) const {
+std::optional<Real> sphere_collision(Point center, Real radius2, const Ray& r) {
     // Surface of the sphere: points s satisfying || c - s || = r
     // Looking for a time t for which || c - (p + t v) || = r
     // So: || c - (p + t v) || = r
@@ -30,16 +38,16 @@ std::optional<double> Sphere::collision(Ray r) const {
     //     t = (-b +/- sqrt(b^2 - 4 a c)) / (2 a)
     Point p = r.start;
     Vector v = r.direction;
-    double a = v.dot_product(v);
-    double b = 2 * (p - this->center).dot_product(v);
-    double c = (this->center - p).dot_product(this->center - p) -
-        this->radius * this->radius;
-    double discr = b * b - 4 * a * c;
+    Real a = v.dot_product(v);
+    Vector f = center - p;
+    Real b = 2 * (p - center).dot_product(v);
+    Real c = f.dot_product(f) - radius2;
+    Real discr = b * b - 4 * a * c;
     if (discr < 0) {
         return {};
     }
-    double t1 = (-b + std::sqrt(discr)) / (2 * a);
-    double t2 = (-b - std::sqrt(discr)) / (2 * a);
+    Real t1 = (-b + std::sqrt(discr)) / (2 * a);
+    Real t2 = (-b - std::sqrt(discr)) / (2 * a);
     if (t1 < 0) {
         if (t2 < 0) {
             return {};
@@ -53,27 +61,52 @@ std::optional<double> Sphere::collision(Ray r) const {
     }
 }
 
+BoundingBox sphere_bounds(Point center, Real radius) {
+    // Pad the box a little so that rays which only just graze the sphere are
+    // not lost to rounding in the box test.
+    Real pad = radius * (1 + Tolerance<Real>::pad) +
+        Tolerance<Real>::pad * std::max({std::abs(center.x),
+                         std::abs(center.y),
+                         std::abs(center.z)});
+    Vector extent(pad, pad, pad);
+    return BoundingBox(center + -extent, center + extent);
+}
+
+std::optional<Real> Sphere::collision(Ray r) const {
+    return sphere_collision(this->center, this->radius * this->radius, r);
+}
+
 Vector Sphere::normal(Point p) const {
     return p - this->center;
 }
 
-Plane::Plane(double refl, Color c, Vector n, Point p):
+std::optional<BoundingBox> Sphere::bounds() const {
+    return sphere_bounds(this->center, this->radius);
+}
+
+Plane::Plane(Real refl, Color c, Vector n, Point p):
     Object(refl, c),
     norm{n},
     point{p},
     checkerboard{},
-    orientation{}
+    orientation{},
+    x_axis{Vector(0, 0, 0)},
+    y_axis{Vector(0, 0, 0)}
 {}
 
-Plane::Plane(double refl, Color c, Vector n, Point p, Color c2, Vector ori):
+Plane::Plane(Real refl, Color c, Vector n, Point p, Color c2, Vector ori):
     Object(refl, c),
     norm{n},
     point{p},
     checkerboard{c2},
-    orientation{ori}
-{}
+    orientation{ori},
+    x_axis{Vector(0, 0, 0)},
+    y_axis{Vector(0, 0, 0)}
+{
+    std::tie(this->x_axis, this->y_axis) = checkerboard_axes(n, ori);
+}
 
-std::optional<double> Plane::collision(Ray r) const {
+std::optional<Real> plane_collision(Point point, Vector norm, const Ray& r) {
     // A plane is defined by (s - c) . n = 0 (for c = point, n = norm)
     // We want ((p + t v) - c) . n = 0
     //         (p - c + t v) . n = 0
@@ -81,12 +114,11 @@ std::optional<double> Plane::collision(Ray r) const {
     //         t = (c . n - p . n) / (v . n) = ((c - p) . n) / (v . n)
     Point p = r.start;
     Vector v = r.direction;
-    if (std::abs(v.dot_product(this->norm)) < 1e-6) {
+    if (std::abs(v.dot_product(norm)) < 1e-6) {
         // The ray is (nearly) parallel to the plane
         return {};
     }
-    double t = (this->point - p).dot_product(this->norm) /
-        v.dot_product(this->norm);
+    Real t = (point - p).dot_product(norm) / v.dot_product(norm);
     if (t < 0) {
         return {};
     } else {
@@ -94,6 +126,22 @@ std::optional<double> Plane::collision(Ray r) const {
     }
 }
 
+std::pair<Vector, Vector> checkerboard_axes(Vector norm, Vector orientation) {
+    // The orientation is meant to lie in the plane, but only the part of it
+    // which does is used.
+    Vector unit_norm = norm.normalized();
+    Vector in_plane = orientation - orientation.project(unit_norm);
+    if (!(in_plane.magnitude() > 1e-6 * orientation.magnitude())) {
+        throw std::invalid_argument("Checkerboard orientation is parallel to the plane's normal");
+    }
+    Vector x = in_plane.normalized();
+    return {x, unit_norm.cross_product(x)};
+}
+
+std::optional<Real> Plane::collision(Ray r) const {
+    return plane_collision(this->point, this->norm, r);
+}
+
 Vector Plane::normal([[maybe_unused]] Point p) const {
     return this->norm;
 }
@@ -102,15 +150,7 @@ Color Plane::get_color(Point p) const {
     if (!this->checkerboard) {
         return this->color;
     }
-    Vector v = p - this->point;
-    Vector x =
-        (v.dot_product(*this->orientation) /
-        (orientation->dot_product(*this->orientation))) *
-        *this->orientation;
-    Vector y = v - x;
-    int ix = (int) (x.magnitude() + 0.5);
-    int iy = (int) (y.magnitude() + 0.5);
-    if ((ix + iy) % 2 == 0) {
+    if (checkerboard_first(p - this->point, this->x_axis, this->y_axis)) {
         return this->color;
     } else {
         return *this->checkerboard;
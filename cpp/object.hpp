@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cmath>
 #include <optional>
+#include <utility>
 
 #include "types.hpp"
 
@@ -11,64 +13,153 @@
  */
 class Object {
 protected:
-    double reflectivity;
+    Real reflectivity;
     Color color;
 
 public:
-    Object(double, Color);
+    Object(Real, Color);
 
     virtual ~Object() {}
 
     /** Given a ray, find the time index at which that ray intersects this object
       first. Returns nothing if the ray does not intersect this object. */
-    virtual std::optional<double> collision(Ray) const = 0;
+    virtual std::optional<Real> collision(Ray) const = 0;
 
     /** Find a normal vector to this object at the given point. The point is
       assumed to lie on the object's surface. */
     virtual Vector normal(Point) const = 0;
 
+    /** normal() scaled to unit length. */
+    virtual Vector unit_normal(Point p) const {
+        return this->normal(p).normalized();
+    }
+
     /** Get the color of this object at the given point. The point is assumed to
       lie on the object's surface. */
     virtual Color get_color(Point) const;
 
-    virtual double get_reflectivity(Point) const {
+    virtual Real get_reflectivity(Point) const {
+        return this->reflectivity;
+    }
+
+    /** The color the object was made with, which for a checkerboard is the
+      color of the squares at its origin. */
+    Color get_base_color() const {
+        return this->color;
+    }
+
+    /** The reflectivity the object was made with. */
+    Real get_base_reflectivity() const {
         return this->reflectivity;
     }
 
+    /** Get a box containing this object, or nothing if the object is
+      unbounded. Unbounded objects are tested against every ray. */
+    virtual std::optional<BoundingBox> bounds() const;
+
 };
 
 /**
- * A sphere of solid material, as defined by a center and a radius.
+ * A sphere of solid material, as defined by a center and a radius. Final so
+ * that calls through a Sphere are never virtual.
  */
-class Sphere: public Object {
+class Sphere final: public Object {
 private:
     Point center;
-    double radius;
+    Real radius;
 
 public:
-    Sphere(double, Color, Point, double);
-    std::optional<double> collision(Ray) const override;
+    Sphere(Real, Color, Point, Real);
+    std::optional<Real> collision(Ray) const override;
+
+    Point get_center() const {
+        return this->center;
+    }
+
+    Real get_radius() const {
+        return this->radius;
+    }
+
     Vector normal(Point) const override;
+    std::optional<BoundingBox> bounds() const override;
 };
 
 /**
  * A plane extends infinitely in two dimensions. In contrast to mathematical
  * planes, our planes have thickness since every object must be 3D. Planes may
  * optionally be colored with a checkerboard pattern. In this case the squares
- * are centered on point1 and always have size 1.
+ * are centered on point1 and always have size 1, with their sides along the
+ * part of the orientation which lies in the plane (see checkerboard_axes).
  */
-class Plane: public Object {
+class Plane final: public Object {
 private:
     Vector norm;
     Point point;
     std::optional<Color> checkerboard;
     std::optional<Vector> orientation;
+    /** The checkerboard's axes, zero without one. */
+    Vector x_axis;
+    Vector y_axis;
 
 public:
-    Plane(double, Color, Vector, Point);
-    Plane(double, Color, Vector, Point, Color, Vector);
+    Plane(Real, Color, Vector, Point);
+    /** Throws if the checkerboard's orientation is parallel to the
+      normal. */
+    Plane(Real, Color, Vector, Point, Color, Vector);
 
-    std::optional<double> collision(Ray) const override;
+    std::optional<Real> collision(Ray) const override;
     Vector normal(Point) const override;
     Color get_color(Point) const override;
+
+    Vector get_normal() const {
+        return this->norm;
+    }
+
+    Point get_point() const {
+        return this->point;
+    }
+
+    const std::optional<Color>& get_checkerboard() const {
+        return this->checkerboard;
+    }
+
+    const std::optional<Vector>& get_orientation() const {
+        return this->orientation;
+    }
+
+    Vector get_x_axis() const {
+        return this->x_axis;
+    }
+
+    Vector get_y_axis() const {
+        return this->y_axis;
+    }
 };
+
+/** The first time at which a ray meets the surface of the sphere with the
+  given center and squared radius, as for Sphere::collision. */
+std::optional<Real> sphere_collision(Point, Real, const Ray&);
+
+/** A box around the sphere with the given center and radius, as for
+  Sphere::bounds. */
+BoundingBox sphere_bounds(Point, Real);
+
+/** The time at which a ray meets the plane through the given point with the
+  given normal, as for Plane::collision. */
+std::optional<Real> plane_collision(Point, Vector, const Ray&);
+
+/** Unit vectors in the plane with the given normal along the part of the
+  given orientation which lies in the plane and across it: the sides of a
+  checkerboard's squares. Throws if the orientation is parallel to the
+  normal, which leaves no direction in the plane to lay the squares along. */
+std::pair<Vector, Vector> checkerboard_axes(Vector, Vector);
+
+/** Whether a point on a checkerboard, given by its offset from the board's
+  origin, is in a square of the first color. */
+inline bool checkerboard_first(Vector offset, Vector x_axis, Vector y_axis) {
+    // The offset lies in the plane, so its lengths along and across the
+    // orientation are its components on the two axes.
+    int ix = (int) (std::abs(offset.dot_product(x_axis)) + 0.5);
+    int iy = (int) (std::abs(offset.dot_product(y_axis)) + 0.5);
+    return (ix + iy) % 2 == 0;
+}
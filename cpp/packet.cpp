@@ -0,0 +1,178 @@
+#include <algorithm>
+
+#if defined(__x86_64__) && !defined(RTLC_FLOAT)
+#include <immintrin.h>
+#endif
+
+#include "isa.hpp"
+#include "packet.hpp"
+
+namespace {
+
+using BoxKernel = uint32_t (*)(const BoundingBox&, const RayPacket&, const PacketInverse&,
+                               const Real*, size_t);
+
+uint32_t box_hits_scalar(const BoundingBox& box, const RayPacket& p, const PacketInverse& inv,
+                         const Real* t_max, size_t width) {
+    uint32_t lanes = 0;
+    for (size_t k = 0; k < width; k++) {
+        Real lo = 0.0;
+        Real hi = t_max[k];
+        Real t0 = (box.min.x - p.ox[k]) * inv.x[k];
+        Real t1 = (box.max.x - p.ox[k]) * inv.x[k];
+        lo = std::max(lo, std::min(t0, t1));
+        hi = std::min(hi, std::max(t0, t1));
+        t0 = (box.min.y - p.oy[k]) * inv.y[k];
+        t1 = (box.max.y - p.oy[k]) * inv.y[k];
+        lo = std::max(lo, std::min(t0, t1));
+        hi = std::min(hi, std::max(t0, t1));
+        t0 = (box.min.z - p.oz[k]) * inv.z[k];
+        t1 = (box.max.z - p.oz[k]) * inv.z[k];
+        lo = std::max(lo, std::min(t0, t1));
+        hi = std::min(hi, std::max(t0, t1));
+        lanes |= (uint32_t) (lo <= hi) << k;
+    }
+    return lanes;
+}
+
+// As for the sphere kernels, only double precision builds have vector
+// versions.
+#if defined(__x86_64__) && !defined(RTLC_FLOAT)
+
+// In the vector versions, std::min(a, b) is min(b, a) and std::max(a, b) is
+// max(b, a): the x86 instructions return their second operand when the
+// comparison fails, which keeps the NaN handling of the scalar test.
+
+__attribute__((target("sse4.1")))
+uint32_t box_hits_sse41(const BoundingBox& box, const RayPacket& p, const PacketInverse& inv,
+                        const Real* t_max, size_t width) {
+    uint32_t lanes = 0;
+    for (size_t k = 0; k < width; k += 2) {
+        __m128d lo = _mm_setzero_pd();
+        __m128d hi = _mm_loadu_pd(t_max + k);
+        const Real* origins[3] = {p.ox + k, p.oy + k, p.oz + k};
+        const Real* inverses[3] = {inv.x + k, inv.y + k, inv.z + k};
+        const Real mins[3] = {box.min.x, box.min.y, box.min.z};
+        const Real maxs[3] = {box.max.x, box.max.y, box.max.z};
+        for (int axis = 0; axis < 3; axis++) {
+            __m128d o = _mm_loadu_pd(origins[axis]);
+            __m128d i = _mm_loadu_pd(inverses[axis]);
+            __m128d t0 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(mins[axis]), o), i);
+            __m128d t1 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(maxs[axis]), o), i);
+            lo = _mm_max_pd(_mm_min_pd(t1, t0), lo);
+            hi = _mm_min_pd(_mm_max_pd(t1, t0), hi);
+        }
+        lanes |= (uint32_t) _mm_movemask_pd(_mm_cmple_pd(lo, hi)) << k;
+    }
+    return lanes;
+}
+
+__attribute__((target("avx2")))
+uint32_t box_hits_avx2(const BoundingBox& box, const RayPacket& p, const PacketInverse& inv,
+                       const Real* t_max, size_t width) {
+    uint32_t lanes = 0;
+    for (size_t k = 0; k < width; k += 4) {
+        __m256d lo = _mm256_setzero_pd();
+        __m256d hi = _mm256_loadu_pd(t_max + k);
+        const Real* origins[3] = {p.ox + k, p.oy + k, p.oz + k};
+        const Real* inverses[3] = {inv.x + k, inv.y + k, inv.z + k};
+        const Real mins[3] = {box.min.x, box.min.y, box.min.z};
+        const Real maxs[3] = {box.max.x, box.max.y, box.max.z};
+        for (int axis = 0; axis < 3; axis++) {
+            __m256d o = _mm256_loadu_pd(origins[axis]);
+            __m256d i = _mm256_loadu_pd(inverses[axis]);
+            __m256d t0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(mins[axis]), o), i);
+            __m256d t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(maxs[axis]), o), i);
+            lo = _mm256_max_pd(_mm256_min_pd(t1, t0), lo);
+            hi = _mm256_min_pd(_mm256_max_pd(t1, t0), hi);
+        }
+        lanes |= (uint32_t) _mm256_movemask_pd(_mm256_cmp_pd(lo, hi, _CMP_LE_OQ)) << k;
+    }
+    return lanes;
+}
+
+__attribute__((target("avx512f")))
+uint32_t box_hits_avx512(const BoundingBox& box, const RayPacket& p, const PacketInverse& inv,
+                         const Real* t_max, size_t width) {
+    if (width < 8) {
+        return box_hits_avx2(box, p, inv, t_max, width);
+    }
+    uint32_t lanes = 0;
+    for (size_t k = 0; k < width; k += 8) {
+        __m512d lo = _mm512_setzero_pd();
+        __m512d hi = _mm512_loadu_pd(t_max + k);
+        const Real* origins[3] = {p.ox + k, p.oy + k, p.oz + k};
+        const Real* inverses[3] = {inv.x + k, inv.y + k, inv.z + k};
+        const Real mins[3] = {box.min.x, box.min.y, box.min.z};
+        const Real maxs[3] = {box.max.x, box.max.y, box.max.z};
+        for (int axis = 0; axis < 3; axis++) {
+            __m512d o = _mm512_loadu_pd(origins[axis]);
+            __m512d i = _mm512_loadu_pd(inverses[axis]);
+            __m512d t0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(mins[axis]), o), i);
+            __m512d t1 = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(maxs[axis]), o), i);
+            // Masked forms, which avoid a spurious uninitialized warning from
+            // GCC's _mm512_min_pd and _mm512_max_pd.
+            lo = _mm512_mask_max_pd(lo, 0xff, _mm512_mask_min_pd(t0, 0xff, t1, t0), lo);
+            hi = _mm512_mask_min_pd(hi, 0xff, _mm512_mask_max_pd(t0, 0xff, t1, t0), hi);
+        }
+        lanes |= (uint32_t) _mm512_cmp_pd_mask(lo, hi, _CMP_LE_OQ) << k;
+    }
+    return lanes;
+}
+
+#endif
+
+/** The box test for each instruction set, in the order of Isa. */
+const BoxKernel kernels[] = {
+    box_hits_scalar,
+#if defined(__x86_64__) && !defined(RTLC_FLOAT)
+    box_hits_sse41,
+    box_hits_avx2,
+    box_hits_avx512,
+#endif
+};
+
+}
+
+RayPacket::RayPacket(size_t n):
+    size{n},
+    active{0},
+    ox{},
+    oy{},
+    oz{},
+    dx{},
+    dy{},
+    dz{}
+{}
+
+void RayPacket::set(size_t lane, const Ray& r) {
+    this->ox[lane] = r.start.x;
+    this->oy[lane] = r.start.y;
+    this->oz[lane] = r.start.z;
+    this->dx[lane] = r.direction.x;
+    this->dy[lane] = r.direction.y;
+    this->dz[lane] = r.direction.z;
+    this->active |= 1u << lane;
+}
+
+Ray RayPacket::ray(size_t lane) const {
+    return Ray(Point(this->ox[lane], this->oy[lane], this->oz[lane]),
+               Vector(this->dx[lane], this->dy[lane], this->dz[lane]));
+}
+
+PacketInverse::PacketInverse(const RayPacket& p) {
+    for (size_t k = 0; k < RayPacket::max_size; k++) {
+        this->x[k] = 1 / p.dx[k];
+        this->y[k] = 1 / p.dy[k];
+        this->z[k] = 1 / p.dz[k];
+    }
+}
+
+uint32_t packet_box_hits(const BoundingBox& box, const RayPacket& p, const PacketInverse& inv,
+                         const Real* t_max, size_t width) {
+    return kernels[(size_t) current_isa()](box, p, inv, t_max, width);
+}
+
+bool valid_packet_size(size_t n) {
+    return n == 1 || n == 4 || n == 8 || n == 16;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "types.hpp"
+
+/**
+ * A group of rays traced together, stored as a structure of arrays so that
+ * each step of a query can be done for every ray at once. Lanes are numbered
+ * from zero; only the lanes whose bit is set in `active` take part.
+ */
+struct RayPacket {
+    static const size_t max_size = 16;
+
+    size_t size;
+    uint32_t active;
+    Real ox[max_size];
+    Real oy[max_size];
+    Real oz[max_size];
+    Real dx[max_size];
+    Real dy[max_size];
+    Real dz[max_size];
+
+    /** An empty packet of the given size, with no lane active. */
+    RayPacket(size_t);
+
+    /** Put a ray in a lane and make the lane active. */
+    void set(size_t, const Ray&);
+
+    Ray ray(size_t) const;
+};
+
+/**
+ * The reciprocals of a packet's directions, computed once per traversal for
+ * the slab tests against every box.
+ */
+struct PacketInverse {
+    Real x[RayPacket::max_size];
+    Real y[RayPacket::max_size];
+    Real z[RayPacket::max_size];
+
+    PacketInverse(const RayPacket&);
+};
+
+/** BoundingBox::hit for the first `width` lanes of a packet at once: the
+  mask of lanes whose ray passes through the box between time 0 and
+  t_max[lane]. The width must be 4, 8 or 16. */
+uint32_t packet_box_hits(const BoundingBox&, const RayPacket&, const PacketInverse&,
+                         const Real*, size_t);
+
+/** Whether rays may be traced in packets of this size: 4, 8 or 16, or 1 for
+  tracing every ray on its own. */
+bool valid_packet_size(size_t);
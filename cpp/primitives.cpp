@@ -0,0 +1,170 @@
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <typeinfo>
+
+#include "primitives.hpp"
+#include "prototype.hpp"
+
+namespace {
+
+/** The hit of a ray on object i, which has no parts. */
+template <typename T>
+std::optional<Hit> part_hit(size_t i, const T& obj, const Ray& r) {
+    std::optional<Real> t = obj.collision(r);
+    if (!t) {
+        return {};
+    }
+    return Hit{i, *t, 0, 0};
+}
+
+std::optional<Hit> part_hit(size_t i, const TriangleMesh& mesh, const Ray& r) {
+    std::optional<MeshHit> h =
+        mesh.get_geometry().closest(r, std::numeric_limits<Real>::infinity());
+    if (!h) {
+        return {};
+    }
+    return Hit{i, h->t, h->triangle, 0};
+}
+
+std::optional<Hit> part_hit(size_t i, const Instance& instance, const Ray& r) {
+    std::optional<Hit> h = instance.get_prototype().intersect(instance.to_local(r));
+    if (!h) {
+        return {};
+    }
+    return Hit{i, h->t, (uint32_t) h->object, h->part};
+}
+
+}
+
+Primitives::Primitives():
+    spheres{},
+    planes{},
+    custom{},
+    meshes{},
+    instances{},
+    refs{}
+{}
+
+void Primitives::add(std::unique_ptr<Object>&& obj) {
+    if (typeid(*obj) == typeid(Sphere)) {
+        this->add(static_cast<const Sphere&>(*obj));
+    } else if (typeid(*obj) == typeid(Plane)) {
+        this->add(static_cast<const Plane&>(*obj));
+    } else if (typeid(*obj) == typeid(TriangleMesh)) {
+        this->add(static_cast<const TriangleMesh&>(*obj));
+    } else {
+        this->refs.push_back(Ref{Kind::custom, (uint32_t) this->custom.size()});
+        this->custom.push_back(std::move(obj));
+    }
+}
+
+void Primitives::add(const Sphere& s) {
+    this->refs.push_back(Ref{Kind::sphere, (uint32_t) this->spheres.size()});
+    this->spheres.push_back(CompiledSphere(s));
+}
+
+void Primitives::add(const Plane& p) {
+    this->refs.push_back(Ref{Kind::plane, (uint32_t) this->planes.size()});
+    this->planes.push_back(CompiledPlane(p));
+}
+
+void Primitives::add(const TriangleMesh& m) {
+    this->refs.push_back(Ref{Kind::mesh, (uint32_t) this->meshes.size()});
+    this->meshes.push_back(m);
+}
+
+void Primitives::add(const Instance& i) {
+    this->refs.push_back(Ref{Kind::instance, (uint32_t) this->instances.size()});
+    this->instances.push_back(i);
+}
+
+void Primitives::append(std::vector<Primitives>& parts) {
+    for (Primitives& part : parts) {
+        uint32_t base[] = {(uint32_t) this->spheres.size(), (uint32_t) this->planes.size(),
+                           (uint32_t) this->custom.size(), (uint32_t) this->meshes.size(),
+                           (uint32_t) this->instances.size()};
+        for (Ref r : part.refs) {
+            this->refs.push_back(Ref{r.kind, base[(size_t) r.kind] + r.index});
+        }
+        this->spheres.insert(this->spheres.end(), part.spheres.begin(), part.spheres.end());
+        this->planes.insert(this->planes.end(), part.planes.begin(), part.planes.end());
+        this->custom.insert(this->custom.end(), std::make_move_iterator(part.custom.begin()),
+                            std::make_move_iterator(part.custom.end()));
+        this->meshes.insert(this->meshes.end(), part.meshes.begin(), part.meshes.end());
+        this->instances.insert(this->instances.end(), part.instances.begin(),
+                               part.instances.end());
+        part = Primitives();
+    }
+}
+
+void Primitives::truncate(size_t count) {
+    // Objects of each kind are stored in the order they were added, so the
+    // last ones of each kind are the ones to remove.
+    for (size_t i = count; i < this->refs.size(); i++) {
+        switch (this->refs[i].kind) {
+        case Kind::sphere:
+            this->spheres.pop_back();
+            break;
+        case Kind::plane:
+            this->planes.pop_back();
+            break;
+        case Kind::custom:
+            this->custom.pop_back();
+            break;
+        case Kind::mesh:
+            this->meshes.pop_back();
+            break;
+        case Kind::instance:
+            this->instances.pop_back();
+            break;
+        }
+    }
+    this->refs.resize(std::min(count, this->refs.size()));
+}
+
+void Primitives::reserve(size_t sphere_count, size_t plane_count) {
+    this->spheres.reserve(this->spheres.size() + sphere_count);
+    this->planes.reserve(this->planes.size() + plane_count);
+    this->refs.reserve(this->refs.size() + sphere_count + plane_count);
+}
+
+void Primitives::build_meshes(ThreadPool& pool) {
+    for (TriangleMesh& m : this->meshes) {
+        m.get_geometry().build(pool);
+    }
+}
+
+size_t Primitives::size() const {
+    return this->refs.size();
+}
+
+Primitives::Kind Primitives::kind(size_t i) const {
+    return this->refs[i].kind;
+}
+
+const CompiledSphere* Primitives::as_sphere(size_t i) const {
+    Ref r = this->refs[i];
+    return r.kind == Kind::sphere ? &this->spheres[r.index] : nullptr;
+}
+
+std::optional<Hit> Primitives::collision(size_t i, const Ray& r) const {
+    return this->visit(i, [&](const auto& o) { return part_hit(i, o, r); });
+}
+
+std::optional<BoundingBox> Primitives::bounds(size_t i) const {
+    return this->visit(i, [](const auto& o) { return o.bounds(); });
+}
+
+bool Primitives::occludes(size_t i, const Ray& r, Real t_max) const {
+    return this->visit(i, [&](const auto& o) {
+        using T = std::decay_t<decltype(o)>;
+        if constexpr (std::is_same_v<T, TriangleMesh> || std::is_same_v<T, Instance>) {
+            return o.occludes(r, t_max);
+        } else {
+            std::optional<Real> t = o.collision(r);
+            return t && *t < t_max;
+        }
+    });
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "compiled.hpp"
+#include "instance.hpp"
+#include "mesh.hpp"
+#include "object.hpp"
+#include "thread_pool.hpp"
+#include "types.hpp"
+
+/**
+ * The closest intersection of a ray with a list of objects: which object was
+ * hit (as an index into the list), at what time, and which part of it: the
+ * triangle of a mesh, or the object of an instance's prototype, whose own
+ * part is inner_part. Parts are zero for objects which have none.
+ */
+struct Hit {
+    size_t object;
+    Real t;
+    uint32_t part;
+    uint32_t inner_part;
+};
+
+/**
+ * The objects of a scene. Spheres and planes are compiled as they are added
+ * (see compiled.hpp), kept by value in one contiguous array per type and
+ * reached with a switch on their type, so that calls on them are direct rather
+ * than virtual; triangle meshes and instances of prototypes are kept the same
+ * way. Any other subclass of Object is a custom shape, kept behind a pointer
+ * and called through its vtable.
+ *
+ * Objects are identified by the order in which they were added, whatever
+ * their type.
+ */
+class Primitives {
+public:
+    enum class Kind: uint32_t {
+        sphere,
+        plane,
+        custom,
+        mesh,
+        instance,
+    };
+
+    /** Where an object lives: which array, and its index there. */
+    struct Ref {
+        Kind kind;
+        uint32_t index;
+    };
+
+private:
+    std::vector<CompiledSphere> spheres;
+    std::vector<CompiledPlane> planes;
+    std::vector<std::unique_ptr<Object>> custom;
+    std::vector<TriangleMesh> meshes;
+    std::vector<Instance> instances;
+    std::vector<Ref> refs;
+
+public:
+    Primitives();
+
+    /** Add an object. Spheres and planes are compiled into their own arrays
+      and triangle meshes copied into theirs; anything else is kept as a
+      custom shape. */
+    void add(std::unique_ptr<Object>&&);
+    void add(const Sphere&);
+    void add(const Plane&);
+    void add(const TriangleMesh&);
+    void add(const Instance&);
+
+    /** Add all the objects of several lists after this one's, in order,
+      emptying each list as soon as it has been copied. */
+    void append(std::vector<Primitives>&);
+
+    /** Remove all but the first count objects. */
+    void truncate(size_t count);
+
+    /** Make room for this many more spheres and planes, for adding objects
+      whose counts are known beforehand. */
+    void reserve(size_t, size_t);
+
+    /** Build the hierarchy of every mesh which does not have one yet (see
+      MeshGeometry). */
+    void build_meshes(ThreadPool&);
+
+    size_t size() const;
+    Kind kind(size_t) const;
+
+    /** The object as a sphere, or null if it is something else. */
+    const CompiledSphere* as_sphere(size_t) const;
+
+    /** The ray's hit on the object, with the part of it which was hit. */
+    std::optional<Hit> collision(size_t, const Ray&) const;
+    std::optional<BoundingBox> bounds(size_t) const;
+
+    /** Whether the object blocks the ray before time t_max. A mesh stops
+      at the first triangle which does, and an instance at the first of its
+      prototype's objects. */
+    bool occludes(size_t, const Ray&, Real) const;
+
+    /** Call `f` with the object as its concrete type: `const CompiledSphere&`,
+      `const CompiledPlane&`, `const TriangleMesh&`, `const Instance&`
+      or, for custom shapes, `const Object&`. Every call must return the same type. */
+    template <typename F>
+    decltype(auto) visit(size_t, F&&) const;
+};
+
+template <typename F>
+decltype(auto) Primitives::visit(size_t i, F&& f) const {
+    Ref r = this->refs[i];
+    switch (r.kind) {
+    case Kind::sphere:
+        return f(this->spheres[r.index]);
+    case Kind::plane:
+        return f(this->planes[r.index]);
+    case Kind::mesh:
+        return f(this->meshes[r.index]);
+    case Kind::instance:
+        return f(this->instances[r.index]);
+    default:
+        return f(static_cast<const Object&>(*this->custom[r.index]));
+    }
+}
@@ -0,0 +1,33 @@
+#include "prototype.hpp"
+
+Prototype::Prototype():
+    objects{},
+    accelerator{std::make_unique<LinearScan>(objects)}
+{}
+
+void Prototype::add_object(std::unique_ptr<Object>&& obj) {
+    this->objects.add(std::move(obj));
+    LinearScan* scan = dynamic_cast<LinearScan*>(this->accelerator.get());
+    if (scan) {
+        scan->add(this->objects.size() - 1);
+    } else {
+        this->accelerator = std::make_unique<LinearScan>(this->objects);
+    }
+}
+
+void Prototype::build_accelerator(const std::string& name, ThreadPool& pool) {
+    this->objects.build_meshes(pool);
+    this->accelerator = make_accelerator(name, this->objects, pool);
+}
+
+std::optional<BoundingBox> Prototype::bounds() const {
+    BoundingBox box;
+    for (size_t i = 0; i < this->objects.size(); i++) {
+        std::optional<BoundingBox> b = this->objects.bounds(i);
+        if (!b) {
+            return {};
+        }
+        box.expand(*b);
+    }
+    return box;
+}
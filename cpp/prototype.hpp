@@ -0,0 +1,61 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "accel.hpp"
+#include "object.hpp"
+#include "primitives.hpp"
+#include "thread_pool.hpp"
+#include "types.hpp"
+
+/**
+ * Objects which are placed in a scene any number of times by instances (see
+ * instance.hpp), with an acceleration structure of their own. A scene of
+ * instances is traced through two levels of structure: the scene's, over the
+ * instances' bounds, and below it that of each prototype, built once however
+ * many times the prototype is placed.
+ *
+ * Like a scene, a prototype tests every object against every ray until its
+ * structure is built. It must be complete, structure and all, before it is
+ * instanced, since instances take its bounds when they are made. Prototypes
+ * hold objects, not instances, so instances do not nest.
+ */
+class Prototype {
+private:
+    Primitives objects;
+    std::unique_ptr<Accelerator> accelerator;
+
+public:
+    Prototype();
+    // The accelerator refers to the objects, so a prototype stays where it
+    // was made.
+    Prototype(const Prototype&) = delete;
+    Prototype& operator=(const Prototype&) = delete;
+
+    void add_object(std::unique_ptr<Object>&&);
+
+    /** Build the named acceleration structure over the objects, and the
+      hierarchies of their meshes. */
+    void build_accelerator(const std::string&, ThreadPool&);
+
+    size_t size() const {
+        return this->objects.size();
+    }
+
+    /** A box around every object, or nothing if some object is unbounded. */
+    std::optional<BoundingBox> bounds() const;
+
+    std::optional<Hit> intersect(const Ray& r) const {
+        return this->accelerator->intersect(r);
+    }
+
+    bool occluded(const Ray& r, Real t_max) const {
+        return this->accelerator->occluded(r, t_max);
+    }
+
+    const Primitives& get_objects() const {
+        return this->objects;
+    }
+};
@@ -0,0 +1,171 @@
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <thread>
+
+#include "renderer.hpp"
+#include "wavefront.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+void TileQueue::push(const Tile& tile) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->tiles.push_back(tile);
+}
+
+void TileQueue::offer(const Tile& tile) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->tiles.push_front(tile);
+}
+
+bool TileQueue::pop(Tile& tile) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->tiles.empty()) {
+        return false;
+    }
+    tile = this->tiles.back();
+    this->tiles.pop_back();
+    return true;
+}
+
+bool TileQueue::steal(Tile& tile) {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    if (this->tiles.empty()) {
+        return false;
+    }
+    tile = this->tiles.front();
+    this->tiles.pop_front();
+    return true;
+}
+
+double RenderStats::imbalance() const {
+    if (this->workers.empty()) {
+        return 0.0;
+    }
+    double total = 0.0;
+    double most = 0.0;
+    for (const WorkerStats& w : this->workers) {
+        total += w.busy_seconds;
+        most = std::max(most, w.busy_seconds);
+    }
+    double mean = total / this->workers.size();
+    return mean > 0.0 ? most / mean - 1.0 : 0.0;
+}
+
+TraceStats RenderStats::total() const {
+    TraceStats t;
+    for (const WorkerStats& w : this->workers) {
+        t += w.trace;
+    }
+    return t;
+}
+
+Renderer::Renderer(const Scene& s, ThreadPool& p, size_t ts):
+    scene{s},
+    pool{p},
+    tile_size{ts},
+    split_threshold{0.0005}
+{}
+
+std::vector<Tile> Renderer::make_tiles() const {
+    std::vector<Tile> tiles;
+    for (size_t y = 0; y < this->scene.pixel_height; y += this->tile_size) {
+        for (size_t x = 0; x < this->scene.pixel_width; x += this->tile_size) {
+            tiles.push_back(Tile{
+                x,
+                y,
+                std::min(x + this->tile_size, this->scene.pixel_width),
+                std::min(y + this->tile_size, this->scene.pixel_height)});
+        }
+    }
+    return tiles;
+}
+
+RenderStats Renderer::render(Image& img) const {
+    Clock::time_point start = Clock::now();
+    size_t n = this->pool.size();
+    std::vector<Tile> tiles = this->make_tiles();
+    std::vector<TileQueue> queues(n);
+    // Deal out contiguous runs of tiles so that neighbouring tiles, which
+    // tend to cost the same, start out on the same worker.
+    for (size_t t = 0; t < tiles.size(); t++) {
+        queues[t * n / tiles.size()].push(tiles[t]);
+    }
+
+    std::atomic<size_t> remaining{this->scene.pixel_width * this->scene.pixel_height};
+    std::atomic<size_t> idle{0};
+    RenderStats stats{0.0, std::vector<WorkerStats>(n, WorkerStats{0.0, 0, 0, 0, TraceStats()})};
+
+    this->pool.run([&](size_t me) {
+        WorkerStats& ws = stats.workers[me];
+        // The wavefront engine takes as many whole rows of a tile at once as
+        // make up its batch; otherwise rows are traced one at a time.
+        std::optional<Wavefront> wavefront;
+        if (this->scene.wavefront_batch > 0) {
+            wavefront.emplace(this->scene);
+        }
+        auto find_work = [&](Tile& tile) {
+            if (queues[me].pop(tile)) {
+                return true;
+            }
+            for (size_t k = 1; k < n; k++) {
+                if (queues[(me + k) % n].steal(tile)) {
+                    ws.steals++;
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        Tile tile;
+        while (true) {
+            if (!find_work(tile)) {
+                idle++;
+                bool found = false;
+                while (!found && remaining > 0) {
+                    std::this_thread::yield();
+                    found = find_work(tile);
+                }
+                idle--;
+                if (!found) {
+                    break;
+                }
+            }
+
+            Clock::time_point tile_start = Clock::now();
+            size_t rows = 1;
+            if (wavefront) {
+                rows = std::max<size_t>(1, this->scene.wavefront_batch / (tile.x1 - tile.x0));
+            }
+            for (size_t j = tile.y0; j < tile.y1; j += rows) {
+                size_t end = std::min(tile.y1, j + rows);
+                if (wavefront) {
+                    wavefront->render(tile.x0, tile.x1, j, end, img, ws.trace);
+                } else {
+                    for (size_t row = j; row < end; row++) {
+                        this->scene.compute_pixel_colors(tile.x0, row, tile.x1 - tile.x0,
+                                                         &img(tile.x0, row), ws.trace);
+                    }
+                }
+                remaining -= (end - j) * (tile.x1 - tile.x0);
+                // If someone is waiting for work and the rest of this tile
+                // looks expensive, give half of the remaining rows away.
+                size_t left = tile.y1 - end;
+                if (left >= 2 && idle > 0) {
+                    std::chrono::duration<double> spent = Clock::now() - tile_start;
+                    if (spent / (end - tile.y0) * left > this->split_threshold) {
+                        size_t mid = tile.y1 - left / 2;
+                        queues[me].offer(Tile{tile.x0, mid, tile.x1, tile.y1});
+                        tile.y1 = mid;
+                        ws.splits++;
+                    }
+                }
+            }
+            ws.busy_seconds += std::chrono::duration<double>(Clock::now() - tile_start).count();
+            ws.tiles++;
+        }
+    });
+
+    stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return stats;
+}
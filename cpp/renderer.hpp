@@ -0,0 +1,87 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "image.hpp"
+#include "scene.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * A rectangular block of pixels, covering columns [x0, x1) and rows [y0, y1).
+ */
+struct Tile {
+    size_t x0;
+    size_t y0;
+    size_t x1;
+    size_t y1;
+};
+
+/**
+ * The tiles owned by one worker. The owner takes work from the back while other
+ * workers steal from the front, so a thief takes the work the owner would have
+ * reached last.
+ */
+class TileQueue {
+private:
+    std::mutex mutex;
+    std::deque<Tile> tiles;
+
+public:
+    void push(const Tile&);
+    /** Put a tile where the next thief will find it. */
+    void offer(const Tile&);
+    bool pop(Tile&);
+    bool steal(Tile&);
+};
+
+/**
+ * Per-worker counters collected during a render.
+ */
+struct WorkerStats {
+    double busy_seconds;
+    size_t tiles;
+    size_t steals;
+    size_t splits;
+    TraceStats trace;
+};
+
+struct RenderStats {
+    double seconds;
+    std::vector<WorkerStats> workers;
+
+    /** How much longer the busiest worker rendered than the average worker,
+      as a fraction of the average. Zero means perfectly balanced. */
+    double imbalance() const;
+
+    /** The trace counters summed over all workers. */
+    TraceStats total() const;
+};
+
+/**
+ * Renders a scene into an image by splitting the image into tiles and handing
+ * the tiles out to the workers of a thread pool. Every pixel belongs to exactly
+ * one tile, so workers write into the image without any locking.
+ *
+ * Each worker starts with a contiguous share of the tiles in its own queue and
+ * steals from the other queues once it runs dry. A worker in the middle of an
+ * expensive tile (mirrors, say) splits off the rest of the tile for idle
+ * workers to steal rather than finishing it alone.
+ */
+class Renderer {
+private:
+    const Scene& scene;
+    ThreadPool& pool;
+    size_t tile_size;
+    // Tiles expected to take less than this long are never split.
+    std::chrono::duration<double> split_threshold;
+
+    std::vector<Tile> make_tiles() const;
+
+public:
+    Renderer(const Scene&, ThreadPool&, size_t);
+
+    RenderStats render(Image&) const;
+};
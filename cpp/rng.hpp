@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * A counter-based random number generator. Its output is a pure function of a
+ * key, here (seed, pixel, sample), and the number of values drawn so far, so
+ * any thread can recreate the stream for a given sample without shared state.
+ * This keeps renders bitwise reproducible regardless of how pixels are divided
+ * between threads. Construction costs a few multiplies and the state fits in
+ * two registers.
+ */
+class SampleRng {
+private:
+    uint64_t key;
+    uint64_t counter;
+
+    /** The SplitMix64 finalizer, a cheap bijective hash with good
+      avalanche. */
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+public:
+    SampleRng(uint64_t seed, uint64_t pixel, uint64_t sample):
+        key{mix(mix(mix(seed) ^ pixel) ^ sample)},
+        counter{0}
+    {}
+
+    uint64_t next_u64() {
+        return mix(this->key + 0x9e3779b97f4a7c15ull * ++this->counter);
+    }
+
+    /** A double uniformly distributed in [0, 1). */
+    double next_double() {
+        return (this->next_u64() >> 11) * 0x1.0p-53;
+    }
+};
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "rng.hpp"
+#include "sampler.hpp"
+
+namespace {
+
+// Key for the per-pixel randomization of the deterministic patterns. It is
+// kept away from small values, which are used as sample indices.
+const uint64_t pattern_stream = ~0ull;
+
+uint32_t pixel_hash(uint64_t seed, uint64_t pixel, uint64_t which) {
+    SampleRng rng(seed, pixel, pattern_stream - which);
+    return (uint32_t) rng.next_u64();
+}
+
+/** Element i of a pseudo-random permutation of [0, l), from Kensler's
+  "Correlated Multi-Jittered Sampling". */
+uint32_t permute(uint32_t i, uint32_t l, uint32_t p) {
+    uint32_t w = l - 1;
+    w |= w >> 1;
+    w |= w >> 2;
+    w |= w >> 4;
+    w |= w >> 8;
+    w |= w >> 16;
+    do {
+        i ^= p;
+        i *= 0xe170893d;
+        i ^= p >> 16;
+        i ^= (i & w) >> 4;
+        i ^= p >> 8;
+        i *= 0x0929eb3f;
+        i ^= p >> 23;
+        i ^= (i & w) >> 1;
+        i *= 1 | p >> 27;
+        i *= 0x6935fa69;
+        i ^= (i & w) >> 11;
+        i *= 0x74dcb303;
+        i ^= (i & w) >> 2;
+        i *= 0x9e501cc3;
+        i ^= (i & w) >> 2;
+        i *= 0xc860a3df;
+        i &= w;
+        i ^= i >> 5;
+    } while (i >= l);
+    return (i + p) % l;
+}
+
+/** A float in [0, 1) determined by i and p, also from Kensler. */
+double randfloat(uint32_t i, uint32_t p) {
+    i ^= p;
+    i ^= i >> 17;
+    i ^= i >> 10;
+    i *= 0xb36534e5;
+    i ^= i >> 12;
+    i ^= i >> 21;
+    i *= 0x93fc4795;
+    i ^= 0xdf6e307f;
+    i ^= i >> 17;
+    i *= 1 | p >> 18;
+    return i * 0x1.0p-32;
+}
+
+double radical_inverse(uint64_t i, uint64_t base) {
+    double inv = 1.0 / base;
+    double f = inv;
+    double r = 0.0;
+    while (i > 0) {
+        r += f * (i % base);
+        i /= base;
+        f *= inv;
+    }
+    return r;
+}
+
+double shift(double x, double offset) {
+    x += offset;
+    return x >= 1.0 ? x - 1.0 : x;
+}
+
+uint32_t reverse_bits(uint32_t x) {
+    x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+    x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+    x = ((x >> 8) & 0x00ff00ff) | ((x & 0x00ff00ff) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+/** Owen scrambling of a 32-bit fixed point value, as a hash that only lets
+  each bit depend on the bits above it. */
+uint32_t owen_scramble(uint32_t x, uint32_t seed) {
+    x = reverse_bits(x);
+    x += seed;
+    x ^= x * 0x6c50b47c;
+    x ^= x * 0xb82f1e52;
+    x ^= x * 0xc7afe638;
+    x ^= x * 0x8d22f6e6;
+    return reverse_bits(x);
+}
+
+/** Sobol dimension 0 is the base 2 radical inverse; dimension 1 uses the
+  direction numbers of the polynomial x + 1. */
+uint32_t sobol(uint32_t i, int dim) {
+    if (dim == 0) {
+        return reverse_bits(i);
+    }
+    uint32_t r = 0;
+    for (uint32_t v = 1u << 31; i != 0; i >>= 1, v ^= v >> 1) {
+        if (i & 1) {
+            r ^= v;
+        }
+    }
+    return r;
+}
+
+}
+
+std::pair<double, double> RandomSampler::sample(uint64_t seed, uint64_t pixel,
+                                                size_t index,
+                                                [[maybe_unused]] size_t count) const {
+    SampleRng rng(seed, pixel, index);
+    double x = rng.next_double();
+    double y = rng.next_double();
+    return {x, y};
+}
+
+std::pair<double, double> StratifiedSampler::sample(uint64_t seed, uint64_t pixel,
+                                                    size_t index, size_t count) const {
+    uint32_t p = pixel_hash(seed, pixel, 0);
+    uint32_t n = count;
+    uint32_t m = std::max(1u, (uint32_t) std::sqrt((double) n));
+    uint32_t k = (n + m - 1) / m;
+    uint32_t s = permute(index, n, p * 0x51633e2d);
+    uint32_t sx = permute(s % m, m, p * 0x68bc21eb);
+    uint32_t sy = permute(s / m, k, p * 0x02e5be93);
+    double jx = randfloat(s, p * 0x967a889b);
+    double jy = randfloat(s, p * 0x368cc8b7);
+    double x = (sx + (sy + jx) / k) / m;
+    double y = (s + jy) / n;
+    return {x, y};
+}
+
+std::pair<double, double> HaltonSampler::sample(uint64_t seed, uint64_t pixel,
+                                                size_t index,
+                                                [[maybe_unused]] size_t count) const {
+    double dx = pixel_hash(seed, pixel, 0) * 0x1.0p-32;
+    double dy = pixel_hash(seed, pixel, 1) * 0x1.0p-32;
+    return {shift(radical_inverse(index, 2), dx),
+            shift(radical_inverse(index, 3), dy)};
+}
+
+std::pair<double, double> SobolSampler::sample(uint64_t seed, uint64_t pixel,
+                                               size_t index,
+                                               [[maybe_unused]] size_t count) const {
+    uint32_t x = owen_scramble(sobol(index, 0), pixel_hash(seed, pixel, 0));
+    uint32_t y = owen_scramble(sobol(index, 1), pixel_hash(seed, pixel, 1));
+    return {x * 0x1.0p-32, y * 0x1.0p-32};
+}
+
+std::unique_ptr<Sampler> make_sampler(const std::string& name) {
+    if (name == "random") {
+        return std::make_unique<RandomSampler>();
+    } else if (name == "stratified") {
+        return std::make_unique<StratifiedSampler>();
+    } else if (name == "halton") {
+        return std::make_unique<HaltonSampler>();
+    } else if (name == "sobol") {
+        return std::make_unique<SobolSampler>();
+    } else {
+        throw std::invalid_argument("Unknown sampler: " + name);
+    }
+}
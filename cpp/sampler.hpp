@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+/**
+ * A sampler decides where within a pixel the antialiasing samples go.
+ *
+ * Samples are positions in [0, 1)^2 relative to the corner of the pixel. The
+ * position of a sample depends only on the seed, the pixel and the sample's
+ * index among the `count` samples taken for that pixel, so samplers hold no
+ * mutable state and can be shared between threads.
+ */
+class Sampler {
+public:
+    virtual ~Sampler() {}
+
+    /** Get the position of sample `index` out of `count` in the given pixel. */
+    virtual std::pair<double, double> sample(uint64_t seed, uint64_t pixel,
+                                             size_t index, size_t count) const = 0;
+};
+
+/**
+ * Independent uniform random samples.
+ */
+class RandomSampler: public Sampler {
+public:
+    std::pair<double, double> sample(uint64_t, uint64_t, size_t, size_t) const override;
+};
+
+/**
+ * Correlated multi-jittered samples (Kensler 2013). The pixel is divided into
+ * a grid of roughly square strata with one sample in each, and the samples are
+ * also stratified along each axis separately. Works for any sample count.
+ */
+class StratifiedSampler: public Sampler {
+public:
+    std::pair<double, double> sample(uint64_t, uint64_t, size_t, size_t) const override;
+};
+
+/**
+ * The Halton sequence in bases 2 and 3, randomly shifted (modulo 1) per pixel
+ * so that neighbouring pixels do not share a pattern.
+ */
+class HaltonSampler: public Sampler {
+public:
+    std::pair<double, double> sample(uint64_t, uint64_t, size_t, size_t) const override;
+};
+
+/**
+ * The first two dimensions of the Sobol sequence with hash-based Owen
+ * scrambling (Burley 2020). Best at power-of-two sample counts.
+ */
+class SobolSampler: public Sampler {
+public:
+    std::pair<double, double> sample(uint64_t, uint64_t, size_t, size_t) const override;
+};
+
+/** Build a sampler by name: "random", "stratified", "halton" or "sobol". */
+std::unique_ptr<Sampler> make_sampler(const std::string&);
@@ -1,13 +1,168 @@
-#include <fstream>
-#include <random>
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <type_traits>
+#include <vector>
 
+#include "image.hpp"
 #include "json.hpp"
+#include "mapped_file.hpp"
+#include "mesh.hpp"
+#include "obj_file.hpp"
+#include "prototype.hpp"
 #include "scene.hpp"
+#include "scene_file.hpp"
+#include "scene_json.hpp"
 
 using json = nlohmann::json;
 
+namespace {
+
+// Keys the roulette streams apart from the samplers', which use the sample
+// index and the values just below ~0.
+const uint64_t roulette_stream = ~0ull >> 1;
+
+/** A hit along a path which reflects: its own color and the weight of the
+  reflection's. */
+struct PathVertex {
+    Color color;
+    Real weight;
+};
+
+// Paths up to this deep keep their hits on the stack.
+const size_t stack_depth = 16;
+
+/** The unit normal of an object where a ray hits the given part of it (see
+  Hit) at the given time and point. A mesh's depends on which triangle the
+  ray hits. */
+template <typename T>
+Vector surface_normal(const T& obj, [[maybe_unused]] const Ray& ray,
+                      [[maybe_unused]] Real time, [[maybe_unused]] uint32_t part,
+                      Point collision) {
+    return obj.unit_normal(collision);
+}
+
+Vector surface_normal(const TriangleMesh& mesh, const Ray& ray, Real time, uint32_t part,
+                      [[maybe_unused]] Point collision) {
+    return mesh.hit_normal(ray, time, part);
+}
+
+/** An object of a prototype where an instance places it, as shade_object
+  sees it: its color is looked up where the ray hits it in the prototype's
+  space, which is where `local`, the ray in that space, reaches at the time
+  of the hit. `part` is the part of the object which was hit. */
+template <typename T>
+struct Placed {
+    const T& object;
+    const Instance& instance;
+    Ray local;
+    Real time;
+    uint32_t part;
+
+    Color get_color(Point) const {
+        return this->object.get_color(this->local.at(this->time));
+    }
+
+    Real get_reflectivity(Point) const {
+        return this->object.get_reflectivity(this->local.at(this->time));
+    }
+};
+
+/** The object's normal in the prototype's space, carried out to the
+  scene's. */
+template <typename T>
+Vector surface_normal(const Placed<T>& placed, [[maybe_unused]] const Ray& ray, Real time,
+                      [[maybe_unused]] uint32_t part, [[maybe_unused]] Point collision) {
+    Vector n = surface_normal(placed.object, placed.local, time, placed.part,
+                              placed.local.at(time));
+    return placed.instance.normal_to_world(n).normalized();
+}
+
+/** The geometry of a mesh entry: read from the OBJ file named by "file",
+  relative to the scene's directory, or given inline as "vertices" and
+  "triangles" (lists of three numbers and of three vertex indices from zero),
+  with an optional "normals" giving one normal per vertex. */
+std::shared_ptr<MeshGeometry> parse_mesh(json& obj, const std::string& directory) {
+    if (obj.contains("file")) {
+        std::filesystem::path file = obj["file"].get<std::string>();
+        return read_obj((std::filesystem::path(directory) / file).string());
+    }
+    std::vector<Point> vertices;
+    for (json& v : obj["vertices"]) {
+        vertices.push_back(Point(v[0], v[1], v[2]));
+    }
+    std::vector<Vector> normals;
+    if (obj.contains("normals")) {
+        for (json& n : obj["normals"]) {
+            normals.push_back(Vector(n[0], n[1], n[2]));
+        }
+    }
+    std::vector<MeshTriangle> triangles;
+    for (json& t : obj["triangles"]) {
+        MeshTriangle tri{{t[0], t[1], t[2]}, {MeshTriangle::no_normal, MeshTriangle::no_normal,
+                                              MeshTriangle::no_normal}};
+        if (!normals.empty()) {
+            std::copy(tri.vertex, tri.vertex + 3, tri.normal);
+        }
+        triangles.push_back(tri);
+    }
+    return std::make_shared<MeshGeometry>(std::move(vertices), std::move(normals),
+                                          std::move(triangles));
+}
+
+/** The transform of an instance entry: "matrix", the three rows of [A | b]
+  for the map p -> A p + b, or any of "scale" (one number, or one for each
+  axis), "rotate" ({"axis": [x, y, z], "degrees": d}) and "translate" (three
+  numbers), applied in that order. */
+AffineTransform parse_transform(json& entry) {
+    if (entry.contains("matrix")) {
+        json& m = entry["matrix"];
+        Real rows[3][4];
+        for (size_t i = 0; i < 3; i++) {
+            for (size_t j = 0; j < 4; j++) {
+                rows[i][j] = m.at(i).at(j);
+            }
+        }
+        return AffineTransform(rows);
+    }
+    AffineTransform t;
+    if (entry.contains("scale")) {
+        json& s = entry["scale"];
+        Vector v = s.is_number() ? Vector(s, s, s) : Vector(s[0], s[1], s[2]);
+        t = t.then(AffineTransform::scaling(v));
+    }
+    if (entry.contains("rotate")) {
+        json& rot = entry["rotate"];
+        Vector axis(rot["axis"][0], rot["axis"][1], rot["axis"][2]);
+        t = t.then(AffineTransform::rotation(axis, rot["degrees"]));
+    }
+    if (entry.contains("translate")) {
+        json& v = entry["translate"];
+        t = t.then(AffineTransform::translation(Vector(v[0], v[1], v[2])));
+    }
+    return t;
+}
+
+}
+
+TraceStats::TraceStats():
+    samples{0},
+    rays{0},
+    shadow_rays{0},
+    cut{0}
+{}
+
+TraceStats& TraceStats::operator+=(const TraceStats& other) {
+    this->samples += other.samples;
+    this->rays += other.rays;
+    this->shadow_rays += other.shadow_rays;
+    this->cut += other.cut;
+    return *this;
+}
+
 Scene::Scene(Point c):
     objects{},
+    accelerator{std::make_unique<LinearScan>(objects)},
     camera{c},
     light{Point(0, 0, 0)},
     ambient{0.2},
@@ -19,11 +174,20 @@ Scene::Scene(Point c):
     background{Color(135, 206, 235)},
     pixel_width{512},
     pixel_height{512},
-    antialias{1}
+    antialias{1},
+    seed{0},
+    sampler{std::make_unique<RandomSampler>()},
+    adaptive_threshold{0.0},
+    adaptive_min{4},
+    packet_size{1},
+    wavefront_batch{0},
+    cutoff{0.0},
+    roulette{false}
 {}
 
-Scene::Scene(Point c, Point lig, double a, double l, bool dof, Color bg):
+Scene::Scene(Point c, Point lig, Real a, Real l, bool dof, Color bg):
     objects{},
+    accelerator{std::make_unique<LinearScan>(objects)},
     camera{c},
     light{lig},
     ambient{a},
@@ -35,17 +199,25 @@ Scene::Scene(Point c, Point lig, double a, double l, bool dof, Color bg):
     background{bg},
     pixel_width{512},
     pixel_height{512},
-    antialias{1}
+    antialias{1},
+    seed{0},
+    sampler{std::make_unique<RandomSampler>()},
+    adaptive_threshold{0.0},
+    adaptive_min{4},
+    packet_size{1},
+    wavefront_batch{0},
+    cutoff{0.0},
+    roulette{false}
 {}
 
-std::unique_ptr<Object> parse_object(json obj) {
-    double refl = obj["reflectivity"];
+std::unique_ptr<Object> parse_object(json obj, const std::string& directory) {
+    Real refl = obj["reflectivity"];
     Color col(obj["color"][0], obj["color"][1], obj["color"][2]);
     if (obj["type"] == "sphere") {
         Point center(obj["center"][0],
                      obj["center"][1],
                      obj["center"][2]);
-        double rad = obj["radius"];
+        Real rad = obj["radius"];
         return std::make_unique<Sphere>(refl, col, center, rad);
     } else if (obj["type"] == "plane") {
         Vector norm(obj["normal"][0],
@@ -62,14 +234,17 @@ std::unique_ptr<Object> parse_object(json obj) {
         } else {
             return std::make_unique<Plane>(refl, col, norm, point);
         }
+    } else if (obj["type"] == "mesh") {
+        return std::make_unique<TriangleMesh>(refl, col, parse_mesh(obj, directory));
     } else {
         throw std::invalid_argument("Unknown object type: " +
                                     obj["type"].get<std::string>());
     }
 }
 
-Scene::Scene(std::string filename):
+Scene::Scene(std::string filename, ThreadPool& pool, const std::optional<std::string>& accel):
     objects{},
+    accelerator{std::make_unique<LinearScan>(objects)},
     camera{Point(0, 0, 0)},
     light{Point(0, 0, 0)},
     ambient{0.2},
@@ -81,101 +256,400 @@ Scene::Scene(std::string filename):
     background{Color(135, 206, 235)},
     pixel_width{512},
     pixel_height{512},
-    antialias{1}
+    antialias{1},
+    seed{0},
+    sampler{std::make_unique<RandomSampler>()},
+    adaptive_threshold{0.0},
+    adaptive_min{4},
+    packet_size{1},
+    wavefront_batch{0},
+    cutoff{0.0},
+    roulette{false}
 {
-    std::ifstream infile(filename);
-    json data = json::parse(infile);
+    // Objects go straight into the list; the accelerator is built once they
+    // are all in.
+    json data;
+    std::string directory = std::filesystem::path(filename).parent_path().string();
+    if (is_scene_file(filename)) {
+        MappedFile file(filename);
+        data = read_scene_file(file, this->objects);
+    } else {
+        MappedFile file(filename);
+        data = read_json_scene(file, this->objects, pool, [&](json& obj, Primitives& part) {
+            part.add(parse_object(std::move(obj), directory));
+        });
+    }
+    // Prototypes are built as they are read, so that their instances can
+    // take their bounds. Instances follow the scene's other objects.
+    std::map<std::string, std::shared_ptr<const Prototype>> prototypes;
+    if (data.contains("prototypes")) {
+        for (auto& item : data["prototypes"].items()) {
+            auto p = std::make_shared<Prototype>();
+            for (json& obj : item.value()["objects"]) {
+                p->add_object(parse_object(std::move(obj), directory));
+            }
+            if (p->size() == 0) {
+                throw std::invalid_argument("Prototype has no objects: " + item.key());
+            }
+            p->build_accelerator(item.value().value("accelerator", "bvh"), pool);
+            prototypes.emplace(item.key(), std::move(p));
+        }
+    }
+    if (data.contains("instances")) {
+        for (json& entry : data["instances"]) {
+            std::string name = entry["prototype"];
+            auto p = prototypes.find(name);
+            if (p == prototypes.end()) {
+                throw std::invalid_argument("Unknown prototype: " + name);
+            }
+            this->objects.add(Instance(p->second, parse_transform(entry)));
+        }
+    }
     this->camera = Point(data["camera"][0], data["camera"][1], data["camera"][2]);
     this->light = Point(data["light"][0], data["light"][1], data["light"][2]);
     this->antialias = data["antialias"];
-    for (json obj : data["objects"]) {
-        this->add_object(parse_object(obj));
+    this->seed = data.value("seed", this->seed);
+    if (data.contains("sampler")) {
+        this->sampler = make_sampler(data["sampler"]);
     }
+    this->adaptive_threshold = data.value("adaptive_threshold", this->adaptive_threshold);
+    this->adaptive_min = data.value("adaptive_min", this->adaptive_min);
+    this->pixel_width = data.value("width", this->pixel_width);
+    this->pixel_height = data.value("height", this->pixel_height);
+    this->packet_size = data.value("packet_size", this->packet_size);
+    if (!valid_packet_size(this->packet_size)) {
+        throw std::invalid_argument("Bad packet size: " + std::to_string(this->packet_size));
+    }
+    this->wavefront_batch = data.value("wavefront_batch", this->wavefront_batch);
+    this->cutoff = data.value("reflection_cutoff", this->cutoff);
+    this->roulette = data.value("russian_roulette", this->roulette);
+    this->build_accelerator(accel ? *accel : data.value("accelerator", "bvh"), pool);
 }
 
 void Scene::add_object(std::unique_ptr<Object>&& obj) {
-    this->objects.push_back(std::move(obj));
+    this->objects.add(std::move(obj));
+    // Extend a linear scan rather than rebuilding it, so that adding n
+    // objects one at a time costs O(n) rather than O(n^2).
+    LinearScan* scan = dynamic_cast<LinearScan*>(this->accelerator.get());
+    if (scan) {
+        scan->add(this->objects.size() - 1);
+    } else {
+        this->accelerator = std::make_unique<LinearScan>(this->objects);
+    }
 }
 
-std::optional<std::pair<std::reference_wrapper<Object>, double>> Scene::get_intersection(Ray r) {
-    std::optional<std::pair<std::reference_wrapper<Object>, double>> nearest;
-    for (const std::unique_ptr<Object>& o : this->objects) {
-        auto t = o->collision(r);
-        if (t && (!nearest || *t < nearest->second)) {
-            nearest =
-                std::optional(std::make_pair<std::reference_wrapper<Object>, double>(*o, std::move(*t)));
-        }
+void Scene::add_instance(const Instance& instance) {
+    this->objects.add(instance);
+    LinearScan* scan = dynamic_cast<LinearScan*>(this->accelerator.get());
+    if (scan) {
+        scan->add(this->objects.size() - 1);
+    } else {
+        this->accelerator = std::make_unique<LinearScan>(this->objects);
     }
-    return nearest;
 }
 
-Color Scene::compute_ray_color(Ray ray, unsigned int reflections) {
-    auto res = this->get_intersection(ray);
-    if (!res) {
-        return background;
-    }
-    const Object& obj = res->first;
-    double time = res->second;
-    Point collision = ray.start + time * ray.direction;
+void Scene::build_accelerator(const std::string& name, ThreadPool& pool) {
+    this->objects.build_meshes(pool);
+    this->accelerator = make_accelerator(name, this->objects, pool);
+}
+
+std::string Scene::accelerator_summary() const {
+    return this->accelerator->summary();
+}
+
+std::optional<Hit> Scene::intersect(Ray r) const {
+    return this->accelerator->intersect(r);
+}
+
+bool Scene::occluded(Ray r, Real t_max) const {
+    return this->accelerator->occluded(r, t_max);
+}
+
+void Scene::get_intersections(const RayPacket& p, std::optional<Hit>* hits) const {
+    this->accelerator->intersect_packet(p, hits);
+}
+
+uint32_t Scene::occluded(const RayPacket& p, Real t_max) const {
+    return this->accelerator->occluded_packet(p, t_max);
+}
+
+Ray Scene::shadow_ray(Point collision) const {
+    Vector light_dir = this->light - collision;
+    return Ray(multiply_add(Tolerance<Real>::offset, light_dir, collision), light_dir);
+}
+
+Ray Scene::camera_ray(size_t i, size_t j, size_t n) const {
+    double x_min = ((double) i) / this->pixel_width;
+    double z_min = 1 - ((double) j) / this->pixel_width;
+    double size = 1.0 / this->pixel_width;
+    auto [dx, dz] = this->sampler->sample(this->seed, j * this->pixel_width + i, n,
+                                          this->antialias);
+    Point p(x_min + size * dx, 0, z_min + size * dz);
+    return Ray(p, p - camera);
+}
+
+SampleRng Scene::path_rng(uint64_t pixel, size_t n) const {
+    return SampleRng(this->seed, pixel, roulette_stream - n);
+}
+
+template <typename T>
+Color Scene::shade_object(const T& obj, Ray ray, const Hit& hit, bool lit,
+                          unsigned int reflections, std::optional<Bounce>& bounce) const {
+    Point collision = ray.at(hit.t);
 
     // Ambient light
     Color c = obj.get_color(collision);
-    double reflect = obj.get_reflectivity(collision);
-    double amb = this->ambient * (1 - reflect);
+    Real reflect = obj.get_reflectivity(collision);
+    Real amb = this->ambient * (1 - reflect);
     Color l_amb = amb * c;
     Color lighting = l_amb;
 
+    bounce.reset();
+    bool reflects = reflections < max_reflections && reflect > 0.003;
+    if (!lit && !reflects) {
+        return lighting;
+    }
+    // Shared by the diffuse and specular light and the reflection.
+    Vector norm = surface_normal(obj, ray, hit.t, hit.part, collision);
+    Vector v = (-ray.direction).normalized();
+
     // Diffuse light
-    Vector light_dir = this->light - collision;
-    // Check if we're in a shadow
-    if (!get_intersection(Ray(collision + 1e-5 * light_dir, light_dir))) {
-        light_dir = 1 / light_dir.magnitude() * light_dir;
-        Vector norm = obj.normal(collision);
-        norm = 1 / norm.magnitude() * norm;
+    if (lit) {
+        Vector light_dir = (this->light - collision).normalized();
         Color l_diff =
-            (1 - amb) * (1 - reflect) * std::max(0.0, norm.dot_product(light_dir)) * c;
+            (1 - amb) * (1 - reflect) * std::max<Real>(0, norm.dot_product(light_dir)) * c;
         lighting += l_diff;
 
         // Specular light
-        Vector v = 1 / (ray.direction.magnitude()) * (-ray.direction);
-        Vector half = v + light_dir;
-        half = 1 / half.magnitude() * half;
+        Vector half = (v + light_dir).normalized();
         Color l_spec =
             this->specular *
-            std::pow(std::max(0.0, half.dot_product(norm)), this->specular_power) *
+            std::pow(std::max<Real>(0, half.dot_product(norm)), this->specular_power) *
             Color(255, 255, 255);
         lighting += l_spec;
     }
 
-    if (reflections < max_reflections && obj.get_reflectivity(collision) > 0.003) {
-        Vector v = 1 / ray.direction.magnitude() * (-ray.direction);
-        Vector diff = v.project(obj.normal(collision)) - v;
-        Vector refl = v + 2 * diff;
-        Color reflected =
-            this->compute_ray_color(Ray(collision + 1e-5 * refl, refl),
-                                    reflections + 1);
-        lighting += (1 - amb) * reflect * reflected;
+    if (reflects) {
+        Vector refl = v.reflect_unit(norm);
+        bounce = Bounce{Ray(multiply_add(Tolerance<Real>::offset, refl, collision), refl),
+                        (1 - amb) * reflect};
     }
     return lighting;
 }
 
-Color Scene::compute_point_color(Point p) {
-    return this->compute_ray_color(Ray(p, p - camera), 0);
+Color Scene::shade(const Hit& hit, Ray ray, bool lit, unsigned int reflections,
+                   std::optional<Bounce>& bounce) const {
+    return this->objects.visit(hit.object, [&](const auto& obj) {
+        if constexpr (std::is_same_v<std::decay_t<decltype(obj)>, Instance>) {
+            // The hit's part is the prototype's object which the ray hit.
+            Ray local = obj.to_local(ray);
+            const Primitives& objects = obj.get_prototype().get_objects();
+            return objects.visit(hit.part, [&](const auto& o) {
+                using T = std::decay_t<decltype(o)>;
+                if constexpr (std::is_same_v<T, Instance>) {
+                    // Prototypes hold no instances.
+                    return Color();
+                } else {
+                    return this->shade_object(Placed<T>{o, obj, local, hit.t, hit.inner_part},
+                                              ray, hit, lit, reflections, bounce);
+                }
+            });
+        } else {
+            return this->shade_object(obj, ray, hit, lit, reflections, bounce);
+        }
+    });
 }
 
-Color Scene::compute_pixel_color(size_t i, size_t j) {
-    double x_min = ((double) i) / this->pixel_width;
-    double z_min = 1 - ((double) j) / this->pixel_width;
-    double size = 1.0 / this->pixel_width;
-    std::random_device dev;
-    std::mt19937 rng(dev());
-    std::uniform_real_distribution<double> distr(0.0, size);
+bool Scene::follow(Bounce& bounce, double& throughput, unsigned int depth, SampleRng& rng,
+                   TraceStats& stats) const {
+    throughput *= bounce.weight;
+    if (this->cutoff <= 0) {
+        return true;
+    }
+    // No hit is brighter than full color plus a full specular highlight, and
+    // its own reflectivity can only take light away from that, so each of
+    // the rays left to trace adds at most this much to its path.
+    double brightest = std::max<double>({255 * (1 + this->specular), this->background.red,
+                                 this->background.green, this->background.blue});
+    double bound = throughput * brightest * (this->max_reflections - depth);
+    if (bound >= this->cutoff) {
+        return true;
+    }
+    if (this->roulette) {
+        double p = bound / this->cutoff;
+        if (rng.next_double() < p) {
+            bounce.weight /= p;
+            throughput /= p;
+            return true;
+        }
+    }
+    stats.cut++;
+    return false;
+}
+
+Color Scene::complete_path(Color color, std::optional<Bounce>& bounce, unsigned int depth,
+                           SampleRng& rng, TraceStats& stats) const {
+    PathVertex on_stack[stack_depth];
+    std::vector<PathVertex> on_heap;
+    PathVertex* path = on_stack;
+    if (this->max_reflections > stack_depth) {
+        on_heap.resize(this->max_reflections);
+        path = on_heap.data();
+    }
+    size_t n = 0;
+    double throughput = 1.0;
+    Color end = color;
+    while (bounce && this->follow(*bounce, throughput, depth, rng, stats)) {
+        path[n++] = PathVertex{end, bounce->weight};
+        Ray ray = bounce->ray;
+        depth++;
+        stats.rays++;
+        std::optional<Hit> hit = this->accelerator->intersect(ray);
+        if (!hit) {
+            end = background;
+            break;
+        }
+        stats.shadow_rays++;
+        bool lit = !this->occluded(this->shadow_ray(ray.at(hit->t)),
+                                   shadow_limit);
+        end = this->shade(*hit, ray, lit, depth, bounce);
+    }
+    // Add the reflections in from the deepest up, as a recursive tracer
+    // would on its way back out.
+    while (n > 0) {
+        n--;
+        end = multiply_add(path[n].weight, end, path[n].color);
+    }
+    return end;
+}
+
+Color Scene::compute_ray_color(Ray ray, SampleRng& rng, TraceStats& stats) const {
+    stats.rays++;
+    std::optional<Hit> hit = this->accelerator->intersect(ray);
+    if (!hit) {
+        return background;
+    }
+    Point collision = ray.at(hit->t);
+    stats.shadow_rays++;
+    bool lit = !this->occluded(this->shadow_ray(collision), shadow_limit);
+    std::optional<Bounce> bounce;
+    Color c = this->shade(*hit, ray, lit, 0, bounce);
+    return this->complete_path(c, bounce, 0, rng, stats);
+}
+
+void Scene::compute_packet_colors(const RayPacket& primary, const uint64_t* pixels, size_t n,
+                                  Color* colors, TraceStats& stats) const {
+    std::optional<Hit> hits[RayPacket::max_size];
+    this->accelerator->intersect_packet(primary, hits);
+    RayPacket shadows(primary.size);
+    for (size_t k = 0; k < primary.size; k++) {
+        if (((primary.active >> k) & 1) && hits[k]) {
+            Ray ray = primary.ray(k);
+            shadows.set(k, this->shadow_ray(ray.at(hits[k]->t)));
+        }
+    }
+    uint32_t blocked = this->accelerator->occluded_packet(shadows, shadow_limit);
+    stats.rays += __builtin_popcount(primary.active);
+    stats.shadow_rays += __builtin_popcount(shadows.active);
+    for (size_t k = 0; k < primary.size; k++) {
+        if (!((primary.active >> k) & 1)) {
+            continue;
+        }
+        if (!hits[k]) {
+            colors[k] = background;
+            continue;
+        }
+        // Reflected rays go their separate ways, so they are traced one at
+        // a time.
+        bool lit = !((blocked >> k) & 1);
+        Ray ray = primary.ray(k);
+        std::optional<Bounce> bounce;
+        Color c = this->shade(*hits[k], ray, lit, 0, bounce);
+        SampleRng rng = this->path_rng(pixels[k], n);
+        colors[k] = this->complete_path(c, bounce, 0, rng, stats);
+    }
+}
+
+PixelSamples::PixelSamples():
+    sum{Color(0, 0, 0)},
+    n{0},
+    mean{0.0, 0.0, 0.0},
+    m2{0.0, 0.0, 0.0}
+{}
 
-    Color c(0, 0, 0);
-    for (size_t k = 0; k < this->antialias; k++) {
-        double x = x_min + distr(rng);
-        double z = z_min + distr(rng);
-        c += this->compute_point_color(Point(x, 0, z));
+bool PixelSamples::add(Color s, double threshold, size_t min_samples) {
+    this->sum += s;
+    this->n++;
+    if (threshold <= 0) {
+        return false;
+    }
+    double v[3] = {clamp_channel(s.red), clamp_channel(s.green), clamp_channel(s.blue)};
+    double worst = 0.0;
+    for (int ch = 0; ch < 3; ch++) {
+        double d = v[ch] - this->mean[ch];
+        this->mean[ch] += d / this->n;
+        this->m2[ch] += d * (v[ch] - this->mean[ch]);
+        worst = std::max(worst, this->m2[ch]);
+    }
+    // The variance of the mean is the sample variance over n.
+    return this->n >= std::max<size_t>(2, min_samples) &&
+        worst / ((this->n - 1) * this->n) < threshold * threshold;
+}
+
+Color PixelSamples::average() const {
+    return (1.0 / this->n) * this->sum;
+}
+
+Color Scene::compute_pixel_color(size_t i, size_t j, TraceStats& stats) const {
+    PixelSamples samples;
+    while (samples.n < this->antialias) {
+        SampleRng rng = this->path_rng(j * this->pixel_width + i, samples.n);
+        Color s = this->compute_ray_color(this->camera_ray(i, j, samples.n), rng, stats);
+        stats.samples++;
+        if (samples.add(s, this->adaptive_threshold, this->adaptive_min)) {
+            break;
+        }
+    }
+    return samples.average();
+}
+
+void Scene::compute_pixel_colors(size_t i0, size_t j, size_t count, Color* out,
+                                 TraceStats& stats) const {
+    if (this->packet_size <= 1) {
+        for (size_t k = 0; k < count; k++) {
+            out[k] = this->compute_pixel_color(i0 + k, j, stats);
+        }
+        return;
+    }
+    for (size_t first = 0; first < count; first += this->packet_size) {
+        size_t lanes = std::min(this->packet_size, count - first);
+        // Sample n of every pixel in the packet is traced together, until
+        // each pixel has all of its samples or has converged.
+        PixelSamples samples[RayPacket::max_size];
+        uint32_t live = this->antialias > 0 ? (1u << lanes) - 1 : 0;
+        for (size_t n = 0; live != 0; n++) {
+            RayPacket primary(lanes);
+            uint64_t pixels[RayPacket::max_size];
+            for (size_t k = 0; k < lanes; k++) {
+                pixels[k] = j * this->pixel_width + i0 + first + k;
+                if ((live >> k) & 1) {
+                    primary.set(k, this->camera_ray(i0 + first + k, j, n));
+                }
+            }
+            Color colors[RayPacket::max_size];
+            this->compute_packet_colors(primary, pixels, n, colors, stats);
+            for (size_t k = 0; k < lanes; k++) {
+                if ((live >> k) & 1) {
+                    stats.samples++;
+                    if (samples[k].add(colors[k], this->adaptive_threshold, this->adaptive_min) ||
+                            samples[k].n == this->antialias) {
+                        live &= ~(1u << k);
+                    }
+                }
+            }
+        }
+        for (size_t k = 0; k < lanes; k++) {
+            out[first + k] = samples[k].average();
+        }
     }
-    return (1.0 / this->antialias) * c;
 }
@@ -1,35 +1,182 @@
 #pragma once
 
+#include <optional>
+#include <string>
 #include <vector>
 
+#include "accel.hpp"
 #include "object.hpp"
+#include "packet.hpp"
+#include "primitives.hpp"
+#include "rng.hpp"
+#include "sampler.hpp"
 #include "types.hpp"
 #include "json.hpp"
 
+/**
+ * Counters for the work done while tracing. Each render thread keeps its own.
+ */
+struct TraceStats {
+    uint64_t samples;
+    /** Rays traced for their closest hit: camera rays and reflections. */
+    uint64_t rays;
+    uint64_t shadow_rays;
+    /** Paths which stopped following reflections early because of the
+      cutoff, or were dropped by roulette. */
+    uint64_t cut;
+
+    TraceStats();
+    TraceStats& operator+=(const TraceStats&);
+};
+
+/**
+ * A reflected ray still to be traced, and the weight of its color in the
+ * color of the ray it came from.
+ */
+struct Bounce {
+    Ray ray;
+    Real weight;
+};
+
+/**
+ * The samples taken so far for one pixel: their sum and, for adaptive
+ * sampling, the running mean and sum of squared deviations (Welford) of the
+ * displayed color.
+ */
+struct PixelSamples {
+    Color sum;
+    size_t n;
+    double mean[3];
+    double m2[3];
+
+    PixelSamples();
+
+    /** Add a sample. Returns whether an adaptive pixel has converged. */
+    bool add(Color, double, size_t);
+
+    Color average() const;
+};
+
+/** Make an object from its entry in a JSON scene's "objects". Files the
+  entry names, such as a mesh's OBJ file, are found relative to the given
+  directory, that of the scene. */
+std::unique_ptr<Object> parse_object(nlohmann::json, const std::string&);
+
 class Scene {
 private:
-    std::vector<std::unique_ptr<Object>> objects;
-    Color compute_ray_color(Ray, unsigned int);
+    Primitives objects;
+    std::unique_ptr<Accelerator> accelerator;
+    /** The color of a camera ray. Reflections are followed in a loop, and
+      the sampler's random stream for roulette is passed in. */
+    Color compute_ray_color(Ray, SampleRng&, TraceStats&) const;
+    /** Follow the reflections of a path whose hit at the given depth shaded
+      to the given color, and return the path's color. */
+    Color complete_path(Color, std::optional<Bounce>&, unsigned int, SampleRng&,
+                        TraceStats&) const;
+    /** The color of a ray which makes the given hit on the given object, as
+      for shade. Called with the object's concrete type so that its methods
+      are called directly. */
+    template <typename T>
+    Color shade_object(const T&, Ray, const Hit&, bool, unsigned int,
+                       std::optional<Bounce>&) const;
+    /** compute_ray_color for each active lane of a packet of camera rays,
+      tracing their first hits and shadow rays as packets. The lanes' rays
+      are sample n of the given pixels. */
+    void compute_packet_colors(const RayPacket&, const uint64_t*, size_t, Color*,
+                               TraceStats&) const;
 
 public:
+    /** Shadow rays reach the light at this time, and anything beyond it is
+      behind the light. */
+    static constexpr Real shadow_limit = 1 - Tolerance<Real>::offset;
+
     Point camera;
     Point light;
-    double ambient;
-    double specular;
+    Real ambient;
+    Real specular;
     int specular_power;
-    double limit;
+    Real limit;
     unsigned int max_reflections;
     bool depth_of_field;
     Color background;
     size_t pixel_width;
     size_t pixel_height;
     size_t antialias;
+    /** Seed for all of the random sampling decisions in a render. */
+    uint64_t seed;
+    /** Where the antialiasing samples go within each pixel. */
+    std::unique_ptr<Sampler> sampler;
+    /** When positive, pixels stop taking samples once the standard error of
+      their mean color drops below this many 8-bit levels in every channel.
+      At least adaptive_min and at most antialias samples are taken. */
+    double adaptive_threshold;
+    size_t adaptive_min;
+    /** How many neighboring pixels trace their camera and shadow rays
+      together: 4, 8 or 16, or 1 to trace every ray on its own. */
+    size_t packet_size;
+    /** When positive, render with the wavefront engine, tracing about this
+      many pixels' rays together one bounce at a time. Zero traces each
+      camera ray's reflections depth first. */
+    size_t wavefront_batch;
+    /** When positive, a path stops following reflections once everything
+      further along it could add less than this many 8-bit levels to its
+      sample, assuming colors within 0-255. Zero follows every reflection up
+      to max_reflections. */
+    double cutoff;
+    /** With a cutoff, let such paths go on at random instead of stopping
+      them, weighting the survivors so that the expected color is unchanged
+      (Russian roulette). */
+    bool roulette;
 
     Scene(Point);
-    Scene(Point, Point, double, double, bool, Color);
-    Scene(std::string);
+    Scene(Point, Point, Real, Real, bool, Color);
+    // The accelerator refers to the objects, so a scene stays where it was
+    // made.
+    Scene(const Scene&) = delete;
+    Scene& operator=(const Scene&) = delete;
+    /** Load a scene from a JSON file, or a scene file compiled from one (see
+      scene_file.hpp), and build its accelerator, using the pool's workers
+      for the build: the named one if given, the scene's own otherwise, so
+      that an override does not cost a second build. */
+    Scene(std::string, ThreadPool&, const std::optional<std::string>& = {});
+    /** Add an object to the scene, compiling it if it is a sphere or a
+      plane. Until build_accelerator is called again, queries fall back to
+      testing every object. */
     void add_object(std::unique_ptr<Object>&&);
-    std::optional<std::pair<std::reference_wrapper<Object>, double> > get_intersection(Ray);
-    Color compute_point_color(Point);
-    Color compute_pixel_color(size_t, size_t);
+    /** Add an instance of a prototype, as add_object adds an object. */
+    void add_instance(const Instance&);
+    /** Build the named acceleration structure over the current objects. */
+    void build_accelerator(const std::string&, ThreadPool&);
+    std::string accelerator_summary() const;
+    /** The closest hit of a ray, as an index into the scene's objects. */
+    std::optional<Hit> intersect(Ray) const;
+    /** Check whether anything blocks the ray before time t_max. */
+    bool occluded(Ray, Real) const;
+    /** Packet versions of the two queries above: the closest hit of each
+      active lane, and the mask of active lanes blocked before t_max. */
+    void get_intersections(const RayPacket&, std::optional<Hit>*) const;
+    uint32_t occluded(const RayPacket&, Real) const;
+    /** The ray from a point toward the light, nudged off the surface. It
+      reaches the light at shadow_limit. */
+    Ray shadow_ray(Point) const;
+    /** The camera ray for sample n of pixel (i, j). */
+    Ray camera_ray(size_t, size_t, size_t) const;
+    /** The random stream for the roulette of sample n of a pixel, given by
+      its index j * pixel_width + i. */
+    SampleRng path_rng(uint64_t, size_t) const;
+    /** The color of a ray at its closest hit, given whether the light
+      reaches the hit point, leaving out the reflection. When there is a
+      reflection to trace, it is put in the last argument; the ray's color
+      is then the returned color plus the weight times the reflection's. */
+    Color shade(const Hit&, Ray, bool, unsigned int, std::optional<Bounce>&) const;
+    /** Decide whether a path follows the reflection from a hit at the given
+      depth, applying the cutoff. `throughput`, the weight of the hit
+      ray's color in the sample, becomes that of the reflection's. Roulette
+      may raise the bounce's weight. */
+    bool follow(Bounce&, double&, unsigned int, SampleRng&, TraceStats&) const;
+    Color compute_pixel_color(size_t, size_t, TraceStats&) const;
+    /** Compute `count` pixels of row j starting at column i, in packets of
+      packet_size neighbors. The colors are the same as compute_pixel_color's
+      whatever the packet size. */
+    void compute_pixel_colors(size_t, size_t, size_t, Color*, TraceStats&) const;
 };
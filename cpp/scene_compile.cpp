@@ -0,0 +1,72 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+#include "mapped_file.hpp"
+#include "scene.hpp"
+#include "scene_file.hpp"
+#include "scene_json.hpp"
+
+using json = nlohmann::json;
+
+/**
+ * Convert a JSON scene to the binary scene format (see scene_file.hpp), which
+ * trace loads in place of the JSON.
+ */
+
+/**
+ * Point the files named by the objects of a scene's prototypes, which are
+ * relative to the scene's directory, at the same files relative to the
+ * output's, since that is where the scene file is loaded from.
+ */
+void rebase_prototype_files(json& settings, const std::string& scene, const std::string& output) {
+    if (!settings.contains("prototypes")) {
+        return;
+    }
+    std::filesystem::path from =
+        std::filesystem::absolute(scene).lexically_normal().parent_path();
+    std::filesystem::path to =
+        std::filesystem::absolute(output).lexically_normal().parent_path();
+    for (auto& item : settings["prototypes"].items()) {
+        for (json& obj : item.value()["objects"]) {
+            if (obj.contains("file")) {
+                std::filesystem::path file = from / obj["file"].get<std::string>();
+                obj["file"] = file.lexically_normal().lexically_relative(to).string();
+            }
+        }
+    }
+}
+
+void usage() {
+    std::cout << "Usage: ./scene-compile <scene.json> <output-file>" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; i++) {
+        files.push_back(argv[i]);
+    }
+    if (files.size() != 2) {
+        usage();
+        return 1;
+    }
+    try {
+        // Objects are converted as they are parsed, so even very large scenes
+        // never need more than their records in memory.
+        MappedFile file(files[0]);
+        SceneFileWriter writer;
+        std::string directory = std::filesystem::path(files[0]).parent_path().string();
+        json settings = read_json_scene(file, [&](json& obj) {
+            writer.add(*parse_object(std::move(obj), directory));
+        });
+        rebase_prototype_files(settings, files[0], files[1]);
+        writer.write(files[1], settings);
+        std::cout << files[1] << ": " << writer.size() << " objects" << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
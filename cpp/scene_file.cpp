@@ -0,0 +1,196 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#include <typeinfo>
+
+#include "scene_file.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+
+static_assert(std::is_trivially_copyable<SceneFileHeader>::value &&
+              std::is_trivially_copyable<SceneFileObject>::value &&
+              std::is_trivially_copyable<SceneFileSphere>::value &&
+              std::is_trivially_copyable<SceneFilePlane>::value,
+              "Scene file records are copied as bytes");
+
+// Sections start at multiples of this, so that every record is aligned
+// within the page-aligned mapping.
+const uint64_t section_alignment = 8;
+
+uint64_t align(uint64_t offset) {
+    return (offset + section_alignment - 1) / section_alignment * section_alignment;
+}
+
+/** The count records of type T at offset in the file, checked to lie within
+  it. */
+template <typename T>
+const T* section(const MappedFile& file, uint64_t offset, uint64_t count, const char* name) {
+    if (offset % alignof(T) != 0 || offset > file.size() ||
+            count > (file.size() - offset) / sizeof(T)) {
+        throw std::runtime_error(std::string("Scene file is corrupt: bad ") + name + " section");
+    }
+    return reinterpret_cast<const T*>(file.data() + offset);
+}
+
+Point point(const double* p) {
+    return Point(p[0], p[1], p[2]);
+}
+
+Vector vector(const double* v) {
+    return Vector(v[0], v[1], v[2]);
+}
+
+Color color(const double* c) {
+    return Color(c[0], c[1], c[2]);
+}
+
+void store(double* out, Real x, Real y, Real z) {
+    out[0] = x;
+    out[1] = y;
+    out[2] = z;
+}
+
+}
+
+bool is_scene_file(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    char magic[sizeof(scene_file_magic)];
+    return in.read(magic, sizeof(magic)) &&
+        std::memcmp(magic, scene_file_magic, sizeof(magic)) == 0;
+}
+
+json read_scene_file(const MappedFile& file, Primitives& objects) {
+    const SceneFileHeader& header = *section<SceneFileHeader>(file, 0, 1, "header");
+    if (std::memcmp(header.magic, scene_file_magic, sizeof(scene_file_magic)) != 0) {
+        throw std::runtime_error("Not a scene file");
+    }
+    if (header.byte_order != scene_file_byte_order) {
+        throw std::runtime_error("Scene file was written with the other byte order");
+    }
+    if (header.version != scene_file_version) {
+        throw std::runtime_error("Scene file version " + std::to_string(header.version) +
+                                 " is not supported (expected " +
+                                 std::to_string(scene_file_version) +
+                                 "); compile the scene again with scene-compile");
+    }
+    const char* text = section<char>(file, header.settings_offset, header.settings_size,
+                                     "settings");
+    json settings = json::parse(text, text + header.settings_size);
+    const SceneFileObject* refs = section<SceneFileObject>(file, header.objects_offset,
+                                                           header.object_count, "objects");
+    const SceneFileSphere* spheres = section<SceneFileSphere>(file, header.spheres_offset,
+                                                              header.sphere_count, "spheres");
+    const SceneFilePlane* planes = section<SceneFilePlane>(file, header.planes_offset,
+                                                           header.plane_count, "planes");
+    objects.reserve(header.sphere_count, header.plane_count);
+    for (uint64_t i = 0; i < header.object_count; i++) {
+        SceneFileObject r = refs[i];
+        if (r.kind == (uint32_t) Primitives::Kind::sphere && r.index < header.sphere_count) {
+            const SceneFileSphere& s = spheres[r.index];
+            objects.add(Sphere(s.reflectivity, color(s.color), point(s.center), s.radius));
+        } else if (r.kind == (uint32_t) Primitives::Kind::plane && r.index < header.plane_count) {
+            const SceneFilePlane& p = planes[r.index];
+            if (p.checkerboard) {
+                objects.add(Plane(p.reflectivity, color(p.color), vector(p.normal),
+                                  point(p.point), color(p.color2), vector(p.orientation)));
+            } else {
+                objects.add(Plane(p.reflectivity, color(p.color), vector(p.normal),
+                                  point(p.point)));
+            }
+        } else {
+            throw std::runtime_error("Scene file is corrupt: bad object " + std::to_string(i));
+        }
+    }
+    return settings;
+}
+
+SceneFileWriter::SceneFileWriter():
+    objects{},
+    spheres{},
+    planes{}
+{}
+
+void SceneFileWriter::add(const Object& obj) {
+    if (typeid(obj) == typeid(Sphere)) {
+        const Sphere& s = static_cast<const Sphere&>(obj);
+        SceneFileSphere r;
+        Point c = s.get_center();
+        Color col = s.get_base_color();
+        store(r.center, c.x, c.y, c.z);
+        r.radius = s.get_radius();
+        store(r.color, col.red, col.green, col.blue);
+        r.reflectivity = s.get_base_reflectivity();
+        this->objects.push_back(SceneFileObject{(uint32_t) Primitives::Kind::sphere,
+                                                (uint32_t) this->spheres.size()});
+        this->spheres.push_back(r);
+    } else if (typeid(obj) == typeid(Plane)) {
+        const Plane& p = static_cast<const Plane&>(obj);
+        SceneFilePlane r{};
+        Vector n = p.get_normal();
+        Point q = p.get_point();
+        Color col = p.get_base_color();
+        store(r.normal, n.x, n.y, n.z);
+        store(r.point, q.x, q.y, q.z);
+        store(r.color, col.red, col.green, col.blue);
+        r.reflectivity = p.get_base_reflectivity();
+        if (p.get_checkerboard()) {
+            Color col2 = *p.get_checkerboard();
+            Vector o = *p.get_orientation();
+            r.checkerboard = 1;
+            store(r.color2, col2.red, col2.green, col2.blue);
+            store(r.orientation, o.x, o.y, o.z);
+        }
+        this->objects.push_back(SceneFileObject{(uint32_t) Primitives::Kind::plane,
+                                                (uint32_t) this->planes.size()});
+        this->planes.push_back(r);
+    } else {
+        throw std::invalid_argument("Scene files can only hold spheres and planes");
+    }
+}
+
+size_t SceneFileWriter::size() const {
+    return this->objects.size();
+}
+
+void SceneFileWriter::write(const std::string& filename, const json& settings) const {
+    json without_objects = settings;
+    without_objects.erase("objects");
+    std::string text = without_objects.dump();
+    SceneFileHeader header{};
+    std::memcpy(header.magic, scene_file_magic, sizeof(scene_file_magic));
+    header.version = scene_file_version;
+    header.byte_order = scene_file_byte_order;
+    header.settings_offset = align(sizeof(header));
+    header.settings_size = text.size();
+    header.objects_offset = align(header.settings_offset + text.size());
+    header.object_count = this->objects.size();
+    header.spheres_offset = align(header.objects_offset +
+                                  this->objects.size() * sizeof(SceneFileObject));
+    header.sphere_count = this->spheres.size();
+    header.planes_offset = align(header.spheres_offset +
+                                 this->spheres.size() * sizeof(SceneFileSphere));
+    header.plane_count = this->planes.size();
+
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    uint64_t written = 0;
+    auto put = [&](uint64_t offset, const void* data, uint64_t size) {
+        static const char zeros[section_alignment] = {};
+        out.write(zeros, offset - written);
+        out.write(static_cast<const char*>(data), size);
+        written = offset + size;
+    };
+    put(0, &header, sizeof(header));
+    put(header.settings_offset, text.data(), text.size());
+    put(header.objects_offset, this->objects.data(),
+        this->objects.size() * sizeof(SceneFileObject));
+    put(header.spheres_offset, this->spheres.data(),
+        this->spheres.size() * sizeof(SceneFileSphere));
+    put(header.planes_offset, this->planes.data(),
+        this->planes.size() * sizeof(SceneFilePlane));
+    if (!out.flush()) {
+        throw std::runtime_error("Cannot write " + filename);
+    }
+}
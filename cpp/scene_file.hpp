@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "json.hpp"
+#include "mapped_file.hpp"
+#include "object.hpp"
+#include "primitives.hpp"
+
+/**
+ * The binary scene format, which scene-compile converts JSON scenes to. A
+ * scene file loads by mapping it into memory and copying the objects straight
+ * out of flat arrays, with no parsing per object, so that large scenes start
+ * rendering quickly.
+ *
+ * A file is a SceneFileHeader followed by its sections, each starting at an
+ * offset the header gives:
+ *   settings  everything in the JSON scene but its objects, as JSON text
+ *   objects   a SceneFileObject per object, in scene order
+ *   spheres   SceneFileSphere[sphere_count]
+ *   planes    SceneFilePlane[plane_count]
+ * Numbers are in the byte order of the machine which wrote the file, and all
+ * geometry is double precision whatever the renderer's precision.
+ *
+ * Any change to the layout must bump scene_file_version; readers reject other
+ * versions rather than guess, and the file has to be compiled again.
+ */
+constexpr char scene_file_magic[8] = {'R', 'T', 'L', 'C', 'S', 'C', 'N', '\0'};
+constexpr uint32_t scene_file_version = 1;
+constexpr uint32_t scene_file_byte_order = 0x01020304;
+
+struct SceneFileHeader {
+    char magic[8];
+    uint32_t version;
+    /** scene_file_byte_order, as written, to catch files written on a
+      machine of the other endianness. */
+    uint32_t byte_order;
+    uint64_t settings_offset;
+    /** The length of the settings text in bytes. */
+    uint64_t settings_size;
+    uint64_t objects_offset;
+    uint64_t object_count;
+    uint64_t spheres_offset;
+    uint64_t sphere_count;
+    uint64_t planes_offset;
+    uint64_t plane_count;
+};
+
+/** Which array an object is in (a Primitives::Kind) and its index there. */
+struct SceneFileObject {
+    uint32_t kind;
+    uint32_t index;
+};
+
+struct SceneFileSphere {
+    double center[3];
+    double radius;
+    double color[3];
+    double reflectivity;
+};
+
+struct SceneFilePlane {
+    double normal[3];
+    double point[3];
+    double color[3];
+    double reflectivity;
+    /** Nonzero for a checkerboard, which then uses color2 and orientation. */
+    uint64_t checkerboard;
+    double color2[3];
+    double orientation[3];
+};
+
+/** Check whether a file starts with the scene file magic, whatever its
+  version. */
+bool is_scene_file(const std::string&);
+
+/** Add the objects of a mapped scene file to a list, in order, and return its
+  settings. Throws if the file is not a scene file of this version or is
+  truncated or inconsistent. */
+nlohmann::json read_scene_file(const MappedFile&, Primitives&);
+
+/**
+ * Builds a scene file from objects added one at a time.
+ */
+class SceneFileWriter {
+private:
+    std::vector<SceneFileObject> objects;
+    std::vector<SceneFileSphere> spheres;
+    std::vector<SceneFilePlane> planes;
+
+public:
+    SceneFileWriter();
+
+    /** Add a sphere or a plane. Throws for any other kind of object, which
+      the format cannot hold. */
+    void add(const Object&);
+
+    size_t size() const;
+
+    /** Write the objects so far to a file, with the given settings: those
+      of a JSON scene, whose "objects" are left out. Throws if the file cannot
+      be written. */
+    void write(const std::string&, const nlohmann::json&) const;
+};
@@ -0,0 +1,104 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "generator.hpp"
+#include "scene_file.hpp"
+#include "scene_json.hpp"
+
+/**
+ * Write generated scenes (see generator.hpp), the inputs of scaling studies
+ * and performance regression runs, as JSON scenes or scene files.
+ */
+
+void usage() {
+    std::cout << "Usage: ./scene-gen [options] <output-file>..." << std::endl;
+    std::cout << "Writes the same scene to each file: a JSON scene if its name ends in .json," << std::endl;
+    std::cout << "a scene file (as scene-compile writes) otherwise." << std::endl;
+    std::cout << "Options:" << std::endl;
+    std::cout << "  --objects N        number of spheres (default: 1000)" << std::endl;
+    std::cout << "  --distribution D   uniform, clustered or layered (default: uniform)" << std::endl;
+    std::cout << "  --mirrors P        percentage of spheres which are mirrors (default: 30)" << std::endl;
+    std::cout << "  --reflectivity R   reflectivity of the mirrors (default: 0.7)" << std::endl;
+    std::cout << "  --size WxH         image size (default: 512x512)" << std::endl;
+    std::cout << "  --antialias N      samples per pixel (default: 1)" << std::endl;
+    std::cout << "  --accel NAME       acceleration structure (default: bvh)" << std::endl;
+    std::cout << "  --seed N           seed for the objects (default: 1)" << std::endl;
+    std::cout << "  --no-floor         leave out the checkerboard floor" << std::endl;
+}
+
+bool ends_with(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+        s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    GeneratorSettings settings;
+    std::vector<std::string> files;
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--objects" && i + 1 < argc) {
+                settings.objects = std::stoul(argv[++i]);
+            } else if (arg == "--distribution" && i + 1 < argc) {
+                settings.distribution = parse_distribution(argv[++i]);
+            } else if (arg == "--mirrors" && i + 1 < argc) {
+                settings.mirror_percent = std::stod(argv[++i]);
+            } else if (arg == "--reflectivity" && i + 1 < argc) {
+                settings.mirror_reflectivity = std::stod(argv[++i]);
+            } else if (arg == "--size" && i + 1 < argc) {
+                std::string size = argv[++i];
+                size_t x = size.find('x');
+                if (x == std::string::npos) {
+                    throw std::invalid_argument("Bad image size: " + size);
+                }
+                settings.width = std::stoul(size.substr(0, x));
+                settings.height = std::stoul(size.substr(x + 1));
+            } else if (arg == "--antialias" && i + 1 < argc) {
+                settings.antialias = std::stoul(argv[++i]);
+            } else if (arg == "--accel" && i + 1 < argc) {
+                settings.accelerator = argv[++i];
+            } else if (arg == "--seed" && i + 1 < argc) {
+                settings.seed = std::stoull(argv[++i]);
+            } else if (arg == "--no-floor") {
+                settings.floor = false;
+            } else if (arg.rfind("--", 0) == 0) {
+                throw std::invalid_argument("Unknown option: " + arg);
+            } else {
+                files.push_back(arg);
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+        usage();
+        return 1;
+    }
+    if (files.empty()) {
+        usage();
+        return 1;
+    }
+    try {
+        SceneGenerator generator(settings);
+        for (const std::string& file : files) {
+            // JSON is streamed out as it is generated; a scene file's
+            // sections are written once all of its objects are in.
+            size_t count;
+            if (ends_with(file, ".json")) {
+                JsonSceneWriter writer(file, generator.scene_settings());
+                generator.for_each_object([&](const auto& obj) { writer.add(obj); });
+                writer.close();
+                count = writer.size();
+            } else {
+                SceneFileWriter writer;
+                generator.for_each_object([&](const auto& obj) { writer.add(obj); });
+                writer.write(file, generator.scene_settings());
+                count = writer.size();
+            }
+            std::cout << file << ": " << count << " objects" << std::endl;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
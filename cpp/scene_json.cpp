@@ -0,0 +1,542 @@
+#include <algorithm>
+#include <exception>
+#include <iomanip>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include "scene_json.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+
+void write_triple(std::ostream& out, const char* key, double x, double y, double z) {
+    out << "\"" << key << "\": [" << x << ", " << y << ", " << z << "]";
+}
+
+// How often a parse gives back the pages behind it.
+const size_t release_interval = 16 << 20;
+
+/**
+ * A position in a mapped file which releases the pages it has passed every
+ * release_interval bytes. nlohmann::json reads its input through an iterator
+ * one character at a time, so this sees the whole parse. Positions are kept
+ * as offsets, since a pointer to the next release point could lie far past
+ * the end of the mapping.
+ */
+class ReleasingIterator {
+private:
+    const MappedFile* file;
+    size_t position;
+    size_t next_release;
+
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = char;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const char*;
+    using reference = const char&;
+
+    ReleasingIterator(const MappedFile& f, size_t offset):
+        file{&f},
+        position{offset},
+        next_release{release_interval}
+    {}
+
+    const char& operator*() const {
+        return this->file->data()[this->position];
+    }
+
+    ReleasingIterator& operator++() {
+        if (++this->position >= this->next_release) {
+            this->file->release(0, this->position);
+            this->next_release += release_interval;
+        }
+        return *this;
+    }
+
+    bool operator==(const ReleasingIterator& other) const {
+        return this->position == other.position;
+    }
+
+    bool operator!=(const ReleasingIterator& other) const {
+        return this->position != other.position;
+    }
+};
+
+/**
+ * Builds the settings of a scene from nlohmann::json's SAX events, handing
+ * the entries of "objects" on as they complete instead of keeping them.
+ */
+class SceneSax {
+private:
+    json& settings;
+    const std::function<void(json&)>& add;
+    /** Whether the document is a run of "objects" entries wrapped in an
+      array, rather than a whole scene. */
+    bool entries_only;
+    /** The arrays and objects being filled, innermost last. The "objects"
+      array itself is never built and is marked by a null. */
+    std::vector<json*> open;
+    /** The last key read in the innermost object. */
+    std::string last_key;
+    /** The entry of "objects" being read. */
+    json entry;
+
+    /** Put a value where the parse is: in the innermost array or object, as
+      the current entry, or as the whole document. */
+    json& place(json&& v) {
+        if (this->open.empty()) {
+            this->settings = std::move(v);
+            return this->settings;
+        }
+        json* top = this->open.back();
+        if (top == nullptr) {
+            this->entry = std::move(v);
+            return this->entry;
+        }
+        if (top->is_array()) {
+            top->push_back(std::move(v));
+            return top->back();
+        }
+        return (*top)[this->last_key] = std::move(v);
+    }
+
+    /** After a value is complete, hand it on if it is an entry of "objects". */
+    bool completed() {
+        if (!this->open.empty() && this->open.back() == nullptr) {
+            this->add(this->entry);
+            this->entry = json();
+        }
+        return true;
+    }
+
+    bool value(json&& v) {
+        this->place(std::move(v));
+        return this->completed();
+    }
+
+public:
+    SceneSax(json& s, const std::function<void(json&)>& a, bool entries):
+        settings{s},
+        add{a},
+        entries_only{entries},
+        open{},
+        last_key{},
+        entry{}
+    {}
+
+    bool null() {
+        return this->value(nullptr);
+    }
+
+    bool boolean(bool b) {
+        return this->value(b);
+    }
+
+    bool number_integer(json::number_integer_t n) {
+        return this->value(n);
+    }
+
+    bool number_unsigned(json::number_unsigned_t n) {
+        return this->value(n);
+    }
+
+    bool number_float(json::number_float_t x, const std::string&) {
+        return this->value(x);
+    }
+
+    bool string(std::string& s) {
+        return this->value(std::move(s));
+    }
+
+    bool binary(json::binary_t&) {
+        // JSON text has no binary values.
+        return false;
+    }
+
+    bool start_object(size_t) {
+        this->open.push_back(&this->place(json::object()));
+        return true;
+    }
+
+    bool key(std::string& k) {
+        this->last_key = std::move(k);
+        return true;
+    }
+
+    bool end_object() {
+        this->open.pop_back();
+        return this->completed();
+    }
+
+    bool start_array(size_t) {
+        bool objects = this->entries_only ?
+            this->open.empty() :
+            this->open.size() == 1 && this->open[0] == &this->settings &&
+                this->last_key == "objects";
+        if (objects) {
+            this->open.push_back(nullptr);
+        } else {
+            this->open.push_back(&this->place(json::array()));
+        }
+        return true;
+    }
+
+    bool end_array() {
+        this->open.pop_back();
+        return this->completed();
+    }
+
+    template <typename Exception>
+    bool parse_error(size_t, const std::string&, const Exception& e) {
+        throw e;
+    }
+};
+
+
+/** A range of bytes, [first, second). */
+using Segment = std::pair<const char*, const char*>;
+
+/**
+ * An iterator over several ranges of bytes one after another, for parsing
+ * pieces of a file (and brackets around them) as one document.
+ */
+class SegmentIterator {
+private:
+    const std::vector<Segment>* segments;
+    size_t s;
+    const char* p;
+
+    /** Move on from the end of a segment to the start of the next nonempty
+      one, or to the end. */
+    void skip_ends() {
+        const std::vector<Segment>& segs = *this->segments;
+        while (this->s < segs.size() && this->p == segs[this->s].second) {
+            this->s++;
+            this->p = this->s < segs.size() ? segs[this->s].first : nullptr;
+        }
+    }
+
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = char;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const char*;
+    using reference = const char&;
+
+    /** The start of the segments, or their end if `end` is set. */
+    SegmentIterator(const std::vector<Segment>& segs, bool end):
+        segments{&segs},
+        s{end ? segs.size() : 0},
+        p{end || segs.empty() ? nullptr : segs[0].first}
+    {
+        this->skip_ends();
+    }
+
+    const char& operator*() const {
+        return *this->p;
+    }
+
+    SegmentIterator& operator++() {
+        ++this->p;
+        this->skip_ends();
+        return *this;
+    }
+
+    bool operator==(const SegmentIterator& other) const {
+        return this->s == other.s && this->p == other.p;
+    }
+
+    bool operator!=(const SegmentIterator& other) const {
+        return !(*this == other);
+    }
+};
+
+json parse_segments(const std::vector<Segment>& segments, const std::function<void(json&)>& add,
+                    bool entries_only) {
+    json settings;
+    SceneSax sax(settings, add, entries_only);
+    json::sax_parse(SegmentIterator(segments, false), SegmentIterator(segments, true), &sax);
+    return settings;
+}
+
+// Files smaller than this are parsed on one thread.
+const size_t parallel_min_size = 1 << 20;
+// The range of chunk sizes, in bytes, the "objects" array is split into.
+const size_t min_chunk = 256 << 10;
+const size_t max_chunk = 16 << 20;
+
+/**
+ * Where the entries of a scene's "objects" array are in its text: the
+ * positions of the array's brackets, and of the commas between entries where
+ * it is split into chunks.
+ */
+struct ObjectsLayout {
+    size_t open;
+    size_t close;
+    std::vector<size_t> cuts;
+};
+
+bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+/**
+ * Find the "objects" array of a JSON scene by scanning the structure of the
+ * text (brackets, strings and commas) without parsing it, and choose cuts
+ * about chunk bytes apart. Returns nothing unless the document is an object
+ * with exactly one "objects" key whose value is an array and the scan ends
+ * cleanly; then a plain parse has to be used, and reports any errors. Like a
+ * parse, the scan releases the pages it has passed as it goes.
+ */
+std::optional<ObjectsLayout> find_objects(const MappedFile& file, size_t chunk) {
+    const char* text = file.data();
+    size_t size = file.size();
+    size_t next_release = release_interval;
+    ObjectsLayout layout{0, 0, {}};
+    bool found = false;
+    size_t depth = 0;
+    // At the top level of the root object, whether a key comes next, and
+    // whether the value after the colon is that of "objects".
+    bool expect_key = false;
+    bool objects_key = false;
+    bool objects_value = false;
+    bool in_objects = false;
+    size_t next_cut = 0;
+    size_t i = 0;
+    while (i < size && is_space(text[i])) {
+        i++;
+    }
+    if (i == size || text[i] != '{') {
+        return {};
+    }
+    for (; i < size; i++) {
+        if (i >= next_release) {
+            file.release(0, i);
+            next_release += release_interval;
+        }
+        char c = text[i];
+        if (is_space(c)) {
+            continue;
+        }
+        if (objects_value && c != '[') {
+            // "objects" is not an array.
+            return {};
+        }
+        switch (c) {
+        case '"': {
+            size_t start = ++i;
+            while (i < size && text[i] != '"') {
+                i += text[i] == '\\' ? 2 : 1;
+            }
+            if (i >= size) {
+                return {};
+            }
+            if (depth == 1 && expect_key) {
+                objects_key = std::string(text + start, i - start) == "objects";
+                expect_key = false;
+            }
+            break;
+        }
+        case ':':
+            if (depth == 1) {
+                objects_value = objects_key;
+                objects_key = false;
+            }
+            break;
+        case '{':
+        case '[':
+            if (objects_value) {
+                if (found) {
+                    return {};
+                }
+                found = true;
+                in_objects = true;
+                objects_value = false;
+                layout.open = i;
+                next_cut = i + chunk;
+            }
+            depth++;
+            expect_key = c == '{' && depth == 1;
+            break;
+        case '}':
+        case ']':
+            if (depth == 0) {
+                return {};
+            }
+            if (in_objects && depth == 2) {
+                in_objects = false;
+                layout.close = i;
+            }
+            depth--;
+            if (depth == 0 && i + 1 < size) {
+                // Anything after the root object must be whitespace.
+                for (size_t j = i + 1; j < size; j++) {
+                    if (!is_space(text[j])) {
+                        return {};
+                    }
+                }
+                i = size;
+            }
+            break;
+        case ',':
+            if (depth == 1) {
+                expect_key = true;
+            } else if (in_objects && depth == 2 && i >= next_cut) {
+                layout.cuts.push_back(i);
+                next_cut = i + chunk;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if (depth != 0 || !found) {
+        return {};
+    }
+    return layout;
+}
+}
+
+json read_json_scene(const MappedFile& file, const std::function<void(json&)>& add) {
+    json settings;
+    SceneSax sax(settings, add, false);
+    json::sax_parse(ReleasingIterator(file, 0), ReleasingIterator(file, file.size()), &sax);
+    return settings;
+}
+
+json read_json_scene(const MappedFile& file, Primitives& objects, ThreadPool& pool,
+                     const std::function<void(json&, Primitives&)>& add) {
+    auto serial = [&]() {
+        return read_json_scene(file, [&](json& obj) {
+            add(obj, objects);
+        });
+    };
+    if (pool.size() == 1 || file.size() < parallel_min_size) {
+        return serial();
+    }
+    size_t chunk = std::clamp(file.size() / (4 * pool.size()), min_chunk, max_chunk);
+    std::optional<ObjectsLayout> layout = find_objects(file, chunk);
+    if (!layout) {
+        return serial();
+    }
+
+    // Chunk c holds the entries between cut c - 1 and cut c, the array's
+    // brackets standing in for the cuts at either end.
+    std::vector<size_t> bounds;
+    bounds.push_back(layout->open);
+    bounds.insert(bounds.end(), layout->cuts.begin(), layout->cuts.end());
+    bounds.push_back(layout->close);
+    size_t chunks = bounds.size() - 1;
+    static const char brackets[] = "[]";
+    // Chunks are parsed a pool's worth at a time and merged after each round,
+    // so that only that many chunks' objects are ever held twice.
+    size_t start_size = objects.size();
+    for (size_t round = 0; round < chunks; round += pool.size()) {
+        size_t count = std::min(pool.size(), chunks - round);
+        std::vector<Primitives> parts(count);
+        std::vector<std::exception_ptr> errors(count);
+        pool.parallel_for(count, [&](size_t i, [[maybe_unused]] size_t worker) {
+            const char* first = file.data() + bounds[round + i] + 1;
+            const char* last = file.data() + bounds[round + i + 1];
+            std::vector<Segment> segments = {{brackets, brackets + 1}, {first, last},
+                                             {brackets + 1, brackets + 2}};
+            try {
+                parse_segments(segments, [&](json& obj) {
+                    add(obj, parts[i]);
+                }, true);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+            file.release(first - file.data(), last - first);
+        });
+        for (const std::exception_ptr& e : errors) {
+            if (e) {
+                // Parse again on one thread, for the error as a whole-file
+                // parse reports it.
+                parts.clear();
+                objects.truncate(start_size);
+                return serial();
+            }
+        }
+        objects.append(parts);
+    }
+
+    // The settings are the rest of the document, with the array left empty.
+    std::vector<Segment> rest = {{file.data(), file.data() + layout->open + 1},
+                                 {file.data() + layout->close, file.data() + file.size()}};
+    json settings = parse_segments(rest, [](json&) {}, false);
+    return settings;
+}
+
+JsonSceneWriter::JsonSceneWriter(const std::string& file, const json& settings):
+    filename{file},
+    out{file, std::ios::trunc},
+    count{0}
+{
+    json without_objects = settings;
+    without_objects.erase("objects");
+    // Splice the objects in before the settings' closing brace.
+    std::string head = without_objects.dump();
+    this->out << head.substr(0, head.size() - 1) << (without_objects.empty() ? "" : ", ")
+              << "\"objects\": [" << std::setprecision(17);
+}
+
+void JsonSceneWriter::add(const Object& obj) {
+    std::ostream& out = this->out;
+    out << (this->count == 0 ? "\n" : ",\n");
+    if (typeid(obj) == typeid(Sphere)) {
+        const Sphere& s = static_cast<const Sphere&>(obj);
+        Point c = s.get_center();
+        Color col = s.get_base_color();
+        out << "{\"type\": \"sphere\", ";
+        write_triple(out, "center", c.x, c.y, c.z);
+        out << ", \"radius\": " << s.get_radius() << ", ";
+        write_triple(out, "color", col.red, col.green, col.blue);
+        out << ", \"reflectivity\": " << s.get_base_reflectivity() << "}";
+    } else if (typeid(obj) == typeid(Plane)) {
+        const Plane& p = static_cast<const Plane&>(obj);
+        Vector n = p.get_normal();
+        Point q = p.get_point();
+        Color col = p.get_base_color();
+        out << "{\"type\": \"plane\", ";
+        write_triple(out, "normal", n.x, n.y, n.z);
+        out << ", ";
+        write_triple(out, "point", q.x, q.y, q.z);
+        out << ", ";
+        write_triple(out, "color", col.red, col.green, col.blue);
+        out << ", \"reflectivity\": " << p.get_base_reflectivity() << ", \"checkerboard\": ";
+        if (p.get_checkerboard()) {
+            Color col2 = *p.get_checkerboard();
+            Vector o = *p.get_orientation();
+            out << "true, ";
+            write_triple(out, "color2", col2.red, col2.green, col2.blue);
+            out << ", ";
+            write_triple(out, "orientation", o.x, o.y, o.z);
+        } else {
+            out << "false";
+        }
+        out << "}";
+    } else {
+        throw std::invalid_argument("JSON scenes can only be written with spheres and planes");
+    }
+    this->count++;
+}
+
+size_t JsonSceneWriter::size() const {
+    return this->count;
+}
+
+void JsonSceneWriter::close() {
+    this->out << "\n]}\n";
+    this->out.close();
+    if (!this->out) {
+        throw std::runtime_error("Cannot write " + this->filename);
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <fstream>
+#include <functional>
+#include <string>
+
+#include "json.hpp"
+#include "mapped_file.hpp"
+#include "object.hpp"
+#include "primitives.hpp"
+#include "thread_pool.hpp"
+
+/**
+ * Read a JSON scene from a mapped file without building a tree of the whole
+ * file. Each entry of the top level "objects" array is built on its own,
+ * passed to `add` as soon as it is complete and then dropped; everything else
+ * in the scene (its settings) is returned. Pages of the file which the parse
+ * has passed are handed back to the OS as it goes, so memory use is bounded by
+ * what `add` keeps, not by the size of the file.
+ *
+ * Throws nlohmann::json's parse errors, as json::parse does.
+ */
+nlohmann::json read_json_scene(const MappedFile&, const std::function<void(nlohmann::json&)>&);
+
+/**
+ * read_json_scene, with the entries of "objects" parsed on the pool's
+ * workers. A quick scan of the text's structure finds the array and splits
+ * it at entry boundaries into chunks of up to a few MB; each chunk is parsed
+ * on its own, passing its entries to `add` with a Primitives of the chunk's
+ * own, and the chunks' objects are appended to `objects` in their order in
+ * the file. The objects and their indices are the same as for a parse on one
+ * thread, whatever the number of workers.
+ *
+ * Small files, pools of one worker and documents the scan does not
+ * understand are parsed on one thread, as are files with errors, so that
+ * errors are reported the same way.
+ */
+nlohmann::json read_json_scene(const MappedFile&, Primitives&, ThreadPool&,
+                               const std::function<void(nlohmann::json&, Primitives&)>&);
+
+/**
+ * Writes a JSON scene an object at a time, so that scenes of any size can be
+ * written without holding their objects: the settings first, then each entry
+ * of "objects" on a line of its own. Numbers are written with enough digits
+ * to read back exactly, so the scene loads to the same objects as a scene
+ * file written from them.
+ */
+class JsonSceneWriter {
+private:
+    std::string filename;
+    std::ofstream out;
+    size_t count;
+
+public:
+    /** Start the file with the given settings, those of a JSON scene without
+      its "objects". */
+    JsonSceneWriter(const std::string&, const nlohmann::json&);
+
+    /** Add a sphere or a plane. Throws for any other kind of object, as
+      SceneFileWriter does. */
+    void add(const Object&);
+
+    size_t size() const;
+
+    /** Finish the file. Throws if it could not be written. */
+    void close();
+};
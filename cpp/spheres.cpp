@@ -0,0 +1,682 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__x86_64__) && !defined(RTLC_FLOAT)
+#include <immintrin.h>
+#endif
+
+#include "isa.hpp"
+#include "spheres.hpp"
+
+// The kernels repeat the arithmetic of Sphere::collision operation for
+// operation. Everything is built with -ffp-contract=off so that neither side
+// fuses a multiply and an add the other does not.
+
+namespace {
+
+/** The parts of the quadratic which only depend on the ray. */
+struct Query {
+    Real px, py, pz;
+    Real vx, vy, vz;
+    Real a;
+    Real t_max;
+};
+
+using Kernel = std::optional<SphereHit> (*)(const SphereSet::Arrays&, const Query&, size_t,
+                                            size_t);
+using PacketKernel = void (*)(const SphereSet::Arrays&, const RayPacket&, uint32_t, size_t,
+                              size_t, Real*, size_t*);
+using OcclusionKernel = uint32_t (*)(const SphereSet::Arrays&, const RayPacket&, uint32_t,
+                                     size_t, size_t, Real);
+
+/** The time at which the ray hits one sphere, or NaN if it misses. */
+inline Real hit_time(const Query& q, Real cx, Real cy, Real cz, Real r2) {
+    Real b = 2 * ((q.px - cx) * q.vx + (q.py - cy) * q.vy + (q.pz - cz) * q.vz);
+    Real fx = cx - q.px;
+    Real fy = cy - q.py;
+    Real fz = cz - q.pz;
+    Real c = (fx * fx + fy * fy + fz * fz) - r2;
+    Real discr = b * b - 4 * q.a * c;
+    Real miss = std::numeric_limits<Real>::quiet_NaN();
+    if (discr < 0) {
+        return miss;
+    }
+    Real t1 = (-b + std::sqrt(discr)) / (2 * q.a);
+    Real t2 = (-b - std::sqrt(discr)) / (2 * q.a);
+    if (t1 < 0) {
+        return t2 < 0 ? miss : t2;
+    } else if (t2 < 0) {
+        return t1;
+    } else {
+        return std::min(t1, t2);
+    }
+}
+
+/** Fold spheres [begin, end) into the best hit so far, one at a time. */
+std::optional<SphereHit> scan(const SphereSet::Arrays& s, const Query& q, size_t begin, size_t end,
+                              std::optional<SphereHit> best) {
+    Real limit = best ? best->t : q.t_max;
+    for (size_t i = begin; i < end; i++) {
+        Real t = hit_time(q, s.cx[i], s.cy[i], s.cz[i], s.r2[i]);
+        if (t < limit) {
+            limit = t;
+            best = SphereHit{i, t};
+        }
+    }
+    return best;
+}
+
+std::optional<SphereHit> closest_scalar(const SphereSet::Arrays& s, const Query& q, size_t begin,
+                                        size_t end) {
+    return scan(s, q, begin, end, {});
+}
+
+/** The ray in one lane of a packet, with t_max as given. */
+Query lane_query(const RayPacket& p, size_t k, Real t_max) {
+    Vector v(p.dx[k], p.dy[k], p.dz[k]);
+    return Query{p.ox[k], p.oy[k], p.oz[k], v.x, v.y, v.z, v.dot_product(v), t_max};
+}
+
+void closest_packet_scalar(const SphereSet::Arrays& s, const RayPacket& p, uint32_t lanes, size_t begin,
+                           size_t end, Real* t, size_t* object) {
+    for (uint32_t m = lanes; m != 0; m &= m - 1) {
+        size_t k = __builtin_ctz(m);
+        Query q = lane_query(p, k, t[k]);
+        for (size_t i = begin; i < end; i++) {
+            Real time = hit_time(q, s.cx[i], s.cy[i], s.cz[i], s.r2[i]);
+            if (time < t[k] || (time == t[k] && s.ids[i] < object[k])) {
+                t[k] = time;
+                object[k] = s.ids[i];
+            }
+        }
+    }
+}
+
+uint32_t occluded_packet_scalar(const SphereSet::Arrays& s, const RayPacket& p, uint32_t lanes,
+                                size_t begin, size_t end, Real t_max) {
+    uint32_t hit = 0;
+    for (uint32_t m = lanes; m != 0; m &= m - 1) {
+        size_t k = __builtin_ctz(m);
+        Query q = lane_query(p, k, t_max);
+        for (size_t i = begin; i < end; i++) {
+            if (hit_time(q, s.cx[i], s.cy[i], s.cz[i], s.r2[i]) < t_max) {
+                hit |= 1u << k;
+                break;
+            }
+        }
+    }
+    return hit;
+}
+
+// The vector kernels work on doubles; single precision builds (RTLC_FLOAT)
+// only have the scalar ones.
+#if defined(__x86_64__) && !defined(RTLC_FLOAT)
+
+/** Reduce per-lane results: the smallest time, and the smallest position
+  among lanes tied for it. Lanes which found nothing hold t_max. */
+std::optional<SphereHit> reduce_lanes(const Real* t, const int64_t* index, size_t lanes,
+                                      Real t_max) {
+    std::optional<SphereHit> best;
+    for (size_t k = 0; k < lanes; k++) {
+        if (t[k] < t_max && (!best || t[k] < best->t ||
+                             (t[k] == best->t && (size_t) index[k] < best->index))) {
+            best = SphereHit{(size_t) index[k], t[k]};
+        }
+    }
+    return best;
+}
+
+/** hit_time for two ray-sphere pairs at once. Lanes which miss are set in
+  `miss` and hold garbage. */
+__attribute__((target("sse4.1")))
+inline __m128d hit_times_sse41(__m128d px, __m128d py, __m128d pz, __m128d vx, __m128d vy,
+                               __m128d vz, __m128d four_a, __m128d two_a, __m128d cx,
+                               __m128d cy, __m128d cz, __m128d r2, __m128d& miss) {
+    __m128d zero = _mm_setzero_pd();
+    __m128d dot = _mm_add_pd(
+        _mm_add_pd(_mm_mul_pd(_mm_sub_pd(px, cx), vx), _mm_mul_pd(_mm_sub_pd(py, cy), vy)),
+        _mm_mul_pd(_mm_sub_pd(pz, cz), vz));
+    __m128d b = _mm_mul_pd(_mm_set1_pd(2.0), dot);
+    __m128d fx = _mm_sub_pd(cx, px);
+    __m128d fy = _mm_sub_pd(cy, py);
+    __m128d fz = _mm_sub_pd(cz, pz);
+    __m128d c = _mm_sub_pd(
+        _mm_add_pd(_mm_add_pd(_mm_mul_pd(fx, fx), _mm_mul_pd(fy, fy)), _mm_mul_pd(fz, fz)),
+        r2);
+    __m128d discr = _mm_sub_pd(_mm_mul_pd(b, b), _mm_mul_pd(four_a, c));
+    miss = _mm_cmplt_pd(discr, zero);
+    // With only two lanes, skipping the square root and divisions when both
+    // miss, as the scalar test does, is worth the branch.
+    if (_mm_movemask_pd(miss) == 0x3) {
+        return discr;
+    }
+    __m128d root = _mm_sqrt_pd(discr);
+    __m128d neg_b = _mm_xor_pd(b, _mm_set1_pd(-0.0));
+    __m128d t1 = _mm_div_pd(_mm_add_pd(neg_b, root), two_a);
+    __m128d t2 = _mm_div_pd(_mm_sub_pd(neg_b, root), two_a);
+    __m128d t1_neg = _mm_cmplt_pd(t1, zero);
+    __m128d t2_neg = _mm_cmplt_pd(t2, zero);
+    __m128d t = _mm_blendv_pd(t1, t2, _mm_cmplt_pd(t2, t1));
+    t = _mm_blendv_pd(t, t1, t2_neg);
+    t = _mm_blendv_pd(t, t2, t1_neg);
+    miss = _mm_or_pd(miss, _mm_and_pd(t1_neg, t2_neg));
+    return t;
+}
+
+/** hit_time for four ray-sphere pairs at once. Lanes which miss are set in
+  `miss` and hold garbage. */
+__attribute__((target("avx2")))
+inline __m256d hit_times_avx2(__m256d px, __m256d py, __m256d pz, __m256d vx, __m256d vy,
+                              __m256d vz, __m256d four_a, __m256d two_a, __m256d cx,
+                              __m256d cy, __m256d cz, __m256d r2, __m256d& miss) {
+    __m256d zero = _mm256_setzero_pd();
+    __m256d dot = _mm256_add_pd(
+        _mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(px, cx), vx),
+                      _mm256_mul_pd(_mm256_sub_pd(py, cy), vy)),
+        _mm256_mul_pd(_mm256_sub_pd(pz, cz), vz));
+    __m256d b = _mm256_mul_pd(_mm256_set1_pd(2.0), dot);
+    __m256d fx = _mm256_sub_pd(cx, px);
+    __m256d fy = _mm256_sub_pd(cy, py);
+    __m256d fz = _mm256_sub_pd(cz, pz);
+    __m256d c = _mm256_sub_pd(
+        _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(fx, fx), _mm256_mul_pd(fy, fy)),
+                      _mm256_mul_pd(fz, fz)),
+        r2);
+    __m256d discr = _mm256_sub_pd(_mm256_mul_pd(b, b), _mm256_mul_pd(four_a, c));
+    __m256d root = _mm256_sqrt_pd(discr);
+    __m256d neg_b = _mm256_xor_pd(b, _mm256_set1_pd(-0.0));
+    __m256d t1 = _mm256_div_pd(_mm256_add_pd(neg_b, root), two_a);
+    __m256d t2 = _mm256_div_pd(_mm256_sub_pd(neg_b, root), two_a);
+    __m256d t1_neg = _mm256_cmp_pd(t1, zero, _CMP_LT_OQ);
+    __m256d t2_neg = _mm256_cmp_pd(t2, zero, _CMP_LT_OQ);
+    // std::min(t1, t2) keeps t1 unless t2 is strictly smaller.
+    __m256d t = _mm256_blendv_pd(t1, t2, _mm256_cmp_pd(t2, t1, _CMP_LT_OQ));
+    t = _mm256_blendv_pd(t, t1, t2_neg);
+    t = _mm256_blendv_pd(t, t2, t1_neg);
+    miss = _mm256_or_pd(_mm256_cmp_pd(discr, zero, _CMP_LT_OQ), _mm256_and_pd(t1_neg, t2_neg));
+    return t;
+}
+
+/** The same for eight pairs. */
+__attribute__((target("avx512f")))
+inline __m512d hit_times_avx512(__m512d px, __m512d py, __m512d pz, __m512d vx, __m512d vy,
+                                __m512d vz, __m512d four_a, __m512d two_a, __m512d cx,
+                                __m512d cy, __m512d cz, __m512d r2, __mmask8& miss) {
+    __m512d zero = _mm512_setzero_pd();
+    __m512d dot = _mm512_add_pd(
+        _mm512_add_pd(_mm512_mul_pd(_mm512_sub_pd(px, cx), vx),
+                      _mm512_mul_pd(_mm512_sub_pd(py, cy), vy)),
+        _mm512_mul_pd(_mm512_sub_pd(pz, cz), vz));
+    __m512d b = _mm512_mul_pd(_mm512_set1_pd(2.0), dot);
+    __m512d fx = _mm512_sub_pd(cx, px);
+    __m512d fy = _mm512_sub_pd(cy, py);
+    __m512d fz = _mm512_sub_pd(cz, pz);
+    __m512d c = _mm512_sub_pd(
+        _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(fx, fx), _mm512_mul_pd(fy, fy)),
+                      _mm512_mul_pd(fz, fz)),
+        r2);
+    __m512d discr = _mm512_sub_pd(_mm512_mul_pd(b, b), _mm512_mul_pd(four_a, c));
+    // The masked form avoids a spurious uninitialized warning from GCC's
+    // _mm512_sqrt_pd.
+    __m512d root = _mm512_mask_sqrt_pd(zero, 0xff, discr);
+    // Plain AVX-512F has no floating point xor, so flip the sign bit as an
+    // integer.
+    __m512i sign = _mm512_set1_epi64(std::numeric_limits<int64_t>::min());
+    __m512d neg_b = _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(b), sign));
+    __m512d t1 = _mm512_div_pd(_mm512_add_pd(neg_b, root), two_a);
+    __m512d t2 = _mm512_div_pd(_mm512_sub_pd(neg_b, root), two_a);
+    __mmask8 t1_neg = _mm512_cmp_pd_mask(t1, zero, _CMP_LT_OQ);
+    __mmask8 t2_neg = _mm512_cmp_pd_mask(t2, zero, _CMP_LT_OQ);
+    __m512d t = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(t2, t1, _CMP_LT_OQ), t1, t2);
+    t = _mm512_mask_blend_pd(t2_neg, t, t1);
+    t = _mm512_mask_blend_pd(t1_neg, t, t2);
+    miss = _mm512_cmp_pd_mask(discr, zero, _CMP_LT_OQ) | (t1_neg & t2_neg);
+    return t;
+}
+
+__attribute__((target("sse4.1")))
+std::optional<SphereHit> closest_sse41(const SphereSet::Arrays& s, const Query& q, size_t begin,
+                                       size_t end) {
+    const size_t lanes = 2;
+    __m128d px = _mm_set1_pd(q.px);
+    __m128d py = _mm_set1_pd(q.py);
+    __m128d pz = _mm_set1_pd(q.pz);
+    __m128d vx = _mm_set1_pd(q.vx);
+    __m128d vy = _mm_set1_pd(q.vy);
+    __m128d vz = _mm_set1_pd(q.vz);
+    __m128d four_a = _mm_set1_pd(4 * q.a);
+    __m128d two_a = _mm_set1_pd(2 * q.a);
+    __m128d best_t = _mm_set1_pd(q.t_max);
+    __m128i best_index = _mm_set1_epi64x(-1);
+    __m128i index = _mm_set_epi64x(begin + 1, begin);
+    __m128i step = _mm_set1_epi64x(lanes);
+    size_t i = begin;
+    for (; i + lanes <= end; i += lanes) {
+        __m128d miss;
+        __m128d t = hit_times_sse41(px, py, pz, vx, vy, vz, four_a, two_a,
+                                    _mm_loadu_pd(s.cx + i), _mm_loadu_pd(s.cy + i),
+                                    _mm_loadu_pd(s.cz + i), _mm_loadu_pd(s.r2 + i), miss);
+        __m128d better = _mm_andnot_pd(miss, _mm_cmplt_pd(t, best_t));
+        best_t = _mm_blendv_pd(best_t, t, better);
+        best_index = _mm_castpd_si128(_mm_blendv_pd(
+            _mm_castsi128_pd(best_index), _mm_castsi128_pd(index), better));
+        index = _mm_add_epi64(index, step);
+    }
+    alignas(16) Real t[lanes];
+    alignas(16) int64_t idx[lanes];
+    _mm_store_pd(t, best_t);
+    _mm_store_si128((__m128i*) idx, best_index);
+    return scan(s, q, i, end, reduce_lanes(t, idx, lanes, q.t_max));
+}
+
+__attribute__((target("avx2")))
+std::optional<SphereHit> closest_avx2(const SphereSet::Arrays& s, const Query& q, size_t begin,
+                                      size_t end) {
+    const size_t lanes = 4;
+    __m256d px = _mm256_set1_pd(q.px);
+    __m256d py = _mm256_set1_pd(q.py);
+    __m256d pz = _mm256_set1_pd(q.pz);
+    __m256d vx = _mm256_set1_pd(q.vx);
+    __m256d vy = _mm256_set1_pd(q.vy);
+    __m256d vz = _mm256_set1_pd(q.vz);
+    __m256d four_a = _mm256_set1_pd(4 * q.a);
+    __m256d two_a = _mm256_set1_pd(2 * q.a);
+    __m256d best_t = _mm256_set1_pd(q.t_max);
+    __m256i best_index = _mm256_set1_epi64x(-1);
+    __m256i index = _mm256_set_epi64x(begin + 3, begin + 2, begin + 1, begin);
+    __m256i step = _mm256_set1_epi64x(lanes);
+    size_t i = begin;
+    for (; i + lanes <= end; i += lanes) {
+        __m256d miss;
+        __m256d t = hit_times_avx2(px, py, pz, vx, vy, vz, four_a, two_a,
+                                   _mm256_loadu_pd(s.cx + i), _mm256_loadu_pd(s.cy + i),
+                                   _mm256_loadu_pd(s.cz + i), _mm256_loadu_pd(s.r2 + i), miss);
+        __m256d better = _mm256_andnot_pd(miss, _mm256_cmp_pd(t, best_t, _CMP_LT_OQ));
+        best_t = _mm256_blendv_pd(best_t, t, better);
+        best_index = _mm256_castpd_si256(_mm256_blendv_pd(
+            _mm256_castsi256_pd(best_index), _mm256_castsi256_pd(index), better));
+        index = _mm256_add_epi64(index, step);
+    }
+    alignas(32) Real t[lanes];
+    alignas(32) int64_t idx[lanes];
+    _mm256_store_pd(t, best_t);
+    _mm256_store_si256((__m256i*) idx, best_index);
+    // The leftover spheres come after every lane's, so they only win ties
+    // when nothing else was hit at that time.
+    return scan(s, q, i, end, reduce_lanes(t, idx, lanes, q.t_max));
+}
+
+__attribute__((target("avx512f")))
+std::optional<SphereHit> closest_avx512(const SphereSet::Arrays& s, const Query& q, size_t begin,
+                                        size_t end) {
+    const size_t lanes = 8;
+    __m512d px = _mm512_set1_pd(q.px);
+    __m512d py = _mm512_set1_pd(q.py);
+    __m512d pz = _mm512_set1_pd(q.pz);
+    __m512d vx = _mm512_set1_pd(q.vx);
+    __m512d vy = _mm512_set1_pd(q.vy);
+    __m512d vz = _mm512_set1_pd(q.vz);
+    __m512d four_a = _mm512_set1_pd(4 * q.a);
+    __m512d two_a = _mm512_set1_pd(2 * q.a);
+    __m512d best_t = _mm512_set1_pd(q.t_max);
+    __m512i best_index = _mm512_set1_epi64(-1);
+    __m512i index = _mm512_add_epi64(_mm512_set1_epi64(begin),
+                                     _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0));
+    __m512i step = _mm512_set1_epi64(lanes);
+    size_t i = begin;
+    for (; i + lanes <= end; i += lanes) {
+        __mmask8 miss;
+        __m512d t = hit_times_avx512(px, py, pz, vx, vy, vz, four_a, two_a,
+                                     _mm512_loadu_pd(s.cx + i), _mm512_loadu_pd(s.cy + i),
+                                     _mm512_loadu_pd(s.cz + i), _mm512_loadu_pd(s.r2 + i), miss);
+        __mmask8 better = _mm512_cmp_pd_mask(t, best_t, _CMP_LT_OQ) & ~miss;
+        best_t = _mm512_mask_blend_pd(better, best_t, t);
+        best_index = _mm512_mask_blend_epi64(better, best_index, index);
+        index = _mm512_add_epi64(index, step);
+    }
+    alignas(64) Real t[lanes];
+    alignas(64) int64_t idx[lanes];
+    _mm512_store_pd(t, best_t);
+    _mm512_store_si512(idx, best_index);
+    return scan(s, q, i, end, reduce_lanes(t, idx, lanes, q.t_max));
+}
+
+// The packet kernels take the rays four or eight lanes at a time and the
+// spheres one at a time. Lanes past the packet's size are never active, and
+// their results are never stored.
+
+/** The lanes of a pair selected by the low bits of `bits`, as a vector
+  mask. */
+__attribute__((target("sse4.1")))
+inline __m128d lane_mask_sse41(uint32_t bits) {
+    __m128i bit = _mm_set_epi64x(2, 1);
+    __m128i set = _mm_and_si128(_mm_set1_epi64x(bits), bit);
+    return _mm_castsi128_pd(_mm_cmpeq_epi64(set, bit));
+}
+
+__attribute__((target("sse4.1")))
+void closest_packet_sse41(const SphereSet::Arrays& s, const RayPacket& p, uint32_t lanes,
+                          size_t begin, size_t end, Real* t, size_t* object) {
+    for (size_t k = 0; k < p.size; k += 2) {
+        uint32_t pair = (lanes >> k) & 0x3;
+        if (pair == 0) {
+            continue;
+        }
+        __m128d px = _mm_loadu_pd(p.ox + k);
+        __m128d py = _mm_loadu_pd(p.oy + k);
+        __m128d pz = _mm_loadu_pd(p.oz + k);
+        __m128d vx = _mm_loadu_pd(p.dx + k);
+        __m128d vy = _mm_loadu_pd(p.dy + k);
+        __m128d vz = _mm_loadu_pd(p.dz + k);
+        __m128d a = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, vx), _mm_mul_pd(vy, vy)),
+                               _mm_mul_pd(vz, vz));
+        __m128d four_a = _mm_mul_pd(_mm_set1_pd(4.0), a);
+        __m128d two_a = _mm_mul_pd(_mm_set1_pd(2.0), a);
+        // A packet of one only owns the first slot of t and object. SSE4.1
+        // has no 64-bit compare for the identifiers, so those stay scalar.
+        alignas(16) Real best[2] = {pair & 1 ? t[k] : 0, pair & 2 ? t[k + 1] : 0};
+        size_t best_object[2] = {pair & 1 ? object[k] : 0, pair & 2 ? object[k + 1] : 0};
+        __m128d best_t = _mm_load_pd(best);
+        for (size_t i = begin; i < end; i++) {
+            __m128d miss;
+            __m128d time = hit_times_sse41(px, py, pz, vx, vy, vz, four_a, two_a,
+                                           _mm_set1_pd(s.cx[i]), _mm_set1_pd(s.cy[i]),
+                                           _mm_set1_pd(s.cz[i]), _mm_set1_pd(s.r2[i]), miss);
+            uint32_t closer = _mm_movemask_pd(_mm_andnot_pd(miss, _mm_cmplt_pd(time, best_t)));
+            uint32_t tied = _mm_movemask_pd(_mm_andnot_pd(miss, _mm_cmpeq_pd(time, best_t)));
+            for (uint32_t m = tied; m != 0; m &= m - 1) {
+                size_t lane = __builtin_ctz(m);
+                closer |= (uint32_t) (s.ids[i] < best_object[lane]) << lane;
+            }
+            closer &= pair;
+            if (closer == 0) {
+                continue;
+            }
+            best_t = _mm_blendv_pd(best_t, time, lane_mask_sse41(closer));
+            for (uint32_t m = closer; m != 0; m &= m - 1) {
+                best_object[__builtin_ctz(m)] = s.ids[i];
+            }
+        }
+        _mm_store_pd(best, best_t);
+        for (uint32_t m = pair; m != 0; m &= m - 1) {
+            size_t lane = __builtin_ctz(m);
+            t[k + lane] = best[lane];
+            object[k + lane] = best_object[lane];
+        }
+    }
+}
+
+__attribute__((target("sse4.1")))
+uint32_t occluded_packet_sse41(const SphereSet::Arrays& s, const RayPacket& p, uint32_t lanes,
+                               size_t begin, size_t end, Real t_max) {
+    uint32_t hit = 0;
+    for (size_t k = 0; k < p.size; k += 2) {
+        uint32_t pair = (lanes >> k) & 0x3;
+        if (pair == 0) {
+            continue;
+        }
+        __m128d px = _mm_loadu_pd(p.ox + k);
+        __m128d py = _mm_loadu_pd(p.oy + k);
+        __m128d pz = _mm_loadu_pd(p.oz + k);
+        __m128d vx = _mm_loadu_pd(p.dx + k);
+        __m128d vy = _mm_loadu_pd(p.dy + k);
+        __m128d vz = _mm_loadu_pd(p.dz + k);
+        __m128d a = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, vx), _mm_mul_pd(vy, vy)),
+                               _mm_mul_pd(vz, vz));
+        __m128d four_a = _mm_mul_pd(_mm_set1_pd(4.0), a);
+        __m128d two_a = _mm_mul_pd(_mm_set1_pd(2.0), a);
+        __m128d limit = _mm_set1_pd(t_max);
+        uint32_t found = 0;
+        for (size_t i = begin; i < end && found != pair; i++) {
+            __m128d miss;
+            __m128d time = hit_times_sse41(px, py, pz, vx, vy, vz, four_a, two_a,
+                                           _mm_set1_pd(s.cx[i]), _mm_set1_pd(s.cy[i]),
+                                           _mm_set1_pd(s.cz[i]), _mm_set1_pd(s.r2[i]), miss);
+            __m128d blocked = _mm_andnot_pd(miss, _mm_cmplt_pd(time, limit));
+            found |= _mm_movemask_pd(blocked) & pair;
+        }
+        hit |= found << k;
+    }
+    return hit;
+}
+
+/** The lanes of a chunk of four selected by the low bits of `bits`, as a
+  vector mask. */
+__attribute__((target("avx2")))
+inline __m256d lane_mask_avx2(uint32_t bits) {
+    __m256i bit = _mm256_set_epi64x(8, 4, 2, 1);
+    __m256i set = _mm256_and_si256(_mm256_set1_epi64x(bits), bit);
+    return _mm256_castsi256_pd(_mm256_cmpeq_epi64(set, bit));
+}
+
+__attribute__((target("avx2")))
+void closest_packet_avx2(const SphereSet::Arrays& s, const RayPacket& p, uint32_t lanes, size_t begin,
+                         size_t end, Real* t, size_t* object) {
+    // Flipping the sign bit turns the unsigned comparison of identifiers
+    // into a signed one, which is all AVX2 has.
+    __m256i flip = _mm256_set1_epi64x(std::numeric_limits<int64_t>::min());
+    for (size_t k = 0; k < p.size; k += 4) {
+        if (((lanes >> k) & 0xf) == 0) {
+            continue;
+        }
+        __m256d active = lane_mask_avx2(lanes >> k);
+        __m256d px = _mm256_loadu_pd(p.ox + k);
+        __m256d py = _mm256_loadu_pd(p.oy + k);
+        __m256d pz = _mm256_loadu_pd(p.oz + k);
+        __m256d vx = _mm256_loadu_pd(p.dx + k);
+        __m256d vy = _mm256_loadu_pd(p.dy + k);
+        __m256d vz = _mm256_loadu_pd(p.dz + k);
+        // The same sums as Vector::dot_product.
+        __m256d a = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx, vx), _mm256_mul_pd(vy, vy)),
+                                  _mm256_mul_pd(vz, vz));
+        __m256d four_a = _mm256_mul_pd(_mm256_set1_pd(4.0), a);
+        __m256d two_a = _mm256_mul_pd(_mm256_set1_pd(2.0), a);
+        __m256d best_t = _mm256_maskload_pd(t + k, _mm256_castpd_si256(active));
+        __m256i best_object = _mm256_maskload_epi64((const long long*) object + k,
+                                                    _mm256_castpd_si256(active));
+        for (size_t i = begin; i < end; i++) {
+            __m256d miss;
+            __m256d time = hit_times_avx2(px, py, pz, vx, vy, vz, four_a, two_a,
+                                          _mm256_set1_pd(s.cx[i]), _mm256_set1_pd(s.cy[i]),
+                                          _mm256_set1_pd(s.cz[i]), _mm256_set1_pd(s.r2[i]),
+                                          miss);
+            __m256i id = _mm256_set1_epi64x(s.ids[i]);
+            __m256d smaller_id = _mm256_castsi256_pd(_mm256_cmpgt_epi64(
+                _mm256_xor_si256(best_object, flip), _mm256_xor_si256(id, flip)));
+            __m256d better = _mm256_or_pd(
+                _mm256_cmp_pd(time, best_t, _CMP_LT_OQ),
+                _mm256_and_pd(_mm256_cmp_pd(time, best_t, _CMP_EQ_OQ), smaller_id));
+            better = _mm256_and_pd(_mm256_andnot_pd(miss, better), active);
+            best_t = _mm256_blendv_pd(best_t, time, better);
+            best_object = _mm256_castpd_si256(_mm256_blendv_pd(
+                _mm256_castsi256_pd(best_object), _mm256_castsi256_pd(id), better));
+        }
+        _mm256_maskstore_pd(t + k, _mm256_castpd_si256(active), best_t);
+        _mm256_maskstore_epi64((long long*) object + k, _mm256_castpd_si256(active),
+                               best_object);
+    }
+}
+
+__attribute__((target("avx2")))
+uint32_t occluded_packet_avx2(const SphereSet::Arrays& s, const RayPacket& p, uint32_t lanes,
+                              size_t begin, size_t end, Real t_max) {
+    uint32_t hit = 0;
+    for (size_t k = 0; k < p.size; k += 4) {
+        uint32_t chunk = (lanes >> k) & 0xf;
+        if (chunk == 0) {
+            continue;
+        }
+        __m256d px = _mm256_loadu_pd(p.ox + k);
+        __m256d py = _mm256_loadu_pd(p.oy + k);
+        __m256d pz = _mm256_loadu_pd(p.oz + k);
+        __m256d vx = _mm256_loadu_pd(p.dx + k);
+        __m256d vy = _mm256_loadu_pd(p.dy + k);
+        __m256d vz = _mm256_loadu_pd(p.dz + k);
+        __m256d a = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx, vx), _mm256_mul_pd(vy, vy)),
+                                  _mm256_mul_pd(vz, vz));
+        __m256d four_a = _mm256_mul_pd(_mm256_set1_pd(4.0), a);
+        __m256d two_a = _mm256_mul_pd(_mm256_set1_pd(2.0), a);
+        __m256d limit = _mm256_set1_pd(t_max);
+        uint32_t found = 0;
+        for (size_t i = begin; i < end && found != chunk; i++) {
+            __m256d miss;
+            __m256d time = hit_times_avx2(px, py, pz, vx, vy, vz, four_a, two_a,
+                                          _mm256_set1_pd(s.cx[i]), _mm256_set1_pd(s.cy[i]),
+                                          _mm256_set1_pd(s.cz[i]), _mm256_set1_pd(s.r2[i]),
+                                          miss);
+            __m256d blocked = _mm256_andnot_pd(miss, _mm256_cmp_pd(time, limit, _CMP_LT_OQ));
+            found |= _mm256_movemask_pd(blocked) & chunk;
+        }
+        hit |= found << k;
+    }
+    return hit;
+}
+
+__attribute__((target("avx512f")))
+void closest_packet_avx512(const SphereSet::Arrays& s, const RayPacket& p, uint32_t lanes, size_t begin,
+                           size_t end, Real* t, size_t* object) {
+    for (size_t k = 0; k < p.size; k += 8) {
+        __mmask8 active = (lanes >> k) & 0xff;
+        if (active == 0) {
+            continue;
+        }
+        __m512d px = _mm512_loadu_pd(p.ox + k);
+        __m512d py = _mm512_loadu_pd(p.oy + k);
+        __m512d pz = _mm512_loadu_pd(p.oz + k);
+        __m512d vx = _mm512_loadu_pd(p.dx + k);
+        __m512d vy = _mm512_loadu_pd(p.dy + k);
+        __m512d vz = _mm512_loadu_pd(p.dz + k);
+        __m512d a = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(vx, vx), _mm512_mul_pd(vy, vy)),
+                                  _mm512_mul_pd(vz, vz));
+        __m512d four_a = _mm512_mul_pd(_mm512_set1_pd(4.0), a);
+        __m512d two_a = _mm512_mul_pd(_mm512_set1_pd(2.0), a);
+        // Masked loads and stores, since a packet of four only owns the
+        // first four slots of t and object.
+        __m512d best_t = _mm512_maskz_loadu_pd(active, t + k);
+        __m512i best_object = _mm512_maskz_loadu_epi64(active, object + k);
+        for (size_t i = begin; i < end; i++) {
+            __mmask8 miss;
+            __m512d time = hit_times_avx512(px, py, pz, vx, vy, vz, four_a, two_a,
+                                            _mm512_set1_pd(s.cx[i]), _mm512_set1_pd(s.cy[i]),
+                                            _mm512_set1_pd(s.cz[i]), _mm512_set1_pd(s.r2[i]),
+                                            miss);
+            __m512i id = _mm512_set1_epi64(s.ids[i]);
+            __mmask8 better = _mm512_cmp_pd_mask(time, best_t, _CMP_LT_OQ) |
+                (_mm512_cmp_pd_mask(time, best_t, _CMP_EQ_OQ) &
+                 _mm512_cmplt_epu64_mask(id, best_object));
+            better &= active & ~miss;
+            best_t = _mm512_mask_blend_pd(better, best_t, time);
+            best_object = _mm512_mask_blend_epi64(better, best_object, id);
+        }
+        _mm512_mask_storeu_pd(t + k, active, best_t);
+        _mm512_mask_storeu_epi64(object + k, active, best_object);
+    }
+}
+
+__attribute__((target("avx512f")))
+uint32_t occluded_packet_avx512(const SphereSet::Arrays& s, const RayPacket& p, uint32_t lanes,
+                                size_t begin, size_t end, Real t_max) {
+    uint32_t hit = 0;
+    for (size_t k = 0; k < p.size; k += 8) {
+        __mmask8 chunk = (lanes >> k) & 0xff;
+        if (chunk == 0) {
+            continue;
+        }
+        __m512d px = _mm512_loadu_pd(p.ox + k);
+        __m512d py = _mm512_loadu_pd(p.oy + k);
+        __m512d pz = _mm512_loadu_pd(p.oz + k);
+        __m512d vx = _mm512_loadu_pd(p.dx + k);
+        __m512d vy = _mm512_loadu_pd(p.dy + k);
+        __m512d vz = _mm512_loadu_pd(p.dz + k);
+        __m512d a = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(vx, vx), _mm512_mul_pd(vy, vy)),
+                                  _mm512_mul_pd(vz, vz));
+        __m512d four_a = _mm512_mul_pd(_mm512_set1_pd(4.0), a);
+        __m512d two_a = _mm512_mul_pd(_mm512_set1_pd(2.0), a);
+        __m512d limit = _mm512_set1_pd(t_max);
+        __mmask8 found = 0;
+        for (size_t i = begin; i < end && found != chunk; i++) {
+            __mmask8 miss;
+            __m512d time = hit_times_avx512(px, py, pz, vx, vy, vz, four_a, two_a,
+                                            _mm512_set1_pd(s.cx[i]), _mm512_set1_pd(s.cy[i]),
+                                            _mm512_set1_pd(s.cz[i]), _mm512_set1_pd(s.r2[i]),
+                                            miss);
+            found |= _mm512_cmp_pd_mask(time, limit, _CMP_LT_OQ) & ~miss & chunk;
+        }
+        hit |= (uint32_t) found << k;
+    }
+    return hit;
+}
+
+#endif
+
+struct KernelEntry {
+    Kernel kernel;
+    PacketKernel closest_packet;
+    OcclusionKernel occluded_packet;
+};
+
+/** The kernels for each instruction set, in the order of Isa. */
+const KernelEntry kernels[] = {
+    {closest_scalar, closest_packet_scalar, occluded_packet_scalar},
+#if defined(__x86_64__) && !defined(RTLC_FLOAT)
+    {closest_sse41, closest_packet_sse41, occluded_packet_sse41},
+    {closest_avx2, closest_packet_avx2, occluded_packet_avx2},
+    {closest_avx512, closest_packet_avx512, occluded_packet_avx512},
+#endif
+};
+
+const KernelEntry& current() {
+    return kernels[(size_t) current_isa()];
+}
+
+}
+
+SphereSet::SphereSet():
+    cx{},
+    cy{},
+    cz{},
+    r2{},
+    ids{}
+{}
+
+void SphereSet::add(Point center, Real radius, size_t id) {
+    this->cx.push_back(center.x);
+    this->cy.push_back(center.y);
+    this->cz.push_back(center.z);
+    this->r2.push_back(radius * radius);
+    this->ids.push_back(id);
+}
+
+size_t SphereSet::size() const {
+    return this->ids.size();
+}
+
+size_t SphereSet::id(size_t index) const {
+    return this->ids[index];
+}
+
+SphereSet::Arrays SphereSet::arrays() const {
+    return Arrays{this->cx.data(), this->cy.data(), this->cz.data(), this->r2.data(),
+                  this->ids.data()};
+}
+
+std::optional<SphereHit> SphereSet::closest(const Ray& r, size_t begin, size_t end,
+                                            Real t_max) const {
+    Vector v = r.direction;
+    Query q{r.start.x, r.start.y, r.start.z, v.x, v.y, v.z, v.dot_product(v), t_max};
+    return current().kernel(this->arrays(), q, begin, end);
+}
+
+void SphereSet::closest_packet(const RayPacket& p, uint32_t lanes, size_t begin, size_t end,
+                               Real* t, size_t* object) const {
+    current().closest_packet(this->arrays(), p, lanes, begin, end, t, object);
+}
+
+uint32_t SphereSet::occluded_packet(const RayPacket& p, uint32_t lanes, size_t begin,
+                                    size_t end, Real t_max) const {
+    return current().occluded_packet(this->arrays(), p, lanes, begin, end, t_max);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "packet.hpp"
+#include "types.hpp"
+
+/**
+ * The nearest sphere in a SphereSet hit by a ray: its position in the set
+ * and the time of the hit.
+ */
+struct SphereHit {
+    size_t index;
+    Real t;
+};
+
+/**
+ * Spheres stored as a structure of arrays (center coordinates and squared
+ * radius each in their own contiguous array) so that one ray can be tested
+ * against several spheres at once with vector instructions.
+ *
+ * Every kernel computes exactly the same times, bit for bit, as
+ * Sphere::collision, so the set can stand in for a list of spheres without
+ * changing a single pixel.
+ */
+class SphereSet {
+public:
+    /** Pointers to the arrays, as the kernels take them. */
+    struct Arrays {
+        const Real* cx;
+        const Real* cy;
+        const Real* cz;
+        const Real* r2;
+        const size_t* ids;
+    };
+
+private:
+    std::vector<Real> cx;
+    std::vector<Real> cy;
+    std::vector<Real> cz;
+    std::vector<Real> r2;
+    // Caller supplied identifiers, e.g. the sphere's index in the scene.
+    std::vector<size_t> ids;
+
+    Arrays arrays() const;
+
+public:
+    SphereSet();
+
+    /** Add a sphere by center and radius with an identifier for the
+      caller's use. */
+    void add(Point, Real, size_t);
+
+    size_t size() const;
+
+    /** The identifier given when the sphere at this position was added. */
+    size_t id(size_t) const;
+
+    /** Find the nearest sphere among positions [begin, end) which the ray hits
+      strictly before t_max. When several are hit at the same time the
+      earliest position wins. */
+    std::optional<SphereHit> closest(const Ray&, size_t, size_t, Real) const;
+
+    /** For each ray of the packet in the given lanes, test positions
+      [begin, end) and keep the ray's closest hit in t[lane] and
+      object[lane], the sphere's identifier. Ties go to the smaller
+      identifier. */
+    void closest_packet(const RayPacket&, uint32_t, size_t, size_t, Real*, size_t*) const;
+
+    /** The lanes among those given whose ray hits one of positions
+      [begin, end) strictly before t_max. */
+    uint32_t occluded_packet(const RayPacket&, uint32_t, size_t, size_t, Real) const;
+};
@@ -0,0 +1,79 @@
+#include <atomic>
+
+#include "thread_pool.hpp"
+
+ThreadPool::ThreadPool(size_t n):
+    workers{},
+    mutex{},
+    start_cv{},
+    done_cv{},
+    job{},
+    generation{0},
+    running{0},
+    stopping{false}
+{
+    if (n == 0) {
+        n = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < n; i++) {
+        this->workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->start_cv.notify_all();
+    for (std::thread& t : this->workers) {
+        t.join();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return this->workers.size();
+}
+
+void ThreadPool::worker_loop(size_t index) {
+    size_t seen = 0;
+    while (true) {
+        std::function<void(size_t)>* current;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->start_cv.wait(lock, [&] {
+                return this->stopping || this->generation != seen;
+            });
+            if (this->stopping) {
+                return;
+            }
+            seen = this->generation;
+            current = &this->job;
+        }
+        (*current)(index);
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->running--;
+        }
+        this->done_cv.notify_one();
+    }
+}
+
+void ThreadPool::run(std::function<void(size_t)> f) {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->job = std::move(f);
+    this->running = this->workers.size();
+    this->generation++;
+    this->start_cv.notify_all();
+    this->done_cv.wait(lock, [&] { return this->running == 0; });
+    this->job = nullptr;
+}
+
+void ThreadPool::parallel_for(size_t count, std::function<void(size_t, size_t)> f) {
+    std::atomic<size_t> next{0};
+    this->run([&](size_t worker) {
+        for (size_t i = next++; i < count; i = next++) {
+            f(i, worker);
+        }
+    });
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A fixed set of worker threads which live for the lifetime of the pool.
+ *
+ * Work is handed to the pool one job at a time: every call blocks until all of
+ * the workers have finished with the job. Jobs must not submit further work to
+ * the same pool.
+ */
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start_cv;
+    std::condition_variable done_cv;
+    std::function<void(size_t)> job;
+    size_t generation;
+    size_t running;
+    bool stopping;
+
+    void worker_loop(size_t);
+
+public:
+    /** Start a pool with the given number of workers. Zero means one worker
+      per hardware thread. */
+    ThreadPool(size_t);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const;
+
+    /** Run the given function once on every worker. The argument is the index
+      of the worker running it, in the range [0, size()). */
+    void run(std::function<void(size_t)>);
+
+    /** Call the given function for every index in [0, count), distributing
+      indices dynamically among the workers. The second argument is the index
+      of the worker. */
+    void parallel_for(size_t, std::function<void(size_t, size_t)>);
+};
@@ -1,59 +1,289 @@
 #pragma once
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
-class Vector {
+/**
+ * The scalar type of all geometry and color math. Renders are done in double
+ * precision unless built with RTLC_FLOAT defined, as trace-f32 is, which
+ * renders in single precision instead.
+ *
+ * The math types below are templates over the scalar so that both precisions
+ * can be used side by side, e.g. by tools which compare them; the renderer
+ * itself uses the aliases for Real.
+ *
+ * They are small value types defined entirely in this header, so that every
+ * operation can be inlined where it is used, and everything but what needs a
+ * square root is constexpr. The combined operations (normalized, reflect,
+ * multiply_add, Ray::at) do exactly the arithmetic of the separate operations
+ * they stand for, in the same order, so using them never changes a result.
+ */
+#if defined(RTLC_FLOAT)
+using Real = float;
+#else
+using Real = double;
+#endif
+
+/**
+ * Tolerances which depend on the precision of the math.
+ */
+template <typename T>
+struct Tolerance;
+
+template <>
+struct Tolerance<double> {
+    /** How far along its direction a ray leaving a surface starts, so that it
+      does not hit the surface again. Shadow rays, whose direction reaches
+      the light, stop this far short of it. */
+    static constexpr double offset = 1e-5;
+    /** Relative padding of bounding boxes, covering rounding in the box and
+      intersection tests. */
+    static constexpr double pad = 1e-9;
+};
+
+template <>
+struct Tolerance<float> {
+    static constexpr float offset = 1e-4f;
+    static constexpr float pad = 1e-5f;
+};
+
+template <typename T>
+class BasicVector {
 public:
-    double x;
-    double y;
-    double z;
+    using Scalar = T;
+
+    T x;
+    T y;
+    T z;
+
+    constexpr BasicVector(T x, T y, T z): x{x}, y{y}, z{z} {}
+
+    constexpr T dot_product(BasicVector other) const {
+        return this->x * other.x + this->y * other.y + this->z * other.z;
+    }
 
-    Vector(double, double, double);
+    constexpr BasicVector cross_product(BasicVector other) const {
+        return BasicVector(this->y * other.z - this->z * other.y,
+                           this->z * other.x - this->x * other.z,
+                           this->x * other.y - this->y * other.x);
+    }
 
-    double dot_product(Vector) const;
-    Vector cross_product(Vector) const;
-    double magnitude() const;
-    Vector project(Vector) const;
-    Vector operator-(Vector) const;
-    Vector operator-() const;
-    Vector operator+(Vector) const;
+    T magnitude() const {
+        return std::sqrt(this->dot_product(*this));
+    }
 
-    friend Vector operator*(double, Vector);
+    /** 1 / magnitude(), for scaling by rather than dividing by. */
+    T reciprocal_magnitude() const {
+        return 1 / this->magnitude();
+    }
+
+    /** This vector scaled to unit length. */
+    BasicVector normalized() const {
+        return this->reciprocal_magnitude() * *this;
+    }
+
+    /** The component of this vector along another. */
+    constexpr BasicVector project(BasicVector other) const {
+        return (this->dot_product(other) / other.dot_product(other)) * other;
+    }
+
+    /** This vector mirrored about the line along the normal, which need not
+      be unit length: a vector pointing away from a surface reflects to the
+      direction light arriving along it leaves in. */
+    constexpr BasicVector reflect(BasicVector normal) const {
+        return *this + 2 * (this->project(normal) - *this);
+    }
+
+    /** reflect() about a unit normal, which makes the projection a single
+      dot product with no division. */
+    constexpr BasicVector reflect_unit(BasicVector unit) const {
+        return *this + 2 * (this->dot_product(unit) * unit - *this);
+    }
+
+    constexpr BasicVector operator-(BasicVector other) const {
+        return BasicVector(this->x - other.x, this->y - other.y, this->z - other.z);
+    }
+
+    constexpr BasicVector operator-() const {
+        return BasicVector(-this->x, -this->y, -this->z);
+    }
+
+    constexpr BasicVector operator+(BasicVector other) const {
+        return BasicVector(this->x + other.x, this->y + other.y, this->z + other.z);
+    }
 };
 
-class Point {
+/** Scale a vector. The scalar is converted to the vector's precision. */
+template <typename T>
+constexpr BasicVector<T> operator*(typename BasicVector<T>::Scalar a, BasicVector<T> v) {
+    return BasicVector<T>(a * v.x, a * v.y, a * v.z);
+}
+
+template <typename T>
+class BasicPoint {
 public:
-    double x;
-    double y;
-    double z;
+    T x;
+    T y;
+    T z;
 
-    Point(double, double, double);
+    constexpr BasicPoint(T x, T y, T z): x{x}, y{y}, z{z} {}
 
-    Vector operator-(Point) const;
-    Point operator+(Vector) const;
+    constexpr BasicVector<T> operator-(BasicPoint other) const {
+        return BasicVector<T>(this->x - other.x, this->y - other.y, this->z - other.z);
+    }
 
+    constexpr BasicPoint operator+(BasicVector<T> other) const {
+        return BasicPoint(this->x + other.x, this->y + other.y, this->z + other.z);
+    }
 };
 
-class Ray {
+/** p + a v, without building the scaled vector. */
+template <typename T>
+constexpr BasicPoint<T> multiply_add(typename BasicVector<T>::Scalar a, BasicVector<T> v,
+                                     BasicPoint<T> p) {
+    return BasicPoint<T>(p.x + a * v.x, p.y + a * v.y, p.z + a * v.z);
+}
+
+template <typename T>
+class BasicRay {
+public:
+    BasicPoint<T> start;
+    BasicVector<T> direction;
+
+    constexpr BasicRay(BasicPoint<T> p, BasicVector<T> v): start{p}, direction{v} {}
+
+    /** The point the ray reaches at time t. */
+    constexpr BasicPoint<T> at(T t) const {
+        return multiply_add(t, this->direction, this->start);
+    }
+};
+
+template <typename T>
+class BasicColor {
 public:
-    Point start;
-    Vector direction;
+    using Scalar = T;
+
+    T red;
+    T green;
+    T blue;
+
+    constexpr BasicColor(): red{0.0}, green{0.0}, blue{0.0} {}
+    constexpr BasicColor(T r, T g, T b): red{r}, green{g}, blue{b} {}
 
-    Ray(Point, Vector);
+    constexpr BasicColor operator+(BasicColor other) const {
+        return BasicColor(this->red + other.red,
+                          this->green + other.green,
+                          this->blue + other.blue);
+    }
+
+    constexpr BasicColor& operator+=(BasicColor other) {
+        this->red += other.red;
+        this->green += other.green;
+        this->blue += other.blue;
+        return *this;
+    }
 };
 
-class Color {
+template <typename T>
+constexpr BasicColor<T> operator*(typename BasicColor<T>::Scalar a, BasicColor<T> c) {
+    return BasicColor<T>(a * c.red, a * c.green, a * c.blue);
+}
+
+/** d + a c, without building the scaled color. */
+template <typename T>
+constexpr BasicColor<T> multiply_add(typename BasicColor<T>::Scalar a, BasicColor<T> c,
+                                     BasicColor<T> d) {
+    return BasicColor<T>(d.red + a * c.red, d.green + a * c.green, d.blue + a * c.blue);
+}
+
+/**
+ * An axis-aligned box, used to bound objects for acceleration structures. A
+ * default-constructed box is empty and expands to fit whatever is added to it.
+ */
+template <typename T>
+class BasicBoundingBox {
 public:
-    double red;
-    double green;
-    double blue;
+    BasicPoint<T> min;
+    BasicPoint<T> max;
+
+    constexpr BasicBoundingBox():
+        min{BasicPoint<T>(std::numeric_limits<T>::infinity(),
+                          std::numeric_limits<T>::infinity(),
+                          std::numeric_limits<T>::infinity())},
+        max{BasicPoint<T>(-std::numeric_limits<T>::infinity(),
+                          -std::numeric_limits<T>::infinity(),
+                          -std::numeric_limits<T>::infinity())}
+    {}
+
+    constexpr BasicBoundingBox(BasicPoint<T> lo, BasicPoint<T> hi): min{lo}, max{hi} {}
+
+    constexpr void expand(BasicPoint<T> p) {
+        this->min = BasicPoint<T>(std::min(this->min.x, p.x),
+                                  std::min(this->min.y, p.y),
+                                  std::min(this->min.z, p.z));
+        this->max = BasicPoint<T>(std::max(this->max.x, p.x),
+                                  std::max(this->max.y, p.y),
+                                  std::max(this->max.z, p.z));
+    }
+
+    constexpr void expand(const BasicBoundingBox& other) {
+        this->expand(other.min);
+        this->expand(other.max);
+    }
+
+    /** Whether the point lies in the box, faces included. */
+    constexpr bool contains(BasicPoint<T> p) const {
+        return this->min.x <= p.x && p.x <= this->max.x &&
+            this->min.y <= p.y && p.y <= this->max.y &&
+            this->min.z <= p.z && p.z <= this->max.z;
+    }
 
-    Color();
-    Color(double, double, double);
+    constexpr BasicPoint<T> centroid() const {
+        return BasicPoint<T>(T(0.5) * (this->min.x + this->max.x),
+                             T(0.5) * (this->min.y + this->max.y),
+                             T(0.5) * (this->min.z + this->max.z));
+    }
 
-    Color operator+(Color);
-    Color& operator+=(Color);
+    constexpr T surface_area() const {
+        BasicVector<T> d = this->max - this->min;
+        if (d.x < 0 || d.y < 0 || d.z < 0) {
+            return 0.0;
+        }
+        return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
 
-    friend Color operator*(double, Color);
+    /** Check whether a ray enters this box at some time in [0, t_max]. The
+      inverse of each component of the ray's direction is passed in so that it
+      can be computed once per ray rather than once per box. */
+    constexpr bool hit(const BasicRay<T>& r, const BasicVector<T>& inv, T t_max) const {
+        // Slab test. A zero direction component gives an infinite inverse,
+        // and a ray strictly between the two planes of that slab gets the
+        // interval (-inf, inf) from it. A ray starting on a plane gets a NaN
+        // (0 * inf) for that plane. The argument order to min/max below
+        // makes a NaN for the min plane leave the interval unchanged, but a
+        // NaN for the max plane gives way to the min plane's infinite time,
+        // which empties the interval. So such a ray enters a box it lies on
+        // the min face of, but not one it lies on the max face of.
+        T t_min = 0.0;
+        T t0 = (this->min.x - r.start.x) * inv.x;
+        T t1 = (this->max.x - r.start.x) * inv.x;
+        t_min = std::max(t_min, std::min(t0, t1));
+        t_max = std::min(t_max, std::max(t0, t1));
+        t0 = (this->min.y - r.start.y) * inv.y;
+        t1 = (this->max.y - r.start.y) * inv.y;
+        t_min = std::max(t_min, std::min(t0, t1));
+        t_max = std::min(t_max, std::max(t0, t1));
+        t0 = (this->min.z - r.start.z) * inv.z;
+        t1 = (this->max.z - r.start.z) * inv.z;
+        t_min = std::max(t_min, std::min(t0, t1));
+        t_max = std::min(t_max, std::max(t0, t1));
+        return t_min <= t_max;
+    }
 };
 
+using Vector = BasicVector<Real>;
+using Point = BasicPoint<Real>;
+using Ray = BasicRay<Real>;
+using Color = BasicColor<Real>;
+using BoundingBox = BasicBoundingBox<Real>;
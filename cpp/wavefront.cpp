@@ -0,0 +1,198 @@
+#include <algorithm>
+
+#include "packet.hpp"
+#include "wavefront.hpp"
+
+namespace {
+
+/** Which of the eight octants a direction points into. Rays in the same
+  octant visit a BVH's children in the same order. */
+uint32_t octant(const Vector& v) {
+    return (v.x < 0) | (v.y < 0) << 1 | (v.z < 0) << 2;
+}
+
+}
+
+Wavefront::Wavefront(const Scene& s):
+    scene{s},
+    rays{},
+    reflections{},
+    hits{},
+    shadows{},
+    lit{},
+    order{},
+    colors{},
+    weights{},
+    bounces{},
+    throughputs{},
+    rngs{},
+    ends{}
+{}
+
+void Wavefront::intersect_all(TraceStats& stats) {
+    size_t n = this->rays.size();
+    this->hits.resize(n);
+    stats.rays += n;
+    size_t width = this->scene.packet_size;
+    if (width <= 1) {
+        for (size_t i = 0; i < n; i++) {
+            this->hits[i] = this->scene.intersect(this->rays[i].ray);
+        }
+        return;
+    }
+    for (size_t first = 0; first < n; first += width) {
+        RayPacket p(std::min(width, n - first));
+        for (size_t k = 0; k < p.size; k++) {
+            p.set(k, this->rays[first + k].ray);
+        }
+        this->scene.get_intersections(p, &this->hits[first]);
+    }
+}
+
+void Wavefront::shadow_all(TraceStats& stats) {
+    // order lists the rays which hit something; their shadow rays are
+    // traced in the same order.
+    this->order.clear();
+    this->shadows.clear();
+    for (size_t i = 0; i < this->rays.size(); i++) {
+        if (this->hits[i]) {
+            const Ray& r = this->rays[i].ray;
+            this->order.push_back(i);
+            this->shadows.push_back(this->scene.shadow_ray(r.at(this->hits[i]->t)));
+        }
+    }
+    this->lit.resize(this->rays.size());
+    size_t n = this->shadows.size();
+    stats.shadow_rays += n;
+    size_t width = this->scene.packet_size;
+    if (width <= 1) {
+        for (size_t s = 0; s < n; s++) {
+            this->lit[this->order[s]] = !this->scene.occluded(this->shadows[s], Scene::shadow_limit);
+        }
+        return;
+    }
+    for (size_t first = 0; first < n; first += width) {
+        RayPacket p(std::min(width, n - first));
+        for (size_t k = 0; k < p.size; k++) {
+            p.set(k, this->shadows[first + k]);
+        }
+        uint32_t blocked = this->scene.occluded(p, Scene::shadow_limit);
+        for (size_t k = 0; k < p.size; k++) {
+            this->lit[this->order[first + k]] = !((blocked >> k) & 1);
+        }
+    }
+}
+
+void Wavefront::shade_all(unsigned int depth, TraceStats& stats) {
+    size_t max = this->scene.max_reflections;
+    // Shade hits on the same object together.
+    std::sort(this->order.begin(), this->order.end(), [&](uint32_t a, uint32_t b) {
+        return this->hits[a]->object < this->hits[b]->object ||
+            (this->hits[a]->object == this->hits[b]->object && a < b);
+    });
+    this->reflections.clear();
+    for (uint32_t i : this->order) {
+        const PathRay& r = this->rays[i];
+        std::optional<Bounce> bounce;
+        Color c = this->scene.shade(*this->hits[i], r.ray, this->lit[i], depth, bounce);
+        if (bounce && this->scene.follow(*bounce, this->throughputs[r.path], depth,
+                                         this->rngs[r.path], stats)) {
+            size_t slot = r.path * max + this->bounces[r.path]++;
+            this->colors[slot] = c;
+            this->weights[slot] = bounce->weight;
+            this->reflections.push_back(
+                PathRay{bounce->ray, r.path, (uint32_t) this->hits[i]->object});
+        } else {
+            this->ends[r.path] = c;
+        }
+    }
+    for (size_t i = 0; i < this->rays.size(); i++) {
+        if (!this->hits[i]) {
+            this->ends[this->rays[i].path] = this->scene.background;
+        }
+    }
+}
+
+void Wavefront::trace(TraceStats& stats) {
+    size_t paths = this->rays.size();
+    size_t max = this->scene.max_reflections;
+    this->bounces.assign(paths, 0);
+    this->throughputs.assign(paths, 1.0);
+    this->ends.resize(paths);
+    this->colors.resize(paths * max);
+    this->weights.resize(paths * max);
+    for (unsigned int depth = 0; !this->rays.empty(); depth++) {
+        if (depth > 0) {
+            // Reflections off the same object in the same general direction
+            // tend to hit the same things.
+            std::sort(this->rays.begin(), this->rays.end(),
+                      [](const PathRay& a, const PathRay& b) {
+                uint32_t oa = octant(a.ray.direction);
+                uint32_t ob = octant(b.ray.direction);
+                return oa < ob || (oa == ob && (a.source < b.source ||
+                                                (a.source == b.source && a.path < b.path)));
+            });
+        }
+        this->intersect_all(stats);
+        this->shadow_all(stats);
+        this->shade_all(depth, stats);
+        std::swap(this->rays, this->reflections);
+    }
+    // Fold each path's colors from its deepest hit up, in the same order as
+    // Scene::complete_path.
+    for (size_t p = 0; p < paths; p++) {
+        Color c = this->ends[p];
+        for (size_t d = this->bounces[p]; d-- > 0;) {
+            c = multiply_add(this->weights[p * max + d], c, this->colors[p * max + d]);
+        }
+        this->ends[p] = c;
+    }
+}
+
+void Wavefront::render(size_t x0, size_t x1, size_t y0, size_t y1, Image& img,
+                       TraceStats& stats) {
+    size_t width = x1 - x0;
+    size_t antialias = this->scene.antialias;
+    std::vector<PixelSamples> samples(width * (y1 - y0));
+    std::vector<uint32_t> live;
+    for (size_t p = 0; p < samples.size() && antialias > 0; p++) {
+        live.push_back(p);
+    }
+    // Without adaptive sampling every sample of every pixel goes in one
+    // batch. Otherwise whether a pixel takes another sample depends on the
+    // ones before, so the samples are taken one round at a time.
+    bool adaptive = this->scene.adaptive_threshold > 0;
+    size_t round = adaptive ? 1 : antialias;
+    for (size_t n = 0; !live.empty(); n += round) {
+        size_t end = std::min(n + round, antialias);
+        this->rays.clear();
+        this->rngs.clear();
+        for (uint32_t p : live) {
+            size_t i = x0 + p % width;
+            size_t j = y0 + p / width;
+            for (size_t s = n; s < end; s++) {
+                Ray r = this->scene.camera_ray(i, j, s);
+                this->rays.push_back(PathRay{r, (uint32_t) this->rays.size(), 0});
+                this->rngs.push_back(this->scene.path_rng(j * this->scene.pixel_width + i, s));
+            }
+        }
+        this->trace(stats);
+        size_t path = 0;
+        size_t kept = 0;
+        for (uint32_t p : live) {
+            bool converged = false;
+            for (size_t s = n; s < end; s++) {
+                stats.samples++;
+                converged = samples[p].add(this->ends[path++], this->scene.adaptive_threshold,
+                                           this->scene.adaptive_min);
+            }
+            if (!converged && samples[p].n < antialias) {
+                live[kept++] = p;
+            }
+        }
+        live.resize(kept);
+    }
+    for (size_t p = 0; p < samples.size(); p++) {
+        img(x0 + p % width, y0 + p / width) = samples[p].average();
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "accel.hpp"
+#include "image.hpp"
+#include "rng.hpp"
+#include "scene.hpp"
+#include "types.hpp"
+
+/**
+ * Traces a block of pixels breadth first: every camera ray of the block is
+ * intersected, then every shadow ray, then every hit is shaded, and the
+ * reflections found while shading make up the next batch, until no rays are
+ * left. Each stage runs one kind of query over many rays, so the same
+ * traversal and shading code stays hot, and the batches are sorted to keep
+ * neighboring rays coherent.
+ *
+ * The colors are exactly those of Scene's depth-first tracer. Each hit's own
+ * color and reflection weight are kept along its path, and the reflections
+ * are folded in from the deepest bounce up, in the same order.
+ *
+ * The batches are reused from block to block, so each render thread needs its
+ * own Wavefront.
+ */
+class Wavefront {
+private:
+    /** A ray still to be traced, for one camera sample (its path). */
+    struct PathRay {
+        Ray ray;
+        uint32_t path;
+        // What the ray left from, to sort reflections by.
+        uint32_t source;
+    };
+
+    const Scene& scene;
+    std::vector<PathRay> rays;
+    std::vector<PathRay> reflections;
+    std::vector<std::optional<Hit>> hits;
+    std::vector<Ray> shadows;
+    std::vector<uint8_t> lit;
+    std::vector<uint32_t> order;
+    // The color and reflection weight of every hit which reflects, at most
+    // max_reflections per path.
+    std::vector<Color> colors;
+    std::vector<Real> weights;
+    std::vector<uint32_t> bounces;
+    // Each path's throughput and roulette stream, as Scene::follow takes
+    // them.
+    std::vector<double> throughputs;
+    std::vector<SampleRng> rngs;
+    // The color where each path ends: the background or a hit which does not
+    // reflect.
+    std::vector<Color> ends;
+
+    /** Trace the rays in `rays` and all of their reflections. */
+    void trace(TraceStats&);
+    void intersect_all(TraceStats&);
+    void shadow_all(TraceStats&);
+    void shade_all(unsigned int, TraceStats&);
+
+public:
+    Wavefront(const Scene&);
+
+    /** Compute the pixels in columns [x0, x1) and rows [y0, y1), taking
+      samples as Scene::compute_pixel_color does. */
+    void render(size_t, size_t, size_t, size_t, Image&, TraceStats&);
+};